@@ -133,6 +133,7 @@ struct Config {
   size_t batch_length = 500;
 
   bool binary = false;
+  bool compression = false;
   bool ignore_keynotfound = false;
   bool continuous_completing = false;
 };
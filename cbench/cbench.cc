@@ -20,6 +20,7 @@
 #include <cstring>
 #include <ctime>
 #include <format>
+#include <fstream>
 #include <memory>
 #include <mutex>
 #include <numbers>
@@ -354,6 +355,20 @@ std::optional<Usage> Usage::Load(const std::string &datadir) {
   }
   // NOLINTEND(concurrency-mt-unsafe)
 
+  int64_t bytes_read = 0;
+  int64_t bytes_written = 0;
+  if (std::ifstream io("/proc/self/io"); io) {
+    std::string name;
+    int64_t value = 0;
+    while (io >> name >> value) {
+      if (name == "read_bytes:") {
+        bytes_read = value;
+      } else if (name == "write_bytes:") {
+        bytes_written = value;
+      }
+    }
+  }
+
   return Usage{
       .ram = libc_usage.ru_maxrss,
       .disk = diskusage,
@@ -362,6 +377,9 @@ std::optional<Usage> Usage::Load(const std::string &datadir) {
       .iops_write = libc_usage.ru_oublock,
       .iops_page = libc_usage.ru_majflt,
 
+      .bytes_read = bytes_read,
+      .bytes_written = bytes_written,
+
       .cpu_user_ns = (libc_usage.ru_utime.tv_sec * 1'000'000'000) +
                      (libc_usage.ru_utime.tv_usec * 1000),
       .cpu_kernel_ns = (libc_usage.ru_stime.tv_sec * 1'000'000'000) +
@@ -378,11 +396,15 @@ void Usage::PrintUsage(const Usage &start, const Usage &fihish) {
          fihish.iops_write - start.iops_write,
          fihish.iops_page - start.iops_page);
 
+  const double mb = 1UL << 20UL;
+  printf("io: read %f, write %f\n",
+         static_cast<double>(fihish.bytes_read - start.bytes_read) / mb,
+         static_cast<double>(fihish.bytes_written - start.bytes_written) / mb);
+
   printf("cpu: user %f, system %f\n",
          static_cast<double>(fihish.cpu_user_ns - start.cpu_user_ns) / S,
          static_cast<double>(fihish.cpu_kernel_ns - start.cpu_kernel_ns) / S);
 
-  const double mb = 1UL << 20UL;
   printf("space: disk %f, ram %f\n",
          static_cast<double>(fihish.disk - start.disk) / mb,
          static_cast<double>(fihish.ram - start.ram) / mb);
@@ -89,6 +89,10 @@ struct Usage {
   int64_t iops_write;
   int64_t iops_page;
 
+  // The storage traffic, zero where the system doesn't account it
+  int64_t bytes_read;
+  int64_t bytes_written;
+
   int64_t cpu_user_ns;
   int64_t cpu_kernel_ns;
 
@@ -2,9 +2,16 @@
 // Licensed under the Apache License, Version 2.0 (the "License");
 // You may obtain a copy of the License at LICENSE file in the root.
 
+#include <nimbledb/codec.h>
 #include <nimbledb/db.h>
 
 #include <cassert>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
 
 #include "base.h"
 #include "driver.h"
@@ -15,7 +22,35 @@
       "Driver implementation requires `HAVE_NIMBLEDB` variable that includes the definitions"
 #endif  // !HAVE_NIMBLEDB
 
-struct DriverNimbleDBContext {};
+namespace {
+
+std::string_view ToStringView(std::span<char> span) {
+  return {span.data(), span.size()};
+}
+
+// The benchmark only reads the records returned by the driver
+std::span<char> ToSpan(std::string_view view) {
+  return {const_cast<char*>(view.data()), view.size()};
+}
+
+}  // namespace
+
+struct DriverNimbleDBContext {
+  std::unique_ptr<nimbledb::Iterator> it = nullptr;
+
+  // The returned record points into the iterator, so the iterator is moved
+  // only on the next call
+  bool advance = false;
+
+  // Modifications of a batch are collected and written at its end
+  std::unique_ptr<nimbledb::WriteBatch> batch = nullptr;
+
+  // The results of the deferred callbacks
+  Result result = Result::kOk;
+
+  // The lookups copy the values here, so they don't allocate
+  std::string value;
+};
 
 class DriverNimbleDB final : public Driver {
  public:
@@ -32,15 +67,52 @@ class DriverNimbleDB final : public Driver {
   Result Done(Context ctx, BenchType step) override;
 
  private:
+  // Runs the callbacks of the issued commits and returns their result
+  Result Wait(DriverNimbleDBContext* ctx, BenchType step);
+
   Config* config_ = nullptr;
 
+  // Shared by all worker threads, the callbacks of one thread's operations
+  // may be run by another one but have returned once its Wait() is done
   std::shared_ptr<nimbledb::DB> db_ = nullptr;
 };
 
 Result DriverNimbleDB::Open(Config* config, const std::string& datadir) {
   config_ = config;
 
-  auto st = nimbledb::DB::Open(datadir + "/datafile.nmbl", {}, &db_);
+  nimbledb::Options options;
+
+  switch (config_->syncmode) {
+    case kModeSync:
+      options.sync = true;
+      break;
+    case kModeLazy:
+    case kModeNoSync:
+      options.sync = false;
+      break;
+    default:
+      Fatal("error: {}(): unsupported syncmode {}", __func__,
+            to_string(config_->syncmode));
+  }
+
+  switch (config_->walmode) {
+    case kWalDefault:
+    case kWalEnabled:
+      options.wal = true;
+      break;
+    case kWalDisabled:
+      options.wal = false;
+      break;
+    default:
+      Fatal("error: {}(): unsupported walmode {}", __func__,
+            to_string(config_->walmode));
+  }
+
+  if (config_->compression) {
+    options.compression = nimbledb::NewLzCodec();
+  }
+
+  auto st = nimbledb::DB::Open(datadir + "/datafile.nmbl", options, &db_);
   if (!st.IsOk()) {
     Log("error: {}, {}", __func__, st.ToString());
     return Result::kUnexpectedError;
@@ -51,6 +123,11 @@ Result DriverNimbleDB::Open(Config* config, const std::string& datadir) {
 
 Result DriverNimbleDB::Close() {
   if (db_ != nullptr) {
+    // The datafile traffic as stored, the compressed pages take less
+    const auto stats = db_->GetStatistics();
+    Log("nimbledb: page bytes read {}, written {}", stats.page_bytes_read,
+        stats.page_bytes_written);
+
     auto st = db_->Close();
     if (!st.IsOk()) {
       Log("error: {}, {}", __func__, st.ToString());
@@ -70,19 +147,156 @@ void DriverNimbleDB::ThreadDispose(Context ctx) {
   delete static_cast<DriverNimbleDBContext*>(ctx);
 }
 
-Result DriverNimbleDB::Begin(Context /*ctx*/, BenchType /*step*/) {
+Result DriverNimbleDB::Begin(Context ctxptr, BenchType step) {
+  auto* ctx = static_cast<DriverNimbleDBContext*>(ctxptr);
+
+  switch (step) {
+    case kTypeGet:
+    case kTypeSet:
+    case kTypeDelete:
+      break;
+
+    case kTypeBatch:
+    case kTypeCrud:
+      ctx->batch = std::make_unique<nimbledb::WriteBatch>();
+      break;
+
+    case kTypeIterate: {
+      ctx->it = db_->NewIterator();
+      ctx->advance = false;
+      if (auto st = ctx->it->SeekToFirst(); !st.IsOk()) {
+        Log("error: {}, {}, {}", __func__, to_string(step), st.ToString());
+        return Result::kUnexpectedError;
+      }
+      break;
+    }
+
+    default:
+      Unreachable();
+  }
+
   return Result::kOk;
 }
 
-Result DriverNimbleDB::Next(Context /*ctx*/, BenchType /*step*/,
-                            Record* /*kv*/) {
-  return Result::kOk;
+Result DriverNimbleDB::Next(Context ctxptr, BenchType step, Record* kv) {
+  auto* ctx = static_cast<DriverNimbleDBContext*>(ctxptr);
+
+  auto result = Result::kOk;
+
+  switch (step) {
+    case kTypeSet:
+      if (ctx->batch != nullptr) {
+        ctx->batch->Put(ToStringView(kv->key), ToStringView(kv->value));
+        break;
+      }
+      db_->Put(ToStringView(kv->key), ToStringView(kv->value),
+               [ctx, step](const nimbledb::Status& st, bool) {
+                 if (!st.IsOk()) {
+                   Log("error: {}, {}, {}", "Put", to_string(step),
+                       st.ToString());
+                   ctx->result = Result::kUnexpectedError;
+                 }
+               });
+      return Wait(ctx, step);
+
+    case kTypeDelete:
+      if (ctx->batch != nullptr) {
+        ctx->batch->Delete(ToStringView(kv->key));
+        break;
+      }
+      db_->Delete(ToStringView(kv->key),
+                  [ctx, step](const nimbledb::Status& st, bool found) {
+                    if (!st.IsOk()) {
+                      Log("error: {}, {}, {}", "Delete", to_string(step),
+                          st.ToString());
+                      ctx->result = Result::kUnexpectedError;
+                    } else if (!found) {
+                      ctx->result = Result::kNotFound;
+                    }
+                  });
+      return Wait(ctx, step);
+
+    case kTypeGet:
+      db_->Get(ToStringView(kv->key), &ctx->value,
+               [&](const nimbledb::Status& st, bool found) {
+                 if (!st.IsOk()) {
+                   Log("error: {}, {}, {}", __func__, to_string(step),
+                       st.ToString());
+                   result = Result::kUnexpectedError;
+                 } else if (!found && ctx->batch == nullptr) {
+                   // The keys of the unwritten batch aren't visible yet
+                   result = Result::kNotFound;
+                 }
+               });
+      break;
+
+    case kTypeIterate: {
+      if (ctx->advance) {
+        if (auto st = ctx->it->Next(); !st.IsOk()) {
+          Log("error: {}, {}, {}", __func__, to_string(step), st.ToString());
+          return Result::kUnexpectedError;
+        }
+      }
+      if (!ctx->it->Valid()) {
+        kv->key = std::span<char>();
+        kv->value = std::span<char>();
+        return Result::kNotFound;
+      }
+
+      kv->key = ToSpan(ctx->it->key());
+      kv->value = ToSpan(ctx->it->value());
+      ctx->advance = true;
+      break;
+    }
+
+    default:
+      Unreachable();
+  }
+
+  return result;
 }
 
-Result DriverNimbleDB::Done(Context /*ctx*/, BenchType /*step*/) {
+Result DriverNimbleDB::Done(Context ctxptr, BenchType step) {
+  auto* ctx = static_cast<DriverNimbleDBContext*>(ctxptr);
+
+  switch (step) {
+    case kTypeGet:
+    case kTypeSet:
+    case kTypeDelete:
+      break;
+
+    case kTypeBatch:
+    case kTypeCrud: {
+      const auto batch = std::move(ctx->batch);
+      db_->Write(*batch, [ctx, step](const nimbledb::Status& st) {
+        if (!st.IsOk()) {
+          Log("error: {}, {}, {}", "Write", to_string(step), st.ToString());
+          ctx->result = Result::kUnexpectedError;
+        }
+      });
+      return Wait(ctx, step);
+    }
+
+    case kTypeIterate:
+      ctx->it = nullptr;
+      break;
+
+    default:
+      Unreachable();
+  }
+
   return Result::kOk;
 }
 
+Result DriverNimbleDB::Wait(DriverNimbleDBContext* ctx, BenchType step) {
+  if (auto st = db_->Wait(); !st.IsOk()) {
+    Log("error: {}, {}, {}", __func__, to_string(step), st.ToString());
+    return Result::kUnexpectedError;
+  }
+
+  return std::exchange(ctx->result, Result::kOk);
+}
+
 Driver* driver_nimbledb() {
   static DriverNimbleDB instance;
   return &instance;
@@ -14,6 +14,7 @@
 #include <memory>
 #include <optional>
 #include <thread>
+#include <vector>
 
 #include "base.h"
 #include "cbench.h"
@@ -103,6 +104,13 @@ int main(int argc, char *argv[]) {
 
   Histogram histograms(config.benchmarks);
 
+  // No early return once the workers are started, they must be joined
+  if (auto it = Usage::Load(datadir)) {
+    rusage_start = *it;
+  } else {
+    return EXIT_FAILURE;
+  }
+
   // finally launch the benchmark
   std::atomic_bool failed = false;
   std::latch l_start(static_cast<ptrdiff_t>(config.rthr + config.wthr + 1U));
@@ -111,12 +119,16 @@ int main(int argc, char *argv[]) {
   int nth = 0;
   int key_space = 0;
 
+  // The workers are destroyed by their threads, which are joined before the
+  // driver and the histograms are
+  std::vector<std::thread> threads;
+  threads.reserve(config.rthr + config.wthr);
   const auto run_worker_thread = [&](BenchTypeMask mask) {
     auto worker =
         std::make_unique<Worker>(nth, mask, key_space, nth, keyer_options,
                                  &config, driver, &histograms, failed);
 
-    std::thread([&, worker = std::move(worker)]() {
+    threads.emplace_back([&, worker = std::move(worker)]() {
       l_start.arrive_and_wait();
       if (const int rc = worker->FulFil(); rc != 0) {
         failed = true;
@@ -140,12 +152,6 @@ int main(int argc, char *argv[]) {
     run_worker_thread(set_wr);
   }
 
-  if (auto it = Usage::Load(datadir)) {
-    rusage_start = *it;
-  } else {
-    return EXIT_FAILURE;
-  }
-
   sync();
 
   if ((set_wr | set_rd) != 0) {
@@ -162,6 +168,9 @@ int main(int argc, char *argv[]) {
   }
 
   l_finish.arrive_and_wait();
+  for (auto &thread : threads) {
+    thread.join();
+  }
 
   if (failed) {
     Log("error: benchmark finished with error");
@@ -228,6 +237,7 @@ void PrintConfig(const Config &config) {
   Log("\tw-threads    = {}", config.wthr);
   Log("");
   Log("\tbinary                = {}", config.binary ? "yes" : "no");
+  Log("\tcompression           = {}", config.compression ? "yes" : "no");
   Log("\tignore not found      = {}", config.ignore_keynotfound ? "yes" : "no");
   Log("\tcontinuous completing = {}",
       config.continuous_completing ? "yes" : "no");
@@ -306,6 +316,9 @@ Config ParseConfig(std::span<char *> args,
 
   app.add_flag("--binary", config.binary, "generate binary (non ASCII) values")
       ->default_val(config.binary);
+  app.add_flag("--compression", config.compression,
+               "compress the data if the database supports it")
+      ->default_val(config.compression);
   app.add_flag("--continuous", config.continuous_completing,
                "continuous completing mode")
       ->default_val(config.continuous_completing);
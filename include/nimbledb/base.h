@@ -6,8 +6,11 @@
 #define NIMBLEDB_BASE_H_
 
 #include <functional>
+#include <memory>
 #include <span>
 #include <string>
+#include <type_traits>
+#include <utility>
 
 #ifndef NDEBUG
   #define NIMBLEDB_ASSERT_STATUS_CHECKED
@@ -138,7 +141,8 @@ class NIMBLEDB_EXPORT Status {
     kNoMemory = 1,
     kIOError = 2,
     kCorruptedDatafile = 3,
-    kMaxCode = kCorruptedDatafile + 1,
+    kInvalidArgument = 4,
+    kMaxCode = kInvalidArgument + 1,
   };
   [[nodiscard]] Code code() const {
     MarkChecked();
@@ -181,6 +185,10 @@ class NIMBLEDB_EXPORT Status {
                                   const std::string& msg2 = "") {
     return {kCorruptedDatafile, msg, msg2};
   }
+  static Status InvalidArgument(const std::string& msg = "",
+                                const std::string& msg2 = "") {
+    return {kInvalidArgument, msg, msg2};
+  }
 
   [[nodiscard]] bool IsOk() const { return code() == kOk; }
   [[nodiscard]] bool IsOOM() const { return code() == kNoMemory; }
@@ -188,6 +196,9 @@ class NIMBLEDB_EXPORT Status {
   [[nodiscard]] bool IsCorruptedDatafile() const {
     return code() == kCorruptedDatafile;
   }
+  [[nodiscard]] bool IsInvalidArgument() const {
+    return code() == kInvalidArgument;
+  }
 
   // Return a string representation of this status suitable for printing.
   // Returns the string "OK" for success.
@@ -273,6 +284,40 @@ inline bool Status::operator!=(const Status& rhs) const {
 template <typename... Args>
 using Callback = std::function<void(Status, Args...)>;
 
+// A non-owning reference to a callable, for the callbacks invoked before the
+// function taking them returns. It's two pointers passed by value: nothing is
+// allocated or copied, the callable must outlive the reference.
+template <typename Signature>
+class FunctionRef;
+
+template <typename R, typename... Args>
+class FunctionRef<R(Args...)> {
+ public:
+  template <typename Function>
+    requires(!std::is_same_v<std::remove_cvref_t<Function>, FunctionRef> &&
+             std::is_invocable_r_v<R, Function&, Args...>)
+  // NOLINTNEXTLINE(google-explicit-constructor)
+  FunctionRef(Function&& function)
+      : object_(const_cast<void*>(  // NOLINT(*-const-cast)
+            static_cast<const void*>(std::addressof(function)))),
+        invoke_([](void* object, Args... args) -> R {
+          return std::invoke(
+              *static_cast<std::remove_reference_t<Function>*>(object),
+              std::forward<Args>(args)...);
+        }) {}
+
+  R operator()(Args... args) const {
+    return invoke_(object_, std::forward<Args>(args)...);
+  }
+
+ private:
+  void* object_;
+  R (*invoke_)(void*, Args...);
+};
+
+template <typename... Args>
+using CallbackRef = FunctionRef<void(Status, Args...)>;
+
 using RWBuffer = std::span<std::byte>;
 using ROBuffer = std::span<const std::byte>;
 
@@ -0,0 +1,50 @@
+// Copyright 2025 Nikolay Govorov. All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at LICENSE file in the root.
+
+#ifndef NIMBLEDB_CODEC_H_
+#define NIMBLEDB_CODEC_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "nimbledb/base.h"
+
+namespace NIMBLEDB_NAMESPACE {
+
+// Compression of the pages written to the datafile, see Options::compression.
+//
+// The methods are called concurrently by the threads reading and writing the
+// pages, so the codec must be thread safe.
+class NIMBLEDB_EXPORT Codec {
+ public:
+  Codec() = default;
+  virtual ~Codec() = default;
+
+  Codec(const Codec&) = delete;
+  Codec(Codec&&) = delete;
+  Codec& operator=(const Codec&) = delete;
+  Codec& operator=(Codec&&) = delete;
+
+  // Identifies the format in the datafile, a datafile is opened only with the
+  // codec it was written with. Zero means no compression.
+  [[nodiscard]] virtual uint32_t id() const = 0;
+
+  // Returns the compressed size or zero if the output doesn't fit the buffer
+  virtual size_t Compress(ROBuffer input, RWBuffer output) const = 0;
+
+  // Restores exactly `output.size()` bytes, returns false if the input is
+  // malformed. The buffers are never accessed out of their bounds, whatever
+  // the input holds.
+  virtual bool Decompress(ROBuffer input, RWBuffer output) const = 0;
+};
+
+// The built-in codec of the LZ77 family (the LZ4 block format): a single pass
+// with a hash table of the recent positions, no entropy coding. It's fast
+// enough to be used on every page read and write.
+NIMBLEDB_EXPORT std::shared_ptr<const Codec> NewLzCodec();
+
+}  // namespace NIMBLEDB_NAMESPACE
+
+#endif  // NIMBLEDB_CODEC_H_
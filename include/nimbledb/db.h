@@ -5,19 +5,244 @@
 #ifndef NIMBLEDB_NIMBLEDB_H_
 #define NIMBLEDB_NIMBLEDB_H_
 
-#include <map>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <set>
 #include <string>
 #include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "nimbledb/base.h"
+#include "nimbledb/codec.h"
 #include "nimbledb/system.h"
 
 namespace NIMBLEDB_NAMESPACE {
 
-struct NIMBLEDB_EXPORT Options {};
+struct NIMBLEDB_EXPORT Options {
+  // Memory budget of the page cache in bytes. Once it is exhausted, a page not
+  // used since the last sweep of the CLOCK hand is evicted, an approximation
+  // of the least recently used one.
+  size_t cache_size = 64 << 20;
 
+  // Log the modifications to `<filename>.wal`. The log is replayed when the
+  // database is opened, over the tree of the last commit, see
+  // `copy_on_write`. Without the log the changes after the last commit are
+  // lost by a crash.
+  bool wal = true;
+
+  // Invoke Put/Delete callbacks once the log record is on disk, use Wait() to
+  // run the callbacks. The commits made while the log is being synced are
+  // synced together by the next write.
+  //
+  // Otherwise the records are buffered and written without a sync, once 64KB
+  // of them are collected and by Wait(). A crash of the process loses the
+  // records not written yet, a crash of the system also the ones written
+  // since the last checkpoint, see Sync().
+  bool sync = false;
+
+  // The pages are written back and the log is emptied once the log grows
+  // over this size
+  size_t wal_checkpoint_size = 64 << 20;
+
+  // Values larger than this are stored in chains of overflow pages and the
+  // leaf keeps a reference to the chain, so large values don't take the room
+  // of the small entries in the leaves. A chain takes whole pages.
+  size_t max_inline_value = 4096;
+
+  // Append the values of at least `value_log_threshold` bytes to the value
+  // log `<filename>.vlog.<n>` instead of the tree, the leaf keeps a reference
+  // to the value. The values are written once instead of with every write-back
+  // of their leaves, which pays off for the large values updated rarely. The
+  // log is split into segments of `value_log_segment_size`, a checkpoint
+  // collects the oldest segment once `value_log_gc_ratio` of it is overwritten
+  // or deleted values: the live ones are appended again and the segment is
+  // removed. The commits keep the bytes of the live values of every segment
+  // in the meta page, the open recounts them with a scan of the leaves only
+  // past about 8000 segments. The values logged before remain readable when
+  // the option is off.
+  bool value_log = false;
+  size_t value_log_threshold = 512;
+  size_t value_log_segment_size = 64 << 20;
+  double value_log_gc_ratio = 0.5;
+
+  // Never overwrite the pages of the last commit: a page is copied to a free
+  // one before its first modification and the commit switches to the new root
+  // with the meta page. The commits keep the free pages in the meta page as
+  // the runs of adjacent pages, the open finds them with a scan of the tree
+  // only past about 4000 runs.
+  //
+  // Otherwise the modified pages are written back to their own slots, by the
+  // checkpoints and by the evictions from the cache. The committed image of a
+  // page is saved to `<filename>.journal` before it's overwritten the first
+  // time, and the open writes the images back. Either way a crash leaves the
+  // tree of the last commit, copy-on-write writes each page once though.
+  bool copy_on_write = false;
+
+  // Compress the pages written to the datafile, see NewLzCodec(). A page is
+  // stored as an extent of the blocks its compressed form takes, so less is
+  // written and read, and the rest of its slot is punched out of the datafile
+  // to save the space. The cached pages stay uncompressed. The codec can't be
+  // changed once the datafile is created.
+  std::shared_ptr<const Codec> compression;
+
+  // Keep a Bloom filter of the keys in memory, so most lookups of the absent
+  // keys are answered without reading a page. The filter takes this many
+  // bytes, about 10 bits per key keep the false positives around 1%. The open
+  // doesn't scan the tree for it: the reads and the writes add the keys of a
+  // few leaves each, and the lookups use the filter once all leaves are
+  // added. The removed keys stay in it until the next open. Zero disables the
+  // filter.
+  size_t bloom_filter_size = 0;
+
+  // Map the datafile into memory and read the pages from the mapping, so a
+  // page missing from the cache costs no system call or copy and the kernel's
+  // page cache keeps the pages read. Only the modified pages take the memory
+  // of the cache, which suits the read-mostly databases. A page is verified
+  // with its checksum when it's read from the mapping into the cache. The
+  // datafile can't be compressed.
+  bool mmap_reads = false;
+};
+
+// Counters of the database activity since it was opened, see
+// DB::GetStatistics()
+struct NIMBLEDB_EXPORT Statistics {
+  // The bytes of the pages read from and written to the datafile, as they are
+  // stored there
+  uint64_t page_bytes_read = 0;
+  uint64_t page_bytes_written = 0;
+
+  // The lookups of the absent keys answered by the Bloom filter
+  uint64_t filtered_lookups = 0;
+};
+
+// A consistent read view of the database, see DB::GetSnapshot(). The view is
+// released with the last reference to it, which must be dropped before the
+// database is destroyed.
+class NIMBLEDB_EXPORT Snapshot {
+ private:
+  friend class DB;
+
+  Snapshot(int64_t root_id, uint64_t version)
+      : root_id_(root_id), version_(version) {}
+
+  int64_t root_id_;
+  uint64_t version_;
+};
+
+struct NIMBLEDB_EXPORT IteratorOptions {
+  // The iterator only visits the keys in [lower_bound, upper_bound), a missing
+  // bound doesn't limit the range.
+  std::optional<std::string> lower_bound;
+  std::optional<std::string> upper_bound;
+
+  // Read the snapshot instead of the current state, the modifications made
+  // after it are not visible to the iterator
+  std::shared_ptr<const Snapshot> snapshot;
+};
+
+// Ordered cursor over the database keys.
+//
+// The iterator pins the leaf it points to and moves along the leaf siblings,
+// so a scan descends from the root only when it's positioned. In the
+// copy-on-write mode the leaves aren't linked and the neighbor leaf is found
+// by the separator keys. The entries are read from a copy of the leaf, so
+// the writers don't block the iterator. If the leaf is modified, the next move
+// finds the current key in the tree again.
+//
+// An iterator must not be shared between threads.
+//
+// The iterator must be destroyed before the database it was created by.
+class NIMBLEDB_EXPORT Iterator {
+ public:
+  Iterator() = default;
+  virtual ~Iterator() = default;
+
+  // No copying & moving allowed
+  Iterator(Iterator&) = delete;
+  Iterator(Iterator&&) = delete;
+  Iterator& operator=(Iterator&&) = delete;
+  void operator=(const Iterator&) = delete;
+
+  // Whether the iterator points to an entry. An error or a move past the end
+  // of the range invalidates the iterator.
+  [[nodiscard]] virtual bool Valid() const = 0;
+
+  // Positions at the first/last entry of the range
+  virtual Status SeekToFirst() = 0;
+  virtual Status SeekToLast() = 0;
+
+  // Positions at the first entry with the key not less than `key`
+  virtual Status Seek(std::string_view key) = 0;
+
+  // Positions at the last entry with the key not greater than `key`
+  virtual Status SeekForPrev(std::string_view key) = 0;
+
+  // Move to the neighbor entry, the iterator must be valid
+  virtual Status Next() = 0;
+  virtual Status Prev() = 0;
+
+  // The key and the value stay valid until the iterator is moved
+  [[nodiscard]] virtual std::string_view key() const = 0;
+  [[nodiscard]] virtual std::string_view value() const = 0;
+};
+
+// A group of modifications applied atomically by DB::Write().
+//
+// The modifications are encoded into a single buffer as
+// | type | key size | value size | key | value |, the same buffer is the
+// payload of the batch record in the write-ahead log. The modifications of
+// the same key are applied in the order they were added.
+class NIMBLEDB_EXPORT WriteBatch {
+ public:
+  void Put(std::string_view key, std::string_view value);
+  void Delete(std::string_view key);
+
+  void Clear();
+
+  // Number of the modifications in the batch
+  [[nodiscard]] size_t Count() const { return count_; }
+
+ private:
+  friend class DB;
+
+  enum class Type : uint8_t { kPut = 1, kDelete = 2 };
+
+  // A modification pointing into the buffer
+  struct Op {
+    Type type;
+    std::string_view key;
+    std::string_view value;
+  };
+
+  void Append(Type type, std::string_view key, std::string_view value);
+
+  // Splits the encoded batch into the modifications
+  static Status Decode(std::string_view rep, std::vector<Op>* ops);
+
+  std::string rep_;
+  size_t count_ = 0;
+};
+
+class BloomFilter;
+class BufferPool;
+class Journal;
+class ValueLog;
+class WriteAheadLog;
+
+// The methods may be called from several threads, except Close() which must
+// be the last call. The modifications are serialized by a mutex, the reads
+// descend the tree with optimistic lock coupling: every node has a version
+// which is odd while the writer modifies the node, the readers take no locks
+// and restart when a version they read has changed. The callbacks may be
+// invoked by any thread running the event loop and must not call the database
+// back.
 class NIMBLEDB_EXPORT DB {
  public:
   // No copying & moving allowed
@@ -36,16 +261,82 @@ class NIMBLEDB_EXPORT DB {
   // Use this method instead of the implicit destructor to handle errors.
   Status Close();
 
-  // Find key in database, return std::nullopt if not found
+  // Find key in database, return std::nullopt if not found. The lookups
+  // invoke the callback before they return, so it's taken by reference.
   void Get(std::string_view key,
-           const Callback<std::optional<std::string>>& callback);
+           CallbackRef<std::optional<std::string>> callback);
+
+  // Find key in the database as of the snapshot
+  void Get(const Snapshot& snapshot, std::string_view key,
+           CallbackRef<std::optional<std::string>> callback);
+
+  // Same as above, but the value is copied to `value`, which is reused
+  // without an allocation if its capacity suffices. The buffer is cleared if
+  // the key isn't found.
+  void Get(std::string_view key, std::string* value,
+           CallbackRef<bool /* found */> callback);
+  void Get(const Snapshot& snapshot, std::string_view key, std::string* value,
+           CallbackRef<bool /* found */> callback);
+
+  // Find key in the database as of the snapshot without copying the value:
+  // the view refers to the page, which is pinned until the callback returns.
+  // The snapshot's pages are never modified, so the view stays consistent.
+  // A value stored out of the leaf is read into a temporary string.
+  void GetView(const Snapshot& snapshot, std::string_view key,
+               CallbackRef<std::optional<std::string_view>> callback);
 
-  // Add key to database, overrite if key exists
-  void Put(std::string_view key, std::string_view value,
-           const Callback<bool /* rewritten */>& callback);
+  // Add key to database, overrite if key exists. The callback is invoked
+  // before the method returns, except in the sync mode: then it's copied to
+  // wait for the log and invoked by Wait(), so it must be copyable.
+  template <typename Function>
+    requires std::is_invocable_v<Function&, Status, bool /* rewritten */>
+  void Put(std::string_view key, std::string_view value, Function&& callback);
 
-  // Delete key from database. Returns succes if key not found.
-  void Delete(std::string_view key, const Callback<bool /* found */>& callback);
+  // Delete key from database. Returns succes if key not found. The callback
+  // is invoked as the one of Put().
+  template <typename Function>
+    requires std::is_invocable_v<Function&, Status, bool /* found */>
+  void Delete(std::string_view key, Function&& callback);
+
+  // Applies all modifications of the batch or none of them. The batch is
+  // logged as a single record and is committed as a whole.
+  void Write(const WriteBatch& batch, const Callback<>& callback);
+
+  // Returns the next entry of a bulk load or false at the end of the input,
+  // the entry must stay valid until the next call
+  using BulkLoadSource =
+      std::function<bool(std::string_view* key, std::string_view* value)>;
+
+  // Fills the empty database with the entries in the ascending order of the
+  // keys, a database emptied by deletes is loaded as well. The leaves are
+  // built one after another with `fill_factor` of their space taken, then the
+  // interior levels on top of them. The pages are written in large batches of
+  // the ascending offsets and the load is committed as a whole at the end, it
+  // isn't logged.
+  Status BulkLoad(const BulkLoadSource& next, double fill_factor = 0.9);
+
+  // Runs the event loop until all pending I/O is done and the callbacks of
+  // the issued operations have been invoked. Without Options::sync it writes
+  // the buffered log records first.
+  Status Wait();
+
+  // Writes back the modified pages, commits them with the meta page and
+  // empties the log. After a failed write of the log the writes fail and
+  // nothing is committed anymore, the database must be reopened to recover
+  // the logged changes.
+  Status Sync();
+
+  // Creates an unpositioned iterator, one of the seek methods must be called
+  // before the iterator is used
+  std::unique_ptr<Iterator> NewIterator(const IteratorOptions& options = {});
+
+  // Captures the current state of the database. The pages visible to the
+  // snapshot are never modified: the writer copies them and they are reused
+  // only once all snapshots seeing them are released. Requires the
+  // copy-on-write mode.
+  Status GetSnapshot(std::shared_ptr<const Snapshot>* snapshot_ptr);
+
+  [[nodiscard]] Statistics GetStatistics() const;
 
 #ifndef NDEBUG
   // For debug purposes, return a graphical representation of the tree
@@ -54,20 +345,208 @@ class NIMBLEDB_EXPORT DB {
 
  protected:
   struct BTreeNode;
-  struct BTreeNodeKey;
-  struct BTreeNodeVal;
+  struct Entry;
+
+  // Pinned b-tree node, see db.cc
+  class NodeRef;
+
+  // A node on the way from the root, see db.cc
+  struct PathNode;
+
+  // The path of the last modification, see db.cc
+  struct WritePath;
+
+  // The separator keys around a leaf, see db.cc
+  struct LeafBounds;
+
+  // The superblock, see db.cc
+  struct Meta;
+
+  class IteratorImpl;
 
   using NodeId = int64_t;
-  using NodeType = enum : uint8_t { kInterior, kLeaf };
+  using NodeType = enum : uint8_t { kInterior, kLeaf, kFree, kOverflow };
+
+  // Where the value of a leaf entry is, the leaf holds a reference to the
+  // value stored out of it
+  enum class ValueType : uint8_t { kInline, kOverflow, kLog };
+
+  // A page replaced by the writer, the views of the versions in
+  // [sequence, retired) may still read it
+  struct RetiredPage {
+    NodeId id;
+    uint64_t sequence;
+    uint64_t retired;
+  };
 
   DB(Options options, std::unique_ptr<OS> os, std::unique_ptr<File> datafile);
 
-  void NodeSplit(const std::shared_ptr<BTreeNode>& x, NodeId child_id);
-  void NodeInsert(NodeId node_id, std::string_view k, std::string_view v);
+  // Returns an error if the entry can't be stored
+  static Status CheckEntry(std::string_view key, std::string_view value);
 
-  auto AddNode(NodeType page_type) -> std::shared_ptr<BTreeNode>;
-  auto GetNode(NodeId id) -> std::shared_ptr<BTreeNode>;
-  Status Sync();
+  // Modify the tree without logging. The path is reused by the following
+  // modifications of the keys in the same leaf. A failed modification leaves
+  // the key as it was: a large value is stored before the entry is replaced
+  // and the replaced one is released after.
+  Status Insert(std::string_view key, std::string_view value, bool* rewritten,
+                WritePath* path);
+  Status Remove(std::string_view key, bool* found, WritePath* path);
+
+  // Applies the last modification of every key in the key order, so the keys
+  // of the same leaf are found with a single descent. Either all of them are
+  // applied or none: the values are stored first, and a failure to modify the
+  // tree puts the replaced entries back.
+  Status Apply(std::vector<WriteBatch::Op> ops);
+
+  // Put the entry of a stored value into the tree or take the key's entry
+  // out of it. The replaced or removed entry is handed to the caller, to
+  // release its value once the modification is done or to put it back. A
+  // failure leaves the key's entry in place, unless the entry has been
+  // `placed` or taken before a split or a merge above the leaf failed, which
+  // leaves the tree broken.
+  Status PlaceEntry(std::string_view key, std::string_view value,
+                    ValueType value_type, std::optional<Entry>* replaced,
+                    bool* placed, WritePath* path);
+  Status TakeEntry(std::string_view key, std::optional<Entry>* removed,
+                   WritePath* path);
+
+  // Finds the leaf the key belongs to in the current tree or in the one of
+  // the snapshot, a missing key finds the rightmost leaf. The separators on
+  // the way bound the keys of the leaf. The leaf's content is read
+  // optimistically and must be validated against the returned version, no
+  // leaf is returned for an empty tree.
+  Status FindLeaf(const Snapshot* snapshot,
+                  std::optional<std::string_view> key, NodeRef* leaf_ptr,
+                  uint64_t* version_ptr, LeafBounds* bounds = nullptr);
+
+  Status Lookup(const Snapshot* snapshot, std::string_view key,
+                std::string* value, bool* found);
+
+  // The modifications of Put() and Delete() under the mutex, the callback is
+  // invoked with the returned status. In the sync mode `*deferred` is set
+  // instead: the log invokes the waiter made by `defer` once the record is
+  // durable.
+  using MakeWaiter = FunctionRef<Callback<>()>;
+  Status PutEntry(std::string_view key, std::string_view value,
+                  bool* rewritten, bool* deferred, MakeWaiter defer);
+  Status DeleteEntry(std::string_view key, bool* found, bool* deferred,
+                     MakeWaiter defer);
+
+  // Finds the path to the leaf the key belongs to, the path of the previous
+  // modification is reused if the key is in its leaf
+  Status Descend(std::string_view key, WritePath* path, bool* found);
+
+  // Inserts the entry at the last node of the path, nodes without enough
+  // space are split bottom up. A failed split leaves its node as it was.
+  Status NodeInsert(std::vector<PathNode>* path, std::string_view key,
+                    std::string_view value, NodeId child,
+                    ValueType value_type);
+  Status NodeSplit(const NodeRef& node, size_t pos, Entry entry, bool append,
+                   Entry* promoted);
+
+  // The nodes of a level built by a bulk load with the separators before them
+  using BulkLevel = std::vector<std::pair<std::string, NodeId>>;
+
+  // Builds the leaves from the input, then the parents of the level until
+  // the root is left. The created pages are written back once half of the
+  // cache is dirty, `dirty` counts them.
+  Status BulkLoadLeaves(const BulkLoadSource& next, size_t budget,
+                        BulkLevel* level, std::vector<NodeId>* created,
+                        size_t* dirty);
+  Status BulkLoadLevel(size_t budget, BulkLevel* level,
+                       std::vector<NodeId>* created, size_t* dirty);
+  Status BulkLoadFlush(size_t* dirty);
+
+  // Restores the fill of the last node of the path after a removal: borrows
+  // entries from a sibling or merges with it, then shrinks the root if it has
+  // a single child left
+  Status NodeRebalance(std::vector<PathNode>* path);
+
+  // Large values are kept in chains of overflow pages, the leaf entry holds
+  // the encoded reference to the chain
+  Status WriteOverflow(std::string_view value, std::string* ref);
+  Status FreeOverflow(std::string_view ref);
+
+  // Copies the value of the chain referenced by the leaf. The chain is freed
+  // only with the leaf modified, so `valid` is reset if the leaf doesn't
+  // validate after the read.
+  Status ReadOverflow(const NodeRef& leaf, uint64_t version,
+                      std::string_view ref, std::string* value, bool* valid);
+
+  // Reads the value stored out of the leaf, see ReadOverflow()
+  Status ReadValue(const NodeRef& leaf, uint64_t version, ValueType value_type,
+                   std::string_view ref, std::string* value, bool* valid);
+
+  // Moves a large value out of the leaf: appends it to the value log or
+  // writes an overflow chain, then points `value` to the reference
+  Status StoreValue(std::string_view key, std::string_view* value,
+                    std::string* ref, ValueType* value_type);
+
+  // Frees the overflow chain or accounts the logged value of the entry about
+  // to be removed
+  Status ReleaseValue(const NodeRef& leaf, size_t pos);
+  Status ReleaseValue(ValueType value_type, std::string_view ref);
+
+  // Appends the live values of the oldest value log segment again, so the
+  // segment is removed after the next commit. The snapshots may read the
+  // segment, nothing is collected while there are any.
+  Status CollectValueLog();
+
+  // Reuses a page from the free list or appends a new one
+  Status AddNode(NodeType page_type, NodeRef* node_ptr);
+  void FreeNode(const NodeRef& node);
+
+  // Pins the node, a page failing its checksum is a corrupted datafile
+  Status GetNode(NodeId id, NodeRef* node_ptr);
+
+  // In the copy-on-write mode replaces a node of the last commit with a copy
+  // in a new page, the slot `pos` of the parent is pointed to the copy. The
+  // parent must have been copied already, an empty parent means the root.
+  Status ShadowNode(const NodeRef& parent, size_t pos, NodeRef* node);
+  Status ShadowPath(std::vector<PathNode>* path);
+
+  // Finds the pages not reachable from the root, the leaves are read for the
+  // overflow chains only. The open calls it if the free pages of the
+  // copy-on-write mode didn't fit into the meta page.
+  Status CollectFreePages();
+
+  // Recounts the garbage of the value log from the records the leaves
+  // reference, if the counters didn't fit into the meta page
+  Status CountValueLogGarbage();
+
+  // Adds the keys of the next few leaves to the Bloom filter, the open leaves
+  // the filter empty. The caller holds the mutex.
+  Status FillFilter();
+
+  // Whether the Bloom filter may contain the key, always true until the
+  // filter is filled
+  bool MayContain(std::string_view key);
+
+  // Frees the retired pages no snapshot and no commit can read anymore
+  void ReleasePages();
+  void ReleaseSnapshot(const Snapshot* snapshot);
+  // Loads the meta page and redoes the logged changes
+  Status Recover(std::string_view filename, int64_t filesize);
+
+  // Sync() without the lock, the caller holds it
+  Status Checkpoint();
+
+  // The meta pages are written alternately, the valid one with the greatest
+  // sequence number is the current one. The value log is opened after the
+  // meta, so its tail and the bytes referenced in its segments are returned,
+  // see ValueLog::Live(). The lists which didn't fit into the meta page are
+  // missing: `value_log_live` is empty and `free_pages_kept` is false then.
+  Status ReadMeta(uint32_t* value_log_tail,
+                  std::optional<std::vector<uint64_t>>* value_log_live,
+                  bool* free_pages_kept);
+  Status WriteMeta();
+
+  // The codec of the pages recorded in the meta, zero without compression
+  [[nodiscard]] uint32_t CodecId() const;
+
+  // Checkpoints once the log outgrows its limit and writes back the dirty
+  // pages once they take half of the cache, the writes call it first
+  Status MaybeCheckpoint();
 
   bool closed_ = false;
 
@@ -75,12 +554,99 @@ class NIMBLEDB_EXPORT DB {
 
   std::unique_ptr<OS> os_ = nullptr;
   std::unique_ptr<File> datafile_ = nullptr;
+  std::unique_ptr<BufferPool> pool_;
+  std::unique_ptr<WriteAheadLog> wal_;
+  std::unique_ptr<Journal> journal_;
+  std::unique_ptr<ValueLog> value_log_;
+  std::unique_ptr<BloomFilter> filter_;
+  std::atomic<uint64_t> filtered_lookups_ = 0;
+
+  // The filter is filled in the key order after the open, the cursor is the
+  // key the next leaf is found with. It's changed under the mutex.
+  std::atomic<bool> filter_filled_ = false;
+  std::string filter_cursor_;
+
+  // The path of the last Put or Delete, pinned but not latched between them
+  std::unique_ptr<WritePath> write_path_;
+
+  // Serializes the modifications, the fields below are changed under it.
+  // The readers only load the root.
+  std::mutex mutex_;
 
   NodeId pages_ = 0;
-  NodeId root_id_ = 0;
-  std::map<NodeId, std::shared_ptr<BTreeNode>> nodes_;
+  std::atomic<NodeId> root_id_ = -1;
+
+  // The version of the last commit and the meta page holding it
+  uint64_t meta_sequence_ = 0;
+  NodeId meta_slot_ = 0;
+
+  // Pages are stamped with the version they are created in. Commits and
+  // snapshots freeze the current version, so only the pages of the newer one
+  // are modified in place.
+  uint64_t version_ = 1;
+  std::multiset<uint64_t> snapshots_;
+
+  // The log records before this LSN are in the datafile
+  uint64_t wal_lsn_ = 0;
+
+  // Head of the list of the freed pages linked through their `next` field
+  NodeId free_head_ = -1;
+
+  // The copy-on-write mode keeps the free pages in memory, in the descending
+  // order so the lowest ones are reused first. The replaced pages are freed
+  // once neither the last commit nor a snapshot can read them.
+  std::vector<NodeId> free_pages_;
+  std::vector<RetiredPage> retired_pages_;
+
+  // Incremented by every modification of the tree, nothing is committed if it
+  // hasn't changed since the last commit
+  uint64_t changes_ = 0;
+  uint64_t synced_changes_ = 0;
 };
 
+template <typename Function>
+  requires std::is_invocable_v<Function&, Status, bool>
+void DB::Put(std::string_view key, std::string_view value,
+             Function&& callback) {
+  static_assert(std::is_copy_constructible_v<std::decay_t<Function>>,
+                "Put() callback must be copyable: in the sync mode it's "
+                "stored in a std::function until the log is durable");
+  bool rewritten = false;
+  bool deferred = false;
+  auto st = PutEntry(key, value, &rewritten, &deferred, [&]() -> Callback<> {
+    return [callback = std::forward<Function>(callback),
+            rewritten](const Status& log_st) mutable {
+      callback(log_st, log_st.IsOk() && rewritten);
+    };
+  });
+  if (deferred) {
+    st.PermitUncheckedError();  // the log invokes the waiter
+    return;
+  }
+  callback(st, st.IsOk() && rewritten);
+}
+
+template <typename Function>
+  requires std::is_invocable_v<Function&, Status, bool>
+void DB::Delete(std::string_view key, Function&& callback) {
+  static_assert(std::is_copy_constructible_v<std::decay_t<Function>>,
+                "Delete() callback must be copyable: in the sync mode it's "
+                "stored in a std::function until the log is durable");
+  bool found = false;
+  bool deferred = false;
+  auto st = DeleteEntry(key, &found, &deferred, [&]() -> Callback<> {
+    return [callback = std::forward<Function>(callback)](
+               const Status& log_st) mutable {
+      callback(log_st, log_st.IsOk());
+    };
+  });
+  if (deferred) {
+    st.PermitUncheckedError();  // the log invokes the waiter
+    return;
+  }
+  callback(st, st.IsOk() && found);
+}
+
 }  // namespace NIMBLEDB_NAMESPACE
 
 #endif  // NIMBLEDB_NIMBLEDB_H_
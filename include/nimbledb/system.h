@@ -5,20 +5,66 @@
 #ifndef NIMBLEDB_SYSTEM_H_
 #define NIMBLEDB_SYSTEM_H_
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string_view>
+#include <utility>
+#include <vector>
 
 #include "nimbledb/base.h"
 
+#if defined(NIMBLEDB_OS_LINUX)
+struct io_uring;
+#endif
+
 namespace NIMBLEDB_NAMESPACE {
 
+class OS;
+
+// A read-only view of the beginning of a file in the address space, see
+// File::Map(). The view is shared with the page cache of the kernel, so it
+// reflects the writes to the file at once. A byte past the end of the file
+// must not be accessed, even if it's in the view. The view is released with
+// the object.
+class NIMBLEDB_EXPORT MappedRegion {
+ public:
+  // The expected access, the kernel reads ahead less or more of the file
+  enum class Access : uint8_t { kNormal, kRandom, kSequential };
+
+  ~MappedRegion();
+
+  MappedRegion(const MappedRegion&) = delete;
+  MappedRegion(MappedRegion&&) = delete;
+  MappedRegion& operator=(const MappedRegion&) = delete;
+  MappedRegion& operator=(MappedRegion&&) = delete;
+
+  [[nodiscard]] const std::byte* data() const { return data_; }
+  [[nodiscard]] size_t size() const { return size_; }
+
+  Status Advise(Access access) const;
+
+ private:
+  friend class File;
+
+  MappedRegion(const std::byte* data, size_t size) : data_(data), size_(size) {}
+
+  const std::byte* data_;
+  size_t size_;
+};
+
 // Cross-platform asynchronous file interface.
 //
-// This class is not thread-safe and doesn't own the read/write buffers.
-// You must keep the buffers valid from the method call until they return from
-// the callback.
+// Every operation is queued to the owning OS and completes during one of the
+// subsequent `OS::Tick()` or `OS::Wait()` calls, the callback is never invoked
+// from the method itself.
+//
+// The operations may be queued from several threads, but not concurrently
+// with `Close()`. The class doesn't own the read/write buffers, you must keep
+// the buffers valid from the method call until they return from the callback.
 class NIMBLEDB_EXPORT File {
  public:
   struct DeviceAttrs {
@@ -43,12 +89,12 @@ class NIMBLEDB_EXPORT File {
   enum class DirectIO : uint8_t { kRequired, kOptional, kDisabled };
   enum class SyncMode : uint8_t { kFull, kNormal, kDataOnly };
 
-  explicit File(std::string_view filename, int fd = -1)
-      : filename_(filename), fd_(fd) {}
+  File(OS* os, std::string_view filename, int fd = -1)
+      : os_(os), filename_(filename), fd_(fd) {}
 
   ~File() {
     if (!closed_) {
-      std::ignore = Close();
+      Close().PermitUncheckedError();
     }
   }
 
@@ -66,9 +112,22 @@ class NIMBLEDB_EXPORT File {
   void Sync(SyncMode mode, const Callback<>& callback) const;
   void Truncate(int64_t size, const Callback<>& callback) const;
 
+  // Releases the storage of the range, which reads as zeros then, the file
+  // size doesn't change. Where holes can't be punched the range keeps its
+  // data and space, which isn't an error.
+  void PunchHole(int64_t offset, int64_t size,
+                 const Callback<>& callback) const;
+
+  // Maps the first `size` bytes of the file, which may grow up to it later.
+  // Unlike the other operations it's blocking.
+  Status Map(size_t size, std::unique_ptr<MappedRegion>* region_ptr) const;
+
   Status Close();
 
  protected:
+  friend class OS;
+
+  OS* os_ = nullptr;
   const std::string filename_;
 
   bool closed_ = false;
@@ -100,6 +159,15 @@ class NIMBLEDB_EXPORT File {
 // of calling the callback isn't defined (for a naive implementation it can
 // happen immediately with the thread blocking).
 //
+// On Linux the file operations are queued to an io_uring submission queue and
+// reaped from the completion queue by `Tick()`, so many reads and writes are
+// in flight for the price of a single syscall. Other systems execute the
+// queued operations with blocking calls inside `Tick()`.
+//
+// The methods may be called from several threads. The submission queue and
+// the ring are guarded by a mutex, the callbacks are invoked without it by
+// whichever thread reaped the completion.
+//
 // This class does not implement any caching, you should build your own page
 // cache higher up.
 class NIMBLEDB_EXPORT OS {
@@ -111,27 +179,86 @@ class NIMBLEDB_EXPORT OS {
 
   virtual ~OS();
 
-  static Status Create(std::unique_ptr<OS>* ioptr);
+  // The default depth of the submission queue.
+  static constexpr unsigned kQueueDepth = 256;
+
+  static Status Create(std::unique_ptr<OS>* ioptr,
+                       unsigned queue_depth = kQueueDepth);
 
   // Pass all queued submissions to the kernel and peek for completions.
-  Status Tick() {  // NOLINT(*-convert-member-functions-to-static)
-    // no-op, stil unimplemented
-    return Status::Ok();
-  }
+  // Callbacks of the completed operations are invoked from this method.
+  Status Tick();
+
+  // Same as `Tick()`, but blocks until at least one operation completes if
+  // there is anything in flight.
+  Status Wait();
+
+  // Queues an operation with `submit` and runs the event loop until the
+  // operation reports its result. Other completions are handled meanwhile.
+  // The callback passed to `submit` fits std::function's inline storage, so
+  // nothing is allocated for it.
+  Status Await(FunctionRef<void(const Callback<>&)> submit);
 
-  Status Close() {  // NOLINT(*-convert-member-functions-to-static)
-    // no-op, stil unimplemented
-    closed_ = true;
-    return Status::Ok();
+  // Returns the number of operations that have been queued but whose callback
+  // has not returned yet.
+  [[nodiscard]] size_t Pending() const {
+    return pending_.load(std::memory_order_acquire);
   }
 
+  // Waits for all in-flight operations and releases the kernel resources.
+  Status Close();
+
   Status OpenDatafile(std::string_view file_path, File::Flags flags,
                       std::unique_ptr<File>* file_ptr);
 
+  // Blocking file system operations, they are rare and cheap next to the
+  // file I/O
+  [[nodiscard]] bool FileExists(std::string_view file_path) const;
+  Status RemoveFile(std::string_view file_path);
+
  protected:
-  explicit OS();
+  friend class File;
+
+  // A single queued file operation, see system.cc.
+  struct Request;
+
+  explicit OS(unsigned queue_depth);
+
+  Status Init();
+
+  // Takes ownership of the request and queues it for the next `Tick()`.
+  void Submit(Request* req);
+
+  // Runs the request's callback or requeues the rest of a partial transfer.
+  void Complete(Request* req, int64_t result);
+
+  // A reaped request and its result, the request isn't completed yet
+  using Completion = std::pair<Request*, int64_t>;
+
+  // Executes the request with the blocking system calls.
+  // Returns the number of transferred bytes or negative errno.
+  static int64_t Execute(const Request& req);
+
+  Status Reap(bool wait);
+
+  // Moves the queued requests to the kernel and collects the finished ones,
+  // must be called with the mutex held
+  Status Poll(bool wait, std::vector<Completion>* completed);
 
   bool closed_ = false;
+
+  const unsigned queue_depth_;
+  std::atomic<size_t> pending_ = 0;
+
+  std::mutex mutex_;
+
+  Request* queue_head_ = nullptr;
+  Request* queue_tail_ = nullptr;
+
+#if defined(NIMBLEDB_OS_LINUX)
+  std::unique_ptr<io_uring> ring_;
+  size_t inflight_ = 0;
+#endif
 };
 
 }  // namespace NIMBLEDB_NAMESPACE
@@ -101,6 +101,15 @@ std::string Status::ToString() const {
       return "OK";
     case kNoMemory:
       return "Out of memory";
+    case kIOError:
+      result = "IO error: ";
+      break;
+    case kCorruptedDatafile:
+      result = "Corrupted datafile: ";
+      break;
+    case kInvalidArgument:
+      result = "Invalid argument: ";
+      break;
     default: {
       // This should not happen since `code_` should be a valid non-`kMaxCode`
       // member of the `Code` enum. The above switch-statement should have had a
@@ -0,0 +1,76 @@
+// Copyright 2025 Nikolay Govorov. All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at LICENSE file in the root.
+
+#include "src/bloom_filter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string_view>
+
+#include "nimbledb/base.h"
+
+namespace NIMBLEDB_NAMESPACE {
+
+namespace {
+
+uint64_t Hash(std::string_view key) {
+  return std::hash<std::string_view>{}(key);
+}
+
+// The step between the probes, the bits picking the block are mixed in so
+// the keys of the same block get different steps
+uint32_t Delta(uint64_t hash) {
+  const uint64_t mixed = (hash ^ (hash >> 29U)) * 0x9e3779b97f4a7c15U;
+  return static_cast<uint32_t>(mixed >> 32U) | 1U;
+}
+
+}  // namespace
+
+BloomFilter::BloomFilter(size_t size)
+    : blocks_(std::max<size_t>(size / (kBlockWords * sizeof(uint64_t)), 1)),
+      words_(std::make_unique<std::atomic<uint64_t>[]>(blocks_ *
+                                                        kBlockWords)) {}
+
+void BloomFilter::Add(std::string_view key) {
+  const uint64_t hash = Hash(key);
+  auto* block = Block(hash);
+
+  // The probes are derived from the hash by double hashing
+  auto probe = static_cast<uint32_t>(hash);
+  const uint32_t delta = Delta(hash);
+  for (uint32_t i = 0; i < kProbes; ++i, probe += delta) {
+    const uint32_t bit = probe % kBlockBits;
+    block[bit / 64].fetch_or(uint64_t{1} << (bit % 64),
+                             std::memory_order_release);
+  }
+}
+
+bool BloomFilter::MayContain(std::string_view key) const {
+  const uint64_t hash = Hash(key);
+  const auto* block = Block(hash);
+
+  auto probe = static_cast<uint32_t>(hash);
+  const uint32_t delta = Delta(hash);
+  for (uint32_t i = 0; i < kProbes; ++i, probe += delta) {
+    const uint32_t bit = probe % kBlockBits;
+    const uint64_t word = block[bit / 64].load(std::memory_order_acquire);
+    if ((word & (uint64_t{1} << (bit % 64))) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::atomic<uint64_t>* BloomFilter::Block(uint64_t hash) const {
+  // The high bits pick the block, the low ones are left for the probes
+  const auto index = static_cast<size_t>(
+      ((hash >> 32U) * static_cast<uint64_t>(blocks_)) >> 32U);
+  return &words_[index * kBlockWords];
+}
+
+}  // namespace NIMBLEDB_NAMESPACE
@@ -0,0 +1,52 @@
+// Copyright 2025 Nikolay Govorov. All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at LICENSE file in the root.
+
+#ifndef NIMBLEDB_BLOOM_FILTER_H_
+#define NIMBLEDB_BLOOM_FILTER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+#include "nimbledb/base.h"
+
+namespace NIMBLEDB_NAMESPACE {
+
+// In-memory blocked Bloom filter of the keys in the tree, tells the keys which
+// are surely absent without reading the pages.
+//
+// All bits of a key are in a single block of a cache line, so a query touches
+// one line of memory whatever the filter size. Keys can't be removed from the
+// filter, a removed key stays a false positive until the filter is built
+// again.
+//
+// Keys are added by the single writer while the readers query the filter, the
+// bits are set and tested atomically. A key is added before it's inserted into
+// the tree, so a reader finding the key in the tree also finds it here.
+class BloomFilter {
+ public:
+  // `size` is in bytes, it's rounded down to whole blocks
+  explicit BloomFilter(size_t size);
+
+  void Add(std::string_view key);
+  [[nodiscard]] bool MayContain(std::string_view key) const;
+
+ private:
+  static constexpr size_t kBlockWords = 8;  // 64 bytes
+  static constexpr size_t kBlockBits = kBlockWords * 64;
+
+  // The number of bits set per key, the best one for about 10 bits per key
+  static constexpr uint32_t kProbes = 6;
+
+  [[nodiscard]] std::atomic<uint64_t>* Block(uint64_t hash) const;
+
+  const size_t blocks_;
+  std::unique_ptr<std::atomic<uint64_t>[]> words_;
+};
+
+}  // namespace NIMBLEDB_NAMESPACE
+
+#endif  // NIMBLEDB_BLOOM_FILTER_H_
@@ -0,0 +1,613 @@
+// Copyright 2025 Nikolay Govorov. All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at LICENSE file in the root.
+
+#include "src/buffer_pool.h"
+
+#include <sys/types.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <shared_mutex>
+#include <span>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "nimbledb/base.h"
+#include "nimbledb/system.h"
+#include "src/crc32c.h"
+
+namespace NIMBLEDB_NAMESPACE {
+
+namespace {
+
+// The extents take whole blocks of the sector size, the frames are aligned
+// to it so they can be used with direct I/O
+constexpr size_t kBlockSize = 4096;
+constexpr std::align_val_t kFrameAlignment{kBlockSize};
+
+// The extent size follows the checksum in the page header
+constexpr size_t kChecksumSize = sizeof(uint32_t);
+
+// The least address space taken by a mapping of the datafile, a mapping is
+// replaced by one twice as large when the datafile outgrows it
+constexpr size_t kMinMappingSize = size_t{1} << 30;
+
+struct AlignedDelete {
+  void operator()(std::byte* data) const {
+    ::operator delete[](data, kFrameAlignment);
+  }
+};
+using AlignedBuffer = std::unique_ptr<std::byte[], AlignedDelete>;
+
+std::byte* AllocateAligned(size_t size) {
+  return static_cast<std::byte*>(
+      ::operator new[](size, kFrameAlignment, std::nothrow));
+}
+
+}  // namespace
+
+BufferPool::BufferPool(OS* os, File* file, size_t page_size, size_t capacity,
+                       std::shared_ptr<const Codec> codec)
+    : os_(os),
+      file_(file),
+      page_size_(page_size),
+      capacity_(capacity),
+      codec_(std::move(codec)),
+      frames_(std::make_unique<Frame[]>(capacity)) {
+  assert(capacity_ > 0);
+  table_.reserve(capacity_);
+}
+
+BufferPool::~BufferPool() {
+  for (size_t i = 0; i < used_; ++i) {
+    FreeBuffer(frames_[i]);
+  }
+  if (scratch_ != nullptr) {
+    ::operator delete[](scratch_, kFrameAlignment);
+  }
+}
+
+Status BufferPool::Fetch(PageId id, PageRef* ref) {
+  {
+    const std::shared_lock lock(mutex_);
+    if (auto it = table_.find(id); it != table_.end()) {
+      frames_[it->second].pins.fetch_add(1, std::memory_order_relaxed);
+      *ref = PageRef(this, it->second);
+      return Status::Ok();
+    }
+  }
+
+  const std::lock_guard lock(mutex_);
+
+  // Another thread may have read the page meanwhile
+  if (auto it = table_.find(id); it != table_.end()) {
+    frames_[it->second].pins.fetch_add(1, std::memory_order_relaxed);
+    *ref = PageRef(this, it->second);
+    return Status::Ok();
+  }
+
+  size_t index = 0;
+  if (auto st = Allocate(&index); !st.IsOk()) {
+    return st;
+  }
+
+  auto& frame = frames_[index];
+  std::byte* data = nullptr;
+  if (!regions_.empty()) {
+    if (auto st = MapPage(id, &data); !st.IsOk()) {
+      return st;
+    }
+  }
+  if (data == nullptr) {
+    if (frame.buffer == nullptr) {
+      if (auto st = AllocateBuffer(frame); !st.IsOk()) {
+        return st;
+      }
+    }
+    data = frame.buffer;
+    if (auto st = ReadPage(id, data); !st.IsOk()) {
+      return st;
+    }
+  }
+
+  // The frame stays free, the page is read again by the next fetch
+  uint32_t checksum;
+  std::memcpy(&checksum, data, kChecksumSize);
+  const auto page = std::span(data, page_size_).subspan(kHeaderSize);
+  if (checksum != Crc32c(page)) {
+    return Status::CorruptedDatafile("page checksum mismatch",
+                                     std::format("page {}", id));
+  }
+
+  frame.data.store(data, std::memory_order_relaxed);
+  frame.id = id;
+  frame.pins.store(1, std::memory_order_relaxed);
+  frame.dirty = false;
+  table_.emplace(id, index);
+
+  *ref = PageRef(this, index);
+  return Status::Ok();
+}
+
+Status BufferPool::Create(PageId id, PageRef* ref) {
+  size_t index = 0;
+  {
+    const std::lock_guard lock(mutex_);
+    if (auto it = table_.find(id); it != table_.end()) {
+      index = it->second;
+    } else if (auto st = Allocate(&index); !st.IsOk()) {
+      return st;
+    }
+
+    // A new frame stays free if its buffer can't be allocated
+    auto& frame = frames_[index];
+    if (frame.buffer == nullptr) {
+      if (auto st = AllocateBuffer(frame); !st.IsOk()) {
+        return st;
+      }
+    }
+    if (frame.id != id) {
+      frame.data.store(frame.buffer, std::memory_order_relaxed);
+      frame.id = id;
+      table_.emplace(id, index);
+    }
+    frame.pins.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  *ref = PageRef(this, index);
+
+  // The readers still holding a cached page fail to validate it
+  ref->MarkDirty();
+  std::memset(ref->data(), 0, page_size_);
+  return Status::Ok();
+}
+
+Status BufferPool::Map() {
+  int64_t size;
+  if (auto st = file_->GetFileSize(&size); !st.IsOk()) {
+    return st;
+  }
+
+  const std::lock_guard lock(mutex_);
+  file_size_ = static_cast<size_t>(size);
+  regions_.emplace_back();
+  if (auto st = file_->Map(std::max(2 * file_size_, kMinMappingSize),
+                           &regions_.back());
+      !st.IsOk()) {
+    regions_.clear();
+    return st;
+  }
+  return regions_.back()->Advise(access_);
+}
+
+Status BufferPool::Advise(MappedRegion::Access access) {
+  const std::lock_guard lock(mutex_);
+  access_ = access;
+  for (const auto& region : regions_) {
+    if (auto st = region->Advise(access); !st.IsOk()) {
+      return st;
+    }
+  }
+  return Status::Ok();
+}
+
+Status BufferPool::MapPage(PageId id, std::byte** data_ptr) {
+  const auto offset = static_cast<size_t>(Offset(id));
+  const size_t end = offset + page_size_;
+
+  // The datafile grows as the pages are written back, its size is checked
+  // again only for a page past it
+  if (end > file_size_) {
+    int64_t size;
+    if (auto st = file_->GetFileSize(&size); !st.IsOk()) {
+      return st;
+    }
+    file_size_ = static_cast<size_t>(size);
+    if (end > file_size_) {
+      *data_ptr = nullptr;
+      return Status::Ok();
+    }
+  }
+
+  if (end > regions_.back()->size()) {
+    std::unique_ptr<MappedRegion> region;
+    if (auto st = file_->Map(2 * file_size_, &region); !st.IsOk()) {
+      return st;
+    }
+    if (auto st = region->Advise(access_); !st.IsOk()) {
+      return st;
+    }
+    regions_.push_back(std::move(region));
+  }
+
+  // Only the writer modifies a page, after it's copied to a buffer
+  // NOLINTNEXTLINE(*-const-cast)
+  *data_ptr = const_cast<std::byte*>(regions_.back()->data()) + offset;
+  return Status::Ok();
+}
+
+Status BufferPool::Flush() {
+  if (auto st = WriteDirty(); !st.IsOk()) {
+    return st;
+  }
+  return os_->Await([&](const Callback<>& callback) {
+    file_->Sync(File::SyncMode::kNormal, callback);
+  });
+}
+
+Status BufferPool::WriteDirty() {
+  // Ascending offsets let the kernel merge the writes of adjacent pages
+  std::vector<std::pair<PageId, size_t>> dirty;
+  {
+    const std::shared_lock lock(mutex_);
+    for (size_t i = 0; i < used_; ++i) {
+      if (frames_[i].id >= 0 && frames_[i].dirty) {
+        dirty.emplace_back(frames_[i].id, i);
+      }
+    }
+  }
+  if (dirty.empty()) {
+    return Status::Ok();
+  }
+  std::ranges::sort(dirty);
+
+  // The pinned frames can't be evicted while they are written, at most half
+  // of the pool is pinned at a time so the readers still find free frames
+  const size_t batch = std::max<size_t>(capacity_ / 2, 1);
+  for (size_t begin = 0; begin < dirty.size(); begin += batch) {
+    std::vector<PageRef> pages;
+    {
+      const std::lock_guard lock(mutex_);
+      for (size_t i = begin; i < std::min(begin + batch, dirty.size()); ++i) {
+        // The page may have been evicted and written back meanwhile
+        auto& frame = frames_[dirty[i].second];
+        if (frame.id == dirty[i].first && frame.dirty) {
+          frame.pins.fetch_add(1, std::memory_order_relaxed);
+          pages.push_back(PageRef(this, dirty[i].second));
+        }
+      }
+    }
+
+    if (auto st = WritePages(pages); !st.IsOk()) {
+      return st;
+    }
+  }
+
+  return Status::Ok();
+}
+
+Status BufferPool::WritePages(const std::vector<PageRef>& pages) {
+  if (journal_ != nullptr) {
+    std::vector<PageId> ids;
+    ids.reserve(pages.size());
+    for (const auto& page : pages) {
+      ids.push_back(page.id());
+    }
+    if (auto st = journal_->Save(ids); !st.IsOk()) {
+      return st;
+    }
+  }
+
+  // The extents are compressed into buffers of their own, as the writes are
+  // in flight together
+  std::vector<AlignedBuffer> buffers(codec_ != nullptr ? pages.size() : 0);
+  for (auto& buffer : buffers) {
+    buffer.reset(AllocateAligned(page_size_));
+    if (buffer == nullptr) {
+      return Status::NoMemory();
+    }
+  }
+
+  // All writes are queued at once, the completions may be reaped by other
+  // threads. The results of the holes punched behind the extents follow.
+  std::atomic<size_t> pending = pages.size();
+  std::vector<std::optional<Status>> results(2 * pages.size());
+  for (size_t i = 0; i < pages.size(); ++i) {
+    // The readers copying a whole page must not see the checksum change
+    Latch(pages[i].frame_);
+    Seal(pages[i].data());
+    Unlatch(pages[i].frame_);
+
+    // Only this thread modifies the pages, so the page stays as it's sealed
+    const auto extent =
+        Pack(pages[i].data(), buffers.empty() ? nullptr : buffers[i].get());
+    bytes_written_.fetch_add(extent.size(), std::memory_order_relaxed);
+    file_->Write(extent, Offset(pages[i].id()),
+                 [&pending, &results, i](const Status& st) {
+                   results[i] = st;
+                   pending.fetch_sub(1, std::memory_order_release);
+                 });
+
+    if (extent.size() < page_size_) {
+      pending.fetch_add(1, std::memory_order_relaxed);
+      PunchTail(pages[i].id(), extent.size(),
+                [&pending, &results, i, n = pages.size()](const Status& st) {
+                  results[n + i] = st;
+                  pending.fetch_sub(1, std::memory_order_release);
+                });
+    }
+  }
+
+  while (pending.load(std::memory_order_acquire) > 0) {
+    if (auto st = os_->Wait(); !st.IsOk()) {
+      return st;
+    }
+  }
+
+  std::optional<Status> error;
+  for (size_t i = 0; i < pages.size(); ++i) {
+    if (results[i]->IsOk()) {
+      MarkClean(frames_[pages[i].frame_]);
+    } else if (!error.has_value()) {
+      error = *results[i];
+    }
+  }
+  for (size_t i = pages.size(); i < results.size(); ++i) {
+    if (results[i].has_value() && !results[i]->IsOk() && !error.has_value()) {
+      error = *results[i];
+    }
+  }
+  if (error.has_value()) {
+    return *error;
+  }
+  return Status::Ok();
+}
+
+Status BufferPool::Allocate(size_t* frame_ptr) {
+  if (used_ < capacity_) {
+    // The mapped pages need no buffer until they are modified
+    if (regions_.empty()) {
+      if (auto st = AllocateBuffer(frames_[used_]); !st.IsOk()) {
+        return st;
+      }
+      frames_[used_].data.store(frames_[used_].buffer,
+                                std::memory_order_relaxed);
+    }
+    *frame_ptr = used_++;
+    return Status::Ok();
+  }
+
+  // The first round clears the reference bits, so the second one always finds
+  // a victim unless all pages are pinned. The dirty pages are passed over by
+  // the first two rounds: their write-back would hold the lock of the table
+  // and stall the misses of the other threads.
+  for (const bool clean : {true, false}) {
+    for (size_t i = 0; i < 2 * used_; ++i) {
+      const size_t index = clock_hand_;
+      clock_hand_ = (clock_hand_ + 1) % used_;
+
+      auto& frame = frames_[index];
+      if (frame.pins.load(std::memory_order_acquire) > 0) {
+        continue;
+      }
+      if (clean && frame.dirty) {
+        continue;
+      }
+      if (frame.referenced.exchange(false, std::memory_order_relaxed)) {
+        continue;
+      }
+
+      if (frame.dirty) {
+        if (auto st = WriteBack(frame); !st.IsOk()) {
+          return st;
+        }
+      }
+
+      table_.erase(frame.id);
+      frame.id = -1;
+      if (!regions_.empty()) {
+        FreeBuffer(frame);
+      }
+      frame.data.store(frame.buffer, std::memory_order_relaxed);
+
+      *frame_ptr = index;
+      return Status::Ok();
+    }
+  }
+
+  return Status::NoMemory(
+      "buffer pool is exhausted",
+      std::format("all {} pages are pinned", used_));
+}
+
+Status BufferPool::WriteBack(Frame& frame) {
+  // The eviction holds the exclusive lock, so the scratch buffer is free
+  if (codec_ != nullptr && scratch_ == nullptr) {
+    scratch_ = AllocateAligned(page_size_);
+    if (scratch_ == nullptr) {
+      return Status::NoMemory();
+    }
+  }
+
+  if (journal_ != nullptr) {
+    if (auto st = journal_->Save(std::span(&frame.id, 1)); !st.IsOk()) {
+      return st;
+    }
+  }
+
+  // An unpinned page has no readers, a dirty one is in the frame's buffer
+  Seal(frame.buffer);
+  const auto extent = Pack(frame.buffer, scratch_);
+  bytes_written_.fetch_add(extent.size(), std::memory_order_relaxed);
+  auto st = os_->Await([&](const Callback<>& callback) {
+    file_->Write(extent, Offset(frame.id), callback);
+  });
+  if (!st.IsOk()) {
+    return st;
+  }
+  MarkClean(frame);
+
+  if (extent.size() < page_size_) {
+    return os_->Await([&](const Callback<>& callback) {
+      PunchTail(frame.id, extent.size(), callback);
+    });
+  }
+  return Status::Ok();
+}
+
+std::byte* BufferPool::NewBuffer() {
+  auto* buffer =
+      static_cast<std::byte*>(::operator new[](page_size_, kFrameAlignment));
+  buffers_.fetch_add(1, std::memory_order_relaxed);
+  return buffer;
+}
+
+Status BufferPool::AllocateBuffer(Frame& frame) {
+  frame.buffer = AllocateAligned(page_size_);
+  if (frame.buffer == nullptr) {
+    return Status::NoMemory();
+  }
+  buffers_.fetch_add(1, std::memory_order_relaxed);
+  return Status::Ok();
+}
+
+void BufferPool::FreeBuffer(Frame& frame) {
+  if (frame.buffer != nullptr) {
+    ::operator delete[](frame.buffer, kFrameAlignment);
+    frame.buffer = nullptr;
+    buffers_.fetch_sub(1, std::memory_order_relaxed);
+  }
+}
+
+void BufferPool::PunchTail(PageId id, size_t stored,
+                           const Callback<>& callback) const {
+  file_->PunchHole(Offset(id) + static_cast<off_t>(stored),
+                   static_cast<int64_t>(page_size_ - stored), callback);
+}
+
+Status BufferPool::ReadPage(PageId id, std::byte* data) {
+  const auto read = [&](std::byte* buffer, size_t size, size_t offset) {
+    bytes_read_.fetch_add(size, std::memory_order_relaxed);
+    return os_->Await([&](const Callback<>& callback) {
+      file_->Read(std::span(buffer, size),
+                  Offset(id) + static_cast<off_t>(offset), callback);
+    });
+  };
+
+  if (codec_ == nullptr) {
+    return read(data, page_size_, 0);
+  }
+
+  // The caller holds the exclusive lock, so the scratch buffer is free
+  if (scratch_ == nullptr) {
+    scratch_ = AllocateAligned(page_size_);
+    if (scratch_ == nullptr) {
+      return Status::NoMemory();
+    }
+  }
+
+  // The first block tells how much of the slot the page takes
+  const size_t block = std::min(kBlockSize, page_size_);
+  if (auto st = read(scratch_, block, 0); !st.IsOk()) {
+    return st;
+  }
+
+  uint32_t extent;
+  std::memcpy(&extent, scratch_ + kChecksumSize, sizeof(extent));
+  if (extent == 0) {
+    std::memcpy(data, scratch_, block);
+    return block < page_size_ ? read(data + block, page_size_ - block, block)
+                              : Status::Ok();
+  }
+
+  if (extent > page_size_ - kHeaderSize) {
+    return Status::CorruptedDatafile(
+        "page extent is out of the page",
+        std::format("page {}, extent {}", id, extent));
+  }
+  const size_t stored =
+      (kHeaderSize + extent + kBlockSize - 1) / kBlockSize * kBlockSize;
+  if (stored > block) {
+    if (auto st = read(scratch_ + block, stored - block, block); !st.IsOk()) {
+      return st;
+    }
+  }
+
+  // A damaged extent either fails to decompress or fails the checksum
+  if (!codec_->Decompress(
+          std::span(scratch_ + kHeaderSize, extent),
+          std::span(data + kHeaderSize, page_size_ - kHeaderSize))) {
+    return Status::CorruptedDatafile("page extent can't be decompressed",
+                                     std::format("page {}", id));
+  }
+  std::memcpy(data, scratch_, kHeaderSize);
+  return Status::Ok();
+}
+
+void BufferPool::Seal(std::byte* data) const {
+  const uint32_t checksum =
+      Crc32c(std::span(data, page_size_).subspan(kHeaderSize));
+  const uint32_t extent = 0;
+  std::memcpy(data, &checksum, kChecksumSize);
+  std::memcpy(data + kChecksumSize, &extent, sizeof(extent));
+}
+
+ROBuffer BufferPool::Pack(const std::byte* data, std::byte* buffer) const {
+  // Compression pays off only if it saves a block
+  if (codec_ == nullptr || page_size_ < kHeaderSize + 2 * kBlockSize) {
+    return {data, page_size_};
+  }
+
+  const size_t size = codec_->Compress(
+      std::span(data + kHeaderSize, page_size_ - kHeaderSize),
+      std::span(buffer + kHeaderSize, page_size_ - kHeaderSize - kBlockSize));
+  if (size == 0) {
+    return {data, page_size_};
+  }
+
+  const auto extent = static_cast<uint32_t>(size);
+  std::memcpy(buffer, data, kChecksumSize);
+  std::memcpy(buffer + kChecksumSize, &extent, sizeof(extent));
+
+  const size_t stored =
+      (kHeaderSize + size + kBlockSize - 1) / kBlockSize * kBlockSize;
+  std::memset(buffer + kHeaderSize + size, 0, stored - kHeaderSize - size);
+  return {buffer, stored};
+}
+
+void BufferPool::Latch(size_t frame) {
+  auto& latch = frames_[frame];
+  if (latch.latches++ == 0) {
+    latch.version.fetch_add(1, std::memory_order_relaxed);
+    // The modifications must not become visible before the version is odd
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+}
+
+void BufferPool::Unlatch(size_t frame) {
+  auto& latch = frames_[frame];
+  if (--latch.latches == 0) {
+    latch.version.fetch_add(1, std::memory_order_release);
+  }
+}
+
+uint64_t BufferPool::PageRef::Version() const {
+  const auto& latch = pool_->frames_[frame_].version;
+  for (;;) {
+    const uint64_t version = latch.load(std::memory_order_acquire);
+    if ((version & 1U) == 0) {
+      return version;
+    }
+    std::this_thread::yield();
+  }
+}
+
+bool BufferPool::PageRef::Validate(uint64_t version) const {
+  // The reads of the page must not be reordered after the version check
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return pool_->frames_[frame_].version.load(std::memory_order_relaxed) ==
+         version;
+}
+
+}  // namespace NIMBLEDB_NAMESPACE
@@ -0,0 +1,333 @@
+// Copyright 2025 Nikolay Govorov. All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at LICENSE file in the root.
+
+#ifndef NIMBLEDB_BUFFER_POOL_H_
+#define NIMBLEDB_BUFFER_POOL_H_
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "nimbledb/base.h"
+#include "nimbledb/codec.h"
+#include "nimbledb/system.h"
+#include "src/journal.h"
+
+namespace NIMBLEDB_NAMESPACE {
+
+// Fixed-capacity cache of the datafile pages.
+//
+// A page must be pinned while it's in use and pinned pages are never evicted.
+// When the pool is full, an unpinned victim is chosen with the CLOCK algorithm
+// (a cheap approximation of LRU). The clean pages are evicted first, a dirty
+// one is written back under the exclusive lock only when no clean page can be
+// evicted. The writer keeps the readers off that path with WriteDirty().
+//
+// Pages may be pinned and released by several threads. The page table is
+// guarded by a reader-writer lock: hits take it shared, misses exclusive for
+// the time of the read. Each frame also has a version latch for optimistic
+// readers, see PageRef::Version(). Only one thread at a time may modify the
+// pages and flush the pool.
+//
+// The first bytes of every page are the pool's header: the CRC32C of the rest
+// of the page and the size of its compressed extent. The pool stamps the
+// checksum when it writes a page back and verifies it when it reads the page,
+// so a damaged page is never handed out.
+//
+// With a codec the pages are compressed on the way to the datafile. A page is
+// stored in its slot as a variable-size extent: the header followed by the
+// compressed rest of the page, padded to a whole block. The extent size in the
+// header tells how much of the slot to read, a page which doesn't compress by
+// a block at least is stored as is with a zero extent size. The rest of the
+// slot is punched out of the datafile, so the file system stores only the
+// extents, while the page ids stay the slot numbers.
+//
+// With the datafile mapped, see Map(), a page read is a pointer into the
+// mapping instead of a copy: the frame refers to the mapped page until it's
+// marked dirty and copied to the frame's own buffer. The kernel's page cache
+// holds the mapped pages, the pool's buffers only the modified ones: a frame
+// gets its buffer with the first modification of its page and frees it when
+// the page is evicted. A mapped page is still verified with its checksum on
+// a miss, under the exclusive lock of the page table.
+//
+// With a journal, see SetJournal(), the committed image of a page is saved
+// before the page is written back over it.
+class BufferPool {
+ public:
+  using PageId = int64_t;
+
+  // The page layout must leave room for the header at the beginning
+  static constexpr size_t kHeaderSize = 2 * sizeof(uint32_t);
+
+  // A pinned page, the pin is released when the reference is destroyed.
+  class PageRef {
+   public:
+    PageRef() = default;
+    ~PageRef() { Reset(); }
+
+    PageRef(const PageRef&) = delete;
+    PageRef& operator=(const PageRef&) = delete;
+
+    PageRef(PageRef&& other) noexcept
+        : pool_(other.pool_), frame_(other.frame_), latched_(other.latched_) {
+      other.pool_ = nullptr;
+      other.latched_ = false;
+    }
+    PageRef& operator=(PageRef&& other) noexcept {
+      if (this != &other) {
+        Reset();
+        pool_ = other.pool_;
+        frame_ = other.frame_;
+        latched_ = other.latched_;
+        other.pool_ = nullptr;
+        other.latched_ = false;
+      }
+      return *this;
+    }
+
+    explicit operator bool() const { return pool_ != nullptr; }
+
+    [[nodiscard]] PageId id() const { return pool_->frames_[frame_].id; }
+    [[nodiscard]] std::byte* data() const {
+      return pool_->frames_[frame_].data.load(std::memory_order_relaxed);
+    }
+
+    // The page will be written back before its frame is reused. The page is
+    // latched until the reference is released, so it must be called before
+    // the page is modified.
+    void MarkDirty() const {
+      if (!latched_) {
+        pool_->Latch(frame_);
+        latched_ = true;
+      }
+
+      auto& frame = pool_->frames_[frame_];
+      if (auto* mapped = frame.data.load(std::memory_order_relaxed);
+          mapped != frame.buffer) {
+        // Like the other allocations of the writer, a failure throws
+        if (frame.buffer == nullptr) {
+          frame.buffer = pool_->NewBuffer();
+        }
+        std::memcpy(frame.buffer, mapped, pool_->page_size_);
+        frame.data.store(frame.buffer, std::memory_order_relaxed);
+      }
+      if (!frame.dirty) {
+        frame.dirty = true;
+        pool_->dirty_.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+
+    // Optimistic reads take the version before reading the page and validate
+    // it afterwards, a changed version means the page was modified meanwhile
+    // and everything read from it must be discarded. The version is odd while
+    // the page is latched, this method waits until it's released.
+    [[nodiscard]] uint64_t Version() const;
+    [[nodiscard]] bool Validate(uint64_t version) const;
+
+    // Ends the modification and keeps the page pinned, the readers see the
+    // new version. The next modification must mark it dirty again.
+    void Unlatch() const {
+      if (latched_) {
+        pool_->Unlatch(frame_);
+        latched_ = false;
+      }
+    }
+
+    void Reset() {
+      if (pool_ != nullptr) {
+        if (latched_) {
+          pool_->Unlatch(frame_);
+          latched_ = false;
+        }
+        pool_->Unpin(frame_);
+        pool_ = nullptr;
+      }
+    }
+
+   private:
+    friend BufferPool;
+
+    PageRef(BufferPool* pool, size_t frame) : pool_(pool), frame_(frame) {}
+
+    BufferPool* pool_ = nullptr;
+    size_t frame_ = 0;
+    mutable bool latched_ = false;
+  };
+
+  // `capacity` is the maximum number of pages kept in memory, no codec means
+  // the pages are stored uncompressed.
+  BufferPool(OS* os, File* file, size_t page_size, size_t capacity,
+             std::shared_ptr<const Codec> codec = nullptr);
+  ~BufferPool();
+
+  BufferPool(const BufferPool&) = delete;
+  BufferPool(BufferPool&&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+  BufferPool& operator=(BufferPool&&) = delete;
+
+  // Pins the page, reading it from the datafile if it isn't cached. A page
+  // failing the checksum is reported as a corrupted datafile.
+  Status Fetch(PageId id, PageRef* ref);
+
+  // Pins a zeroed frame for a page whose content in the datafile is of no
+  // use, a cached page is zeroed too. The page is dirty and latched from the
+  // start.
+  Status Create(PageId id, PageRef* ref);
+
+  // Writes back all dirty pages in the order of their ids and makes them
+  // durable with a single fsync at the end.
+  Status Flush();
+
+  // Writes back all dirty pages like Flush() but without the fsync, so the
+  // evictions find clean pages
+  Status WriteDirty();
+
+  // Maps the datafile, the pages read afterwards refer to the mapping. The
+  // pages are stored uncompressed then.
+  Status Map();
+
+  // Tells the kernel how the mapped pages are going to be read
+  Status Advise(MappedRegion::Access access);
+
+  // The pages are saved to the journal before they are written back, it must
+  // outlive the pool
+  void SetJournal(Journal* journal) { journal_ = journal; }
+
+  [[nodiscard]] size_t size() const {
+    const std::shared_lock lock(mutex_);
+    return table_.size();
+  }
+  [[nodiscard]] size_t capacity() const { return capacity_; }
+
+  // The cached pages modified since they were written back
+  [[nodiscard]] size_t dirty() const {
+    return dirty_.load(std::memory_order_relaxed);
+  }
+
+  // The frames having a buffer of their own, all of them unless the datafile
+  // is mapped
+  [[nodiscard]] size_t buffers() const {
+    return buffers_.load(std::memory_order_relaxed);
+  }
+
+  // The bytes transferred to and from the datafile, a compressed page counts
+  // with the size of its extent
+  [[nodiscard]] uint64_t bytes_read() const {
+    return bytes_read_.load(std::memory_order_relaxed);
+  }
+  [[nodiscard]] uint64_t bytes_written() const {
+    return bytes_written_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Frame {
+    PageId id = -1;
+
+    // The page, either the frame's buffer or a mapped page. The buffer of a
+    // mapped page is allocated when the page is modified.
+    std::atomic<std::byte*> data = nullptr;
+    std::byte* buffer = nullptr;
+
+    std::atomic<uint32_t> pins = 0;
+    bool dirty = false;
+    std::atomic<bool> referenced = false;
+
+    // The version latch, `latches` counts the references of the modifying
+    // thread holding it
+    std::atomic<uint64_t> version = 0;
+    uint32_t latches = 0;
+  };
+
+  // Finds a frame for a new page: grows the pool up to the capacity, then
+  // evicts the first unpinned and not recently used page.
+  Status Allocate(size_t* frame_ptr);
+
+  Status WriteBack(Frame& frame);
+  void MarkClean(Frame& frame) {
+    frame.dirty = false;
+    dirty_.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  // Allocates a frame's buffer, NewBuffer() throws on failure and
+  // AllocateBuffer() reports it
+  std::byte* NewBuffer();
+  Status AllocateBuffer(Frame& frame);
+  void FreeBuffer(Frame& frame);
+
+  // Reads the page into the frame's data, decompressing its extent
+  Status ReadPage(PageId id, std::byte* data);
+
+  // Finds the page in the mapping, which grows with the datafile. The page
+  // is null if it's past the end of the datafile.
+  Status MapPage(PageId id, std::byte** data_ptr);
+
+  // Computes the checksum of the page before it's written
+  void Seal(std::byte* data) const;
+
+  // Returns the bytes to store for the sealed page: the page itself or its
+  // extent compressed into `buffer` of the page size
+  [[nodiscard]] ROBuffer Pack(const std::byte* data, std::byte* buffer) const;
+
+  // Releases the storage of the page's slot behind its extent of `stored`
+  // bytes
+  void PunchTail(PageId id, size_t stored, const Callback<>& callback) const;
+
+  [[nodiscard]] off_t Offset(PageId id) const {
+    return static_cast<off_t>(id * static_cast<PageId>(page_size_));
+  }
+
+  // Writes the pinned pages concurrently and marks them clean
+  Status WritePages(const std::vector<PageRef>& pages);
+
+  void Latch(size_t frame);
+  void Unlatch(size_t frame);
+
+  void Unpin(size_t frame) {
+    frames_[frame].referenced.store(true, std::memory_order_relaxed);
+    frames_[frame].pins.fetch_sub(1, std::memory_order_release);
+  }
+
+  OS* os_ = nullptr;
+  File* file_ = nullptr;
+  Journal* journal_ = nullptr;
+
+  const size_t page_size_;
+  const size_t capacity_;
+  const std::shared_ptr<const Codec> codec_;
+
+  std::atomic<uint64_t> bytes_read_ = 0;
+  std::atomic<uint64_t> bytes_written_ = 0;
+  std::atomic<size_t> buffers_ = 0;
+  std::atomic<size_t> dirty_ = 0;
+
+  mutable std::shared_mutex mutex_;
+
+  // The frames up to `used_` have their data allocated
+  size_t clock_hand_ = 0;
+  size_t used_ = 0;
+  std::unique_ptr<Frame[]> frames_;
+  std::unordered_map<PageId, size_t> table_;
+
+  // The extents read and evicted under the exclusive lock, allocated with
+  // the first one
+  std::byte* scratch_ = nullptr;
+
+  // The mappings of the datafile, the last one is the largest. The previous
+  // ones stay mapped as long as the frames may refer to them. The datafile
+  // was `file_size_` bytes at least when it was checked last.
+  std::vector<std::unique_ptr<MappedRegion>> regions_;
+  size_t file_size_ = 0;
+  MappedRegion::Access access_ = MappedRegion::Access::kNormal;
+};
+
+}  // namespace NIMBLEDB_NAMESPACE
+
+#endif  // NIMBLEDB_BUFFER_POOL_H_
@@ -0,0 +1,170 @@
+// Copyright 2025 Nikolay Govorov. All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at LICENSE file in the root.
+
+// Measures the cost of passing a completion callback: a std::function made
+// for every call, as the callbacks used to be taken, against a FunctionRef
+// and the templated Put(). The callbacks capture as much as a typical caller,
+// more than std::function keeps without an allocation.
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <format>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "nimbledb/base.h"
+#include "nimbledb/db.h"
+
+namespace {
+
+using NIMBLEDB_NAMESPACE::Callback;
+using NIMBLEDB_NAMESPACE::CallbackRef;
+using NIMBLEDB_NAMESPACE::DB;
+using NIMBLEDB_NAMESPACE::Options;
+using NIMBLEDB_NAMESPACE::Status;
+
+constexpr int kKeys = 100000;
+
+// Returns the nanoseconds per operation, `run` performs `iterations` of them
+template <typename Function>
+double Measure(Function&& run) {
+  using Clock = std::chrono::steady_clock;
+
+  // Enough operations to run for about a second
+  size_t iterations = 1024;
+  for (;;) {
+    const auto start = Clock::now();
+    run(iterations);
+    const auto elapsed = Clock::now() - start;
+
+    if (elapsed >= std::chrono::milliseconds(500)) {
+      return std::chrono::duration<double, std::nano>(elapsed).count() /
+             static_cast<double>(iterations);
+    }
+    iterations *= 2;
+  }
+}
+
+void Report(const char* name, double ns) {
+  std::printf("%-28s %8.1f ns/op\n", name, ns);
+}
+
+// The calls can't be inlined through the pointer, as through the DB's methods
+__attribute__((noinline)) void InvokeFunction(const Callback<bool>& callback) {
+  callback(Status::Ok(), true);
+}
+__attribute__((noinline)) void InvokeRef(CallbackRef<bool> callback) {
+  callback(Status::Ok(), true);
+}
+
+}  // namespace
+
+int main() {
+  uint64_t sink = 0;
+  uint64_t a = 1;
+  uint64_t b = 2;
+  uint64_t c = 3;
+
+  std::printf("completion callback of 4 references\n");
+  Report("std::function", Measure([&](size_t iterations) {
+           for (size_t i = 0; i < iterations; ++i) {
+             InvokeFunction([&](const Status& st, bool found) {
+               sink += a + b + c + static_cast<uint64_t>(found && st.IsOk());
+             });
+           }
+         }));
+  Report("FunctionRef", Measure([&](size_t iterations) {
+           for (size_t i = 0; i < iterations; ++i) {
+             InvokeRef([&](const Status& st, bool found) {
+               sink += a + b + c + static_cast<uint64_t>(found && st.IsOk());
+             });
+           }
+         }));
+
+  const auto path =
+      (std::filesystem::temp_directory_path() / "nimbledb_callback_bench.bin")
+          .string();
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + ".journal");
+
+  // Without the log the operations are in memory, the callbacks matter most
+  std::shared_ptr<DB> db;
+  if (auto st = DB::Open(path, {.wal = false}, &db); !st.IsOk()) {
+    std::printf("open: %s\n", st.ToString().c_str());
+    return 1;
+  }
+
+  std::vector<std::string> keys;
+  keys.reserve(kKeys);
+  for (int i = 0; i < kKeys; ++i) {
+    keys.push_back(std::format("key-{:08}", (i * 7919) % kKeys));
+  }
+  const std::string value(100, 'v');
+
+  std::printf("\nDB operations of %d keys\n", kKeys);
+  Report("Put, std::function", Measure([&](size_t iterations) {
+           for (size_t i = 0; i < iterations; ++i) {
+             const Callback<bool> callback = [&](const Status& st, bool) {
+               sink += a + b + c + static_cast<uint64_t>(st.IsOk());
+             };
+             db->Put(keys[i % kKeys], value, callback);
+           }
+         }));
+  Report("Put, template", Measure([&](size_t iterations) {
+           for (size_t i = 0; i < iterations; ++i) {
+             db->Put(keys[i % kKeys], value, [&](const Status& st, bool) {
+               sink += a + b + c + static_cast<uint64_t>(st.IsOk());
+             });
+           }
+         }));
+
+  Report("Get, std::function", Measure([&](size_t iterations) {
+           for (size_t i = 0; i < iterations; ++i) {
+             const Callback<std::optional<std::string>> callback =
+                 [&](const Status& st,
+                     const std::optional<std::string>& found) {
+                   sink += a + b + c + found->size() +
+                           static_cast<uint64_t>(st.IsOk());
+                 };
+             db->Get(keys[i % kKeys], callback);
+           }
+         }));
+  Report("Get, FunctionRef", Measure([&](size_t iterations) {
+           for (size_t i = 0; i < iterations; ++i) {
+             db->Get(keys[i % kKeys],
+                     [&](const Status& st,
+                         const std::optional<std::string>& found) {
+                       sink += a + b + c + found->size() +
+                               static_cast<uint64_t>(st.IsOk());
+                     });
+           }
+         }));
+
+  std::string buffer;
+  Report("Get, FunctionRef and buffer", Measure([&](size_t iterations) {
+           for (size_t i = 0; i < iterations; ++i) {
+             db->Get(keys[i % kKeys], &buffer,
+                     [&](const Status& st, bool found) {
+                       sink += a + b + c + buffer.size() +
+                               static_cast<uint64_t>(found && st.IsOk());
+                     });
+           }
+         }));
+
+  if (auto st = db->Close(); !st.IsOk()) {
+    std::printf("close: %s\n", st.ToString().c_str());
+    return 1;
+  }
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + ".journal");
+
+  // The result keeps the calls from being optimized out
+  std::printf("\nsink %llu\n", static_cast<unsigned long long>(sink));
+  return 0;
+}
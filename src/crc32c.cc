@@ -0,0 +1,513 @@
+// Copyright 2025 Nikolay Govorov. All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at LICENSE file in the root.
+
+#include "src/crc32c.h"
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+
+#include "nimbledb/base.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define NIMBLEDB_CRC32C_SSE42
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__linux__) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define NIMBLEDB_CRC32C_ARM
+#include <arm_acle.h>
+#include <arm_neon.h>
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
+namespace NIMBLEDB_NAMESPACE {
+
+namespace {
+
+// Reversed Castagnoli polynomial
+constexpr uint32_t kPolynomial = 0x82f63b78;
+
+// Slicing-by-8 tables: `kTables[k][b]` is the CRC register after the byte `b`
+// followed by `k` zero bytes
+constexpr std::array<std::array<uint32_t, 256>, 8> MakeTables() {
+  std::array<std::array<uint32_t, 256>, 8> tables{};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1U) ^ ((crc & 1U) != 0 ? kPolynomial : 0);
+    }
+    tables[0][i] = crc;
+  }
+  for (size_t k = 1; k < tables.size(); ++k) {
+    for (uint32_t i = 0; i < 256; ++i) {
+      const uint32_t prev = tables[k - 1][i];
+      tables[k][i] = (prev >> 8U) ^ tables[0][prev & 0xffU];
+    }
+  }
+  return tables;
+}
+
+constexpr auto kTables = MakeTables();
+
+// The functions below extend the CRC register without the inversions
+uint32_t ExtendPortable(uint32_t crc, const std::byte* data, size_t size) {
+  if constexpr (std::endian::native == std::endian::little) {
+    for (; size >= 8; data += 8, size -= 8) {
+      uint64_t word;
+      std::memcpy(&word, data, sizeof(word));
+      word ^= crc;
+      crc = kTables[7][word & 0xffU] ^ kTables[6][(word >> 8U) & 0xffU] ^
+            kTables[5][(word >> 16U) & 0xffU] ^
+            kTables[4][(word >> 24U) & 0xffU] ^
+            kTables[3][(word >> 32U) & 0xffU] ^
+            kTables[2][(word >> 40U) & 0xffU] ^
+            kTables[1][(word >> 48U) & 0xffU] ^ kTables[0][word >> 56U];
+    }
+  }
+  for (; size > 0; ++data, --size) {
+    crc = kTables[0][(crc ^ static_cast<uint8_t>(*data)) & 0xffU] ^ (crc >> 8U);
+  }
+  return crc;
+}
+
+// The hardware instruction has a latency of 3 cycles and a throughput of 1,
+// so three independent streams over adjacent blocks keep it busy. The CRC of
+// the blocks is combined by shifting the register over the length of a block
+// with a table, see ShiftTable.
+constexpr size_t kLongBlock = 8192;
+constexpr size_t kShortBlock = 256;
+
+// The register after `bytes` zero bytes is linear in the register, so it's
+// looked up by each byte of the register
+class ShiftTable {
+ public:
+  explicit ShiftTable(size_t bytes) {
+    const std::vector<std::byte> zeros(bytes);
+    std::array<uint32_t, 32> basis{};
+    for (uint32_t bit = 0; bit < basis.size(); ++bit) {
+      basis[bit] = ExtendPortable(1U << bit, zeros.data(), zeros.size());
+    }
+    for (size_t k = 0; k < tables_.size(); ++k) {
+      for (uint32_t b = 0; b < 256; ++b) {
+        uint32_t crc = 0;
+        for (uint32_t bit = 0; bit < 8; ++bit) {
+          crc ^= (b >> bit & 1U) != 0 ? basis[(k * 8) + bit] : 0;
+        }
+        tables_[k][b] = crc;
+      }
+    }
+  }
+
+  [[nodiscard]] uint32_t Shift(uint32_t crc) const {
+    return tables_[0][crc & 0xffU] ^ tables_[1][(crc >> 8U) & 0xffU] ^
+           tables_[2][(crc >> 16U) & 0xffU] ^ tables_[3][crc >> 24U];
+  }
+
+ private:
+  std::array<std::array<uint32_t, 256>, 4> tables_{};
+};
+
+const ShiftTable& LongShift() {
+  static const ShiftTable table(kLongBlock);
+  return table;
+}
+
+const ShiftTable& ShortShift() {
+  static const ShiftTable table(kShortBlock);
+  return table;
+}
+
+uint64_t LoadWord(const std::byte* data) {
+  uint64_t word;
+  std::memcpy(&word, data, sizeof(word));
+  return word;
+}
+
+// The carry-less multiplication folds the data: a 128-bit lane A followed by
+// `bits` bits of data is congruent to the data with A.lo * x^(bits+32) +
+// A.hi * x^(bits-32) mod P added to its first lane. The constants are
+// bit-reflected and shifted by one to align the reflected product. The lanes
+// are folded ahead over the data, then into a single lane, whose CRC is the
+// CRC of the data.
+struct FoldConstants {
+  int64_t lo, hi;
+
+  static constexpr FoldConstants For(size_t bits) {
+    return {.lo = Power(bits + 32), .hi = Power(bits - 32)};
+  }
+
+  // x^n mod P, reflected and shifted
+  static constexpr int64_t Power(size_t n) {
+    uint32_t crc = 0x80000000U;  // x^0
+    for (size_t i = 0; i < n; ++i) {
+      crc = (crc >> 1U) ^ ((crc & 1U) != 0 ? kPolynomial : 0);
+    }
+    return static_cast<int64_t>(uint64_t{crc} << 1U);
+  }
+};
+
+constexpr auto kFold128 = FoldConstants::For(128);
+
+// The 64-bit multiply (PCLMULQDQ on x86-64, PMULL on ARMv8) folds a 128-bit
+// register with two, 8 bytes a cycle like the CRC instruction. The two run in
+// different units, so a block is split between them: its first half is
+// folded by six registers and the three streams of the instruction take the
+// other half. A round takes 96 bytes on either side, 12 multiplies against 12
+// CRC instructions, so neither waits for the other. The CRC of the parts is
+// combined with a table.
+constexpr size_t kSplitRegisters = 6;
+constexpr size_t kSplitRound = 16 * kSplitRegisters;
+constexpr size_t kSplitStream = 2688;
+constexpr size_t kSplitBlock = 6 * kSplitStream;
+static_assert(kSplitStream % kSplitRound == 0);
+constexpr auto kFoldSplit = FoldConstants::For(kSplitRound * 8);
+
+const ShiftTable& SplitShift() {
+  static const ShiftTable table(kSplitStream);
+  return table;
+}
+
+#ifdef NIMBLEDB_CRC32C_SSE42
+__attribute__((target("sse4.2"))) uint32_t ExtendSse42(uint32_t crc,
+                                                       const std::byte* data,
+                                                       size_t size) {
+  for (const size_t block : {kLongBlock, kShortBlock}) {
+    const auto& shift = block == kLongBlock ? LongShift() : ShortShift();
+    for (; size >= 3 * block; data += 3 * block, size -= 3 * block) {
+      uint64_t crc0 = crc;
+      uint64_t crc1 = 0;
+      uint64_t crc2 = 0;
+      for (size_t i = 0; i < block; i += 8) {
+        crc0 = _mm_crc32_u64(crc0, LoadWord(data + i));
+        crc1 = _mm_crc32_u64(crc1, LoadWord(data + block + i));
+        crc2 = _mm_crc32_u64(crc2, LoadWord(data + (2 * block) + i));
+      }
+      crc = shift.Shift(static_cast<uint32_t>(crc0)) ^
+            static_cast<uint32_t>(crc1);
+      crc = shift.Shift(crc) ^ static_cast<uint32_t>(crc2);
+    }
+  }
+
+  for (; size >= 8; data += 8, size -= 8) {
+    crc = static_cast<uint32_t>(_mm_crc32_u64(crc, LoadWord(data)));
+  }
+  for (; size > 0; ++data, --size) {
+    crc = _mm_crc32_u8(crc, static_cast<uint8_t>(*data));
+  }
+  return crc;
+}
+
+// With AVX-512 the lanes of eight 512-bit registers are folded 512 bytes
+// ahead at a time. Every 64 bytes take two 512-bit multiplies, and the CPUs
+// issue one a cycle, so a page costs at least one cycle per 32 bytes: ~1us
+// for 64KB at 2GHz. Eight independent registers hide the latency of the
+// multiply (four left the loop latency bound, ~10% slower); more don't help.
+// Nor do streams of the CRC instruction beside them, as in ExtendClmul():
+// with 15 of its instructions per 512 bytes a page took ~10% longer.
+constexpr size_t kFoldRegisters = 8;
+constexpr size_t kFoldBytes = 64 * kFoldRegisters;
+constexpr auto kFoldAhead = FoldConstants::For(kFoldBytes * 8);
+constexpr auto kFold512 = FoldConstants::For(512);
+constexpr auto kFold384 = FoldConstants::For(384);
+constexpr auto kFold256 = FoldConstants::For(256);
+
+__attribute__((target("pclmul,sse4.2"))) __m128i FoldLane(
+    __m128i lane, FoldConstants constants) {
+  const __m128i k = _mm_set_epi64x(constants.hi, constants.lo);
+  return _mm_xor_si128(_mm_clmulepi64_si128(lane, k, 0x00),
+                       _mm_clmulepi64_si128(lane, k, 0x11));
+}
+
+__attribute__((target("pclmul,sse4.2"))) uint32_t ExtendClmul(
+    uint32_t crc, const std::byte* data, size_t size) {
+  const auto& shift = SplitShift();
+  for (; size >= kSplitBlock; data += kSplitBlock, size -= kSplitBlock) {
+    const std::byte* streams = data + (3 * kSplitStream);
+
+    // The register goes into the first bits of the folded part
+    __m128i x[kSplitRegisters];  // NOLINT(*-avoid-c-arrays)
+#pragma GCC unroll 6
+    for (size_t i = 0; i < kSplitRegisters; ++i) {
+      x[i] = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(data + (16 * i)));
+    }
+    x[0] = _mm_xor_si128(x[0], _mm_cvtsi32_si128(static_cast<int>(crc)));
+
+    uint64_t crc0 = 0;
+    uint64_t crc1 = 0;
+    uint64_t crc2 = 0;
+    size_t pos = 0;
+    for (size_t fold = kSplitRound; fold < 3 * kSplitStream;
+         fold += kSplitRound, pos += kSplitRound / 3) {
+#pragma GCC unroll 6
+      for (size_t i = 0; i < kSplitRegisters; ++i) {
+        x[i] = _mm_xor_si128(
+            FoldLane(x[i], kFoldSplit),
+            _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(data + fold + (16 * i))));
+      }
+#pragma GCC unroll 4
+      for (size_t i = pos; i < pos + (kSplitRound / 3); i += 8) {
+        crc0 = _mm_crc32_u64(crc0, LoadWord(streams + i));
+        crc1 = _mm_crc32_u64(crc1, LoadWord(streams + kSplitStream + i));
+        crc2 = _mm_crc32_u64(crc2, LoadWord(streams + (2 * kSplitStream) + i));
+      }
+    }
+
+    // The streams are a round longer, the folded part starts with its loads
+#pragma GCC unroll 4
+    for (size_t i = pos; i < kSplitStream; i += 8) {
+      crc0 = _mm_crc32_u64(crc0, LoadWord(streams + i));
+      crc1 = _mm_crc32_u64(crc1, LoadWord(streams + kSplitStream + i));
+      crc2 = _mm_crc32_u64(crc2, LoadWord(streams + (2 * kSplitStream) + i));
+    }
+
+#pragma GCC unroll 6
+    for (size_t i = 1; i < kSplitRegisters; ++i) {
+      x[i] = _mm_xor_si128(x[i], FoldLane(x[i - 1], kFold128));
+    }
+    const __m128i lane = x[kSplitRegisters - 1];
+    uint64_t folded =
+        _mm_crc32_u64(0, static_cast<uint64_t>(_mm_extract_epi64(lane, 0)));
+    folded = _mm_crc32_u64(folded,
+                           static_cast<uint64_t>(_mm_extract_epi64(lane, 1)));
+
+    crc = shift.Shift(static_cast<uint32_t>(folded)) ^
+          static_cast<uint32_t>(crc0);
+    crc = shift.Shift(crc) ^ static_cast<uint32_t>(crc1);
+    crc = shift.Shift(crc) ^ static_cast<uint32_t>(crc2);
+  }
+  return ExtendSse42(crc, data, size);
+}
+
+__attribute__((target("avx512f,vpclmulqdq,pclmul,sse4.2"))) __m512i
+Broadcast(FoldConstants constants) {
+  return _mm512_set_epi64(constants.hi, constants.lo, constants.hi,
+                          constants.lo, constants.hi, constants.lo,
+                          constants.hi, constants.lo);
+}
+
+__attribute__((target("avx512f,vpclmulqdq,pclmul,sse4.2"))) __m512i
+FoldRegister(__m512i x, __m512i k, __m512i next) {
+  // 0x96 is the XOR of the three operands
+  return _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x, k, 0x00),
+                                   _mm512_clmulepi64_epi128(x, k, 0x11), next,
+                                   0x96);
+}
+
+__attribute__((target("avx512f,vpclmulqdq,pclmul,sse4.2"))) uint32_t
+ExtendAvx512(uint32_t crc, const std::byte* data, size_t size) {
+  if (size < 2 * kFoldBytes) {
+    return ExtendSse42(crc, data, size);
+  }
+
+  // The register goes into the first bits of the data
+  __m512i x[kFoldRegisters];  // NOLINT(*-avoid-c-arrays)
+#pragma GCC unroll 8
+  for (size_t i = 0; i < kFoldRegisters; ++i) {
+    x[i] = _mm512_loadu_si512(data + (64 * i));
+  }
+  x[0] = _mm512_xor_si512(
+      x[0], _mm512_zextsi128_si512(_mm_cvtsi32_si128(static_cast<int>(crc))));
+  data += kFoldBytes;
+  size -= kFoldBytes;
+
+  const __m512i k = Broadcast(kFoldAhead);
+  for (; size >= kFoldBytes; data += kFoldBytes, size -= kFoldBytes) {
+#pragma GCC unroll 8
+    for (size_t i = 0; i < kFoldRegisters; ++i) {
+      x[i] = FoldRegister(x[i], k, _mm512_loadu_si512(data + (64 * i)));
+    }
+  }
+
+  const __m512i k512 = Broadcast(kFold512);
+#pragma GCC unroll 8
+  for (size_t i = 1; i < kFoldRegisters; ++i) {
+    x[i] = FoldRegister(x[i - 1], k512, x[i]);
+  }
+
+  // The lanes of the last register are folded into its last one
+  alignas(64) __m128i lanes[4];  // NOLINT(*-avoid-c-arrays)
+  _mm512_store_si512(lanes, x[kFoldRegisters - 1]);
+  __m128i lane = lanes[3];
+  lane = _mm_xor_si128(lane, FoldLane(lanes[0], kFold384));
+  lane = _mm_xor_si128(lane, FoldLane(lanes[1], kFold256));
+  lane = _mm_xor_si128(lane, FoldLane(lanes[2], kFold128));
+
+  crc = static_cast<uint32_t>(
+      _mm_crc32_u64(0, static_cast<uint64_t>(_mm_extract_epi64(lane, 0))));
+  crc = static_cast<uint32_t>(
+      _mm_crc32_u64(crc, static_cast<uint64_t>(_mm_extract_epi64(lane, 1))));
+  return ExtendSse42(crc, data, size);
+}
+#endif  // NIMBLEDB_CRC32C_SSE42
+
+#ifdef NIMBLEDB_CRC32C_ARM
+#ifdef __clang__
+#define NIMBLEDB_TARGET_CRC __attribute__((target("crc")))
+#define NIMBLEDB_TARGET_CRC_PMULL __attribute__((target("crc,aes")))
+#else
+#define NIMBLEDB_TARGET_CRC __attribute__((target("+crc")))
+#define NIMBLEDB_TARGET_CRC_PMULL __attribute__((target("+crc+crypto")))
+#endif
+
+NIMBLEDB_TARGET_CRC uint32_t ExtendArm(uint32_t crc, const std::byte* data,
+                                       size_t size) {
+  for (const size_t block : {kLongBlock, kShortBlock}) {
+    const auto& shift = block == kLongBlock ? LongShift() : ShortShift();
+    for (; size >= 3 * block; data += 3 * block, size -= 3 * block) {
+      uint32_t crc0 = crc;
+      uint32_t crc1 = 0;
+      uint32_t crc2 = 0;
+      for (size_t i = 0; i < block; i += 8) {
+        crc0 = __crc32cd(crc0, LoadWord(data + i));
+        crc1 = __crc32cd(crc1, LoadWord(data + block + i));
+        crc2 = __crc32cd(crc2, LoadWord(data + (2 * block) + i));
+      }
+      crc = shift.Shift(crc0) ^ crc1;
+      crc = shift.Shift(crc) ^ crc2;
+    }
+  }
+
+  for (; size >= 8; data += 8, size -= 8) {
+    crc = __crc32cd(crc, LoadWord(data));
+  }
+  for (; size > 0; ++data, --size) {
+    crc = __crc32cb(crc, static_cast<uint8_t>(*data));
+  }
+  return crc;
+}
+
+NIMBLEDB_TARGET_CRC_PMULL uint64x2_t Load128(const std::byte* data) {
+  return vreinterpretq_u64_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(data)));
+}
+
+// See FoldLane() of x86-64
+NIMBLEDB_TARGET_CRC_PMULL uint64x2_t FoldLaneArm(uint64x2_t lane,
+                                                 FoldConstants constants) {
+  const poly128_t lo =
+      vmull_p64(static_cast<poly64_t>(vgetq_lane_u64(lane, 0)),
+                static_cast<poly64_t>(constants.lo));
+  const poly128_t hi =
+      vmull_p64(static_cast<poly64_t>(vgetq_lane_u64(lane, 1)),
+                static_cast<poly64_t>(constants.hi));
+  return veorq_u64(vreinterpretq_u64_p128(lo), vreinterpretq_u64_p128(hi));
+}
+
+// See ExtendClmul()
+NIMBLEDB_TARGET_CRC_PMULL uint32_t ExtendPmull(uint32_t crc,
+                                               const std::byte* data,
+                                               size_t size) {
+  const auto& shift = SplitShift();
+  for (; size >= kSplitBlock; data += kSplitBlock, size -= kSplitBlock) {
+    const std::byte* streams = data + (3 * kSplitStream);
+
+    // The register goes into the first bits of the folded part
+    uint64x2_t x[kSplitRegisters];  // NOLINT(*-avoid-c-arrays)
+#pragma GCC unroll 6
+    for (size_t i = 0; i < kSplitRegisters; ++i) {
+      x[i] = Load128(data + (16 * i));
+    }
+    x[0] = veorq_u64(x[0], vsetq_lane_u64(crc, vdupq_n_u64(0), 0));
+
+    uint32_t crc0 = 0;
+    uint32_t crc1 = 0;
+    uint32_t crc2 = 0;
+    size_t pos = 0;
+    for (size_t fold = kSplitRound; fold < 3 * kSplitStream;
+         fold += kSplitRound, pos += kSplitRound / 3) {
+#pragma GCC unroll 6
+      for (size_t i = 0; i < kSplitRegisters; ++i) {
+        x[i] = veorq_u64(FoldLaneArm(x[i], kFoldSplit),
+                         Load128(data + fold + (16 * i)));
+      }
+#pragma GCC unroll 4
+      for (size_t i = pos; i < pos + (kSplitRound / 3); i += 8) {
+        crc0 = __crc32cd(crc0, LoadWord(streams + i));
+        crc1 = __crc32cd(crc1, LoadWord(streams + kSplitStream + i));
+        crc2 = __crc32cd(crc2, LoadWord(streams + (2 * kSplitStream) + i));
+      }
+    }
+
+    // The streams are a round longer, the folded part starts with its loads
+#pragma GCC unroll 4
+    for (size_t i = pos; i < kSplitStream; i += 8) {
+      crc0 = __crc32cd(crc0, LoadWord(streams + i));
+      crc1 = __crc32cd(crc1, LoadWord(streams + kSplitStream + i));
+      crc2 = __crc32cd(crc2, LoadWord(streams + (2 * kSplitStream) + i));
+    }
+
+#pragma GCC unroll 6
+    for (size_t i = 1; i < kSplitRegisters; ++i) {
+      x[i] = veorq_u64(x[i], FoldLaneArm(x[i - 1], kFold128));
+    }
+    const uint64x2_t lane = x[kSplitRegisters - 1];
+    uint32_t folded = __crc32cd(0, vgetq_lane_u64(lane, 0));
+    folded = __crc32cd(folded, vgetq_lane_u64(lane, 1));
+
+    crc = shift.Shift(folded) ^ crc0;
+    crc = shift.Shift(crc) ^ crc1;
+    crc = shift.Shift(crc) ^ crc2;
+  }
+  return ExtendArm(crc, data, size);
+}
+#endif  // NIMBLEDB_CRC32C_ARM
+
+using ExtendFunction = uint32_t (*)(uint32_t, const std::byte*, size_t);
+
+// The register is inverted around the extension
+template <ExtendFunction extend>
+uint32_t Checksum(std::span<const std::byte> data, uint32_t crc) {
+  return ~extend(~crc, data.data(), data.size());
+}
+
+}  // namespace
+
+std::vector<Crc32cImplementation> Crc32cImplementations() {
+  std::vector<Crc32cImplementation> implementations;
+#ifdef NIMBLEDB_CRC32C_SSE42
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("vpclmulqdq")) {
+    implementations.push_back({"AVX-512", Checksum<ExtendAvx512>});
+  }
+  if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul")) {
+    implementations.push_back({"PCLMULQDQ", Checksum<ExtendClmul>});
+  }
+  if (__builtin_cpu_supports("sse4.2")) {
+    implementations.push_back({"SSE4.2", Checksum<ExtendSse42>});
+  }
+#endif  // NIMBLEDB_CRC32C_SSE42
+
+#ifdef NIMBLEDB_CRC32C_ARM
+  const auto hwcap = getauxval(AT_HWCAP);
+  if ((hwcap & HWCAP_CRC32) != 0 && (hwcap & HWCAP_PMULL) != 0) {
+    implementations.push_back({"PMULL", Checksum<ExtendPmull>});
+  }
+  if ((hwcap & HWCAP_CRC32) != 0) {
+    implementations.push_back({"CRC32", Checksum<ExtendArm>});
+  }
+#endif  // NIMBLEDB_CRC32C_ARM
+
+  implementations.push_back({"Portable", Checksum<ExtendPortable>});
+  return implementations;
+}
+
+uint32_t Crc32c(std::span<const std::byte> data, uint32_t crc) {
+  static const auto checksum = Crc32cImplementations().front().function;
+  return checksum(data, crc);
+}
+
+uint32_t Crc32cPortable(std::span<const std::byte> data, uint32_t crc) {
+  return Checksum<ExtendPortable>(data, crc);
+}
+
+}  // namespace NIMBLEDB_NAMESPACE
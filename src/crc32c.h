@@ -0,0 +1,37 @@
+// Copyright 2025 Nikolay Govorov. All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at LICENSE file in the root.
+
+#ifndef NIMBLEDB_CRC32C_H_
+#define NIMBLEDB_CRC32C_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "nimbledb/base.h"
+
+namespace NIMBLEDB_NAMESPACE {
+
+// Computes the CRC-32C (Castagnoli) of the data. Pass the previous result as
+// `crc` to continue the checksum over several buffers.
+uint32_t Crc32c(std::span<const std::byte> data, uint32_t crc = 0);
+
+// The table-driven implementation used without the CRC instructions (SSE4.2
+// on x86-64, the CRC extension on ARMv8), for the tests and benchmarks
+uint32_t Crc32cPortable(std::span<const std::byte> data, uint32_t crc = 0);
+
+// An implementation of Crc32c() with the instructions of a CPU
+struct Crc32cImplementation {
+  const char* name;
+  uint32_t (*function)(std::span<const std::byte> data, uint32_t crc);
+};
+
+// The implementations the CPU supports, the one Crc32c() uses first and the
+// portable one last, for the tests and benchmarks
+std::vector<Crc32cImplementation> Crc32cImplementations();
+
+}  // namespace NIMBLEDB_NAMESPACE
+
+#endif  // NIMBLEDB_CRC32C_H_
@@ -0,0 +1,82 @@
+// Copyright 2025 Nikolay Govorov. All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at LICENSE file in the root.
+
+// Measures the checksum of a b-tree page, which is computed for every page
+// written back and verified for every page read, with every implementation
+// the CPU supports.
+//
+// The target of well under 1us per 64KB page isn't reached: the folding is
+// bound by the throughput of the carry-less multiply. Measured on a 2GHz Xeon
+// VM: ~1.0us (~65GB/s) with AVX-512, one cycle per 32 bytes; ~1.7us with the
+// 128-bit PCLMULQDQ split with the CRC instruction, 16 bytes a cycle from
+// both units; ~3.4us with the CRC instruction alone and ~45us portable. The
+// PMULL path of ARMv8 is bound the same way as PCLMULQDQ.
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <span>
+#include <vector>
+
+#include "nimbledb/base.h"
+#include "src/crc32c.h"
+
+namespace {
+
+using NIMBLEDB_NAMESPACE::Crc32cImplementations;
+
+constexpr size_t kPageSize = 1 << 16;
+
+// Returns the nanoseconds per call, the checksums are chained so the calls
+// can't be elided or overlapped
+template <typename Function>
+double Measure(Function&& function, std::span<const std::byte> page,
+               uint32_t* sink) {
+  using Clock = std::chrono::steady_clock;
+
+  // Enough calls to run for about a second
+  size_t iterations = 16;
+  for (;;) {
+    const auto start = Clock::now();
+    uint32_t crc = 0;
+    for (size_t i = 0; i < iterations; ++i) {
+      crc = function(page, crc);
+    }
+    const auto elapsed = Clock::now() - start;
+    *sink ^= crc;
+
+    if (elapsed >= std::chrono::milliseconds(500)) {
+      return std::chrono::duration<double, std::nano>(elapsed).count() /
+             static_cast<double>(iterations);
+    }
+    iterations *= 2;
+  }
+}
+
+void Report(const char* name, double ns) {
+  const double gbps = static_cast<double>(kPageSize) / ns;
+  std::printf("%-10s %10.1f ns/page %8.2f GB/s\n", name, ns, gbps);
+}
+
+}  // namespace
+
+int main() {
+  std::vector<std::byte> page(kPageSize);
+  for (size_t i = 0; i < page.size(); ++i) {
+    page[i] = static_cast<std::byte>((i * 2654435761U) >> 13U);
+  }
+
+  std::printf("crc32c of a %zu KB page, the first one is used\n",
+              kPageSize >> 10);
+
+  uint32_t sink = 0;
+  for (const auto& implementation : Crc32cImplementations()) {
+    Report(implementation.name, Measure(implementation.function, page, &sink));
+  }
+
+  // The result keeps the calls from being optimized out
+  std::printf("checksum %08x\n", sink);
+  return 0;
+}
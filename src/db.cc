@@ -17,6 +17,7 @@
 #include <format>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <memory>
 #include <new>
@@ -28,9 +29,16 @@
 #include <tuple>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "nimbledb/base.h"
 #include "nimbledb/system.h"
+#include "src/bloom_filter.h"
+#include "src/buffer_pool.h"
+#include "src/crc32c.h"
+#include "src/journal.h"
+#include "src/value_log.h"
+#include "src/wal.h"
 
 namespace {
 
@@ -38,395 +46,3096 @@ namespace {
 // data block size on most systems)
 constexpr size_t btree_page_size = 1U << 16U;  // 64KB
 
-// B-tree cardinality
-constexpr size_t btree_page_keys = 48;
+// Key & entry max size in bytes. An entry (key, value and its slot) takes at
+// most a quarter of the page, so a page split always leaves both halves with
+// enough room for the entry being inserted.
+constexpr size_t btree_maxsize_key = 1024;
+constexpr size_t btree_maxsize_entry = btree_page_size / 4;
 
-// Key & value max size in bytes
-constexpr size_t btree_maxsize_key = 64;
-constexpr size_t btree_maxsize_value = 512;
+// A node with less bytes of entries borrows from or merges with a sibling
+constexpr size_t btree_minsize_node = btree_page_size / 4;
+
+// Marks the absence of a sibling
+constexpr int64_t kNoNode = -1;
+
+// Pages 0 and 1 hold the two copies of the meta page, the tree starts after
+constexpr int64_t kMetaPages = 2;
+
+// Only the beginning of a meta page is written, a sector is written atomically
+// by most devices. The lists following the meta take the next sectors of the
+// page if they don't fit into the first one.
+constexpr size_t kMetaSize = 4096;
+
+constexpr uint64_t kMetaMagic = 0x4244454c424d494e;  // "NIMBLEDB"
+constexpr uint32_t kMetaVersion = 8;
+
+// The count of a list which didn't fit into the meta page, the open scans the
+// tree for it then
+constexpr uint32_t kNotKept = std::numeric_limits<uint32_t>::max();
+
+// The meta is read and written directly from the buffer, aligned as the pages
+// are for the direct I/O
+struct MetaDelete {
+  void operator()(std::byte* data) const {
+    ::operator delete[](data, std::align_val_t{kMetaSize});
+  }
+};
+using MetaBuffer = std::unique_ptr<std::byte[], MetaDelete>;
+
+MetaBuffer NewMetaBuffer(size_t size) {
+  return MetaBuffer(static_cast<std::byte*>(::operator new[](
+      size, std::align_val_t{kMetaSize}, std::nothrow)));
+}
+
+// The leaves added to the Bloom filter by a single operation after the open
+constexpr size_t kFilterFillLeaves = 8;
+
+// The cache must fit every page pinned by a single operation: a node on each
+// level of the tree and the nodes created by a split.
+constexpr size_t kMinCachePages = 16;
+
+// Returns the first 8 bytes of the key as a big-endian number padded with
+// zeros, so heads compare as the keys they are taken from. Equal heads don't
+// mean equal keys: the rest of the keys and their lengths may differ.
+uint64_t KeyHead(std::string_view key) {
+  std::array<unsigned char, sizeof(uint64_t)> bytes{};
+  std::copy_n(key.begin(), std::min(key.size(), bytes.size()), bytes.begin());
+
+  uint64_t head = 0;
+  for (const auto byte : bytes) {
+    head = (head << 8U) | byte;
+  }
+  return head;
+}
+
+// Returns the length of the common prefix of the keys
+size_t CommonPrefix(std::string_view a, std::string_view b) {
+  const auto [end, unused] = std::ranges::mismatch(a, b);
+  return static_cast<size_t>(end - a.begin());
+}
+
+// Returns a short key S with `left` <= S < `right`. A separator only routes
+// the search, so instead of the left key itself the shortest string between
+// the keys is taken (suffix truncation).
+std::string ShortestSeparator(std::string_view left, std::string_view right) {
+  assert(left < right);
+  const size_t common = CommonPrefix(left, right);
+  if (common == left.size()) {
+    return std::string(left);
+  }
+
+  // The first differing byte of `right` is greater, its shorter prefix is
+  // between the keys
+  if (common + 1 < right.size()) {
+    return std::string(right.substr(0, common + 1));
+  }
+
+  // Otherwise `left` is cut after the first byte past the common prefix which
+  // can be incremented
+  for (size_t i = common + 1; i + 1 < left.size(); ++i) {
+    if (static_cast<unsigned char>(left[i]) != 0xffU) {
+      std::string separator(left.substr(0, i + 1));
+      separator.back() = static_cast<char>(left[i] + 1);
+      return separator;
+    }
+  }
+  return std::string(left);
+}
+
+// The value of a leaf entry kept in a chain of overflow pages
+struct OverflowRef {
+  int64_t first;  // the first page of the chain or `kNoNode` if it's empty
+  uint64_t size;
+
+  static OverflowRef Decode(std::string_view bytes) {
+    OverflowRef ref{.first = kNoNode, .size = 0};
+    std::memcpy(&ref, bytes.data(), std::min(bytes.size(), sizeof(ref)));
+    return ref;
+  }
+};
 
 }  // namespace
 
-namespace NIMBLEDB_NAMESPACE {
+namespace NIMBLEDB_NAMESPACE {
+
+// Node of the B+tree, all values are stored in the leaves. Interior nodes only
+// route the search: the child of a slot holds the keys less than or equal to
+// the slot's key, `upper` holds the keys greater than the last one. Leaves are
+// linked into a doubly linked list in the key order.
+//
+// The node is a slotted page: the header is followed by the slot directory
+// growing forward and by the heap of records growing backward from the end of
+// the page.
+//
+//   | header | slot 0 | slot 1 | ... -> free space <- ... | rec 1 | rec 0 |
+//
+// Slots are sorted by key and point to the records: `key | value` in leaves
+// and `key | child id` in interior nodes. A removed record leaves a hole in
+// the heap until the page is compacted. Each slot also caches the head of its
+// key, so a binary search over the slots mostly compares integers and reads
+// the records only when the heads are equal.
+//
+// The keys are stored without the prefix shared by all of them, the prefix is
+// kept once in the heap. It's taken from the first and the last keys when the
+// node is filled or compacted and shrinks when a key not starting with it is
+// inserted. The slot heads are taken from the stored parts of the keys, so
+// they tell apart keys with a long common prefix.
+//
+// In the copy-on-write mode the leaves aren't linked: a copied leaf would have
+// to update its neighbors, which would be copied in turn.
+//
+// A value too large for the leaf is stored in a chain of overflow pages and
+// the slot's value type is `kOverflow`, its value is an `OverflowRef`. An
+// overflow page has no slots, its part of the value fills the heap and `next`
+// links the following page. The chains are never modified: a new value gets a
+// new chain and the old one is freed. The value of a `kLog` slot is a
+// `ValueLog::Ref` to the value log.
+//
+// Optimistic readers may see a node in the middle of a modification, see
+// NodeRef. The accessors they use keep the reads within the page whatever the
+// slots hold, the result is discarded unless the node's version validates.
+struct DB::BTreeNode {
+  struct Slot {
+    uint64_t head;  // see KeyHead()
+    uint32_t offset;
+    uint16_t key_size;
+    uint16_t value_size : 14;
+    uint16_t value_type : 2;  // leaf only, see ValueType
+  };
+
+  uint32_t checksum;  // of the rest of the page, see BufferPool
+  uint32_t extent;    // the compressed size on disk, see BufferPool
+
+  NodeId id;
+  NodeId upper;       // interior only, the child with keys after the last slot
+  NodeId prev, next;  // leaf only, the siblings or `kNoNode`, free pages
+                      // are linked through `next`
+  uint64_t sequence;  // the version the page is created in, see DB
+
+  uint32_t count;          // number of slots
+  uint32_t heap_offset;    // the beginning of the records heap
+  uint32_t garbage;        // bytes of the removed records in the heap
+  uint32_t prefix_offset;  // the prefix of the keys in the heap
+  uint16_t prefix_size;
+
+  NodeType page_type;
+
+  // Returns the bytes taken by an entry including its slot, the value of an
+  // interior entry is the child id
+  static size_t EntrySize(NodeType type, size_t key_size, size_t value_size) {
+    return sizeof(Slot) + key_size +
+           (type == kInterior ? sizeof(NodeId) : value_size);
+  }
+
+  // Erases all entries, the keys inserted next are stored without the prefix
+  void Reset(std::string_view prefix = {}) {
+    count = 0;
+    heap_offset = btree_page_size - prefix.size();
+    garbage = 0;
+    prefix_offset = heap_offset;
+    prefix_size = static_cast<uint16_t>(prefix.size());
+    std::ranges::copy(prefix, reinterpret_cast<char*>(page() + heap_offset));
+  }
+
+  std::byte* page() { return reinterpret_cast<std::byte*>(this); }
+  Slot* slots() { return reinterpret_cast<Slot*>(page() + sizeof(BTreeNode)); }
+
+  [[nodiscard]] size_t FreeSpace() {
+    return heap_offset - sizeof(BTreeNode) - (count * sizeof(Slot));
+  }
+
+  // Bytes taken by the entries
+  [[nodiscard]] size_t UsedSpace() {
+    return btree_page_size - sizeof(BTreeNode) - FreeSpace() - garbage;
+  }
+
+  // Compaction is required when the contiguous free space is not enough
+  [[nodiscard]] bool HasSpaceFor(size_t entry_size) {
+    return FreeSpace() + garbage >= entry_size;
+  }
+
+  // Returns `size` bytes of the page at `offset` clipped to the page
+  std::string_view Bytes(size_t offset, size_t size) {
+    const size_t begin = std::min(offset, btree_page_size);
+    return {reinterpret_cast<const char*>(page() + begin),
+            std::min(size, btree_page_size - begin)};
+  }
+
+  // Returns `size` bytes of the record `i` after the first `skip` ones
+  std::string_view RecordAt(size_t i, size_t skip, size_t size) {
+    return Bytes(size_t{slots()[i].offset} + skip, size);
+  }
+
+  std::string_view Prefix() { return Bytes(prefix_offset, prefix_size); }
+
+  // The stored part of the key after the prefix
+  std::string_view SuffixAt(size_t i) {
+    return RecordAt(i, 0, slots()[i].key_size);
+  }
+
+  std::string KeyAt(size_t i) {
+    std::string key(Prefix());
+    key.append(SuffixAt(i));
+    return key;
+  }
+
+  // The optimistic readers use the accessors below before they validate the
+  // page, which may be reused as a page of another type meanwhile, so the
+  // type isn't asserted. The setters are used under the latch only.
+  std::string_view ValueAt(size_t i) {
+    const auto& slot = slots()[i];
+    return RecordAt(i, slot.key_size, slot.value_size);
+  }
+
+  ValueType ValueTypeAt(size_t i) {
+    return static_cast<ValueType>(slots()[i].value_type);
+  }
+
+  // Overwrites the value in place with one of the same size
+  void SetValueAt(size_t i, std::string_view value) {
+    assert(page_type == kLeaf && value.size() == slots()[i].value_size);
+    std::memcpy(page() + slots()[i].offset + slots()[i].key_size, value.data(),
+                value.size());
+  }
+
+  // Returns the child to descend into from the slot, `count` means `upper`
+  NodeId ChildAt(size_t i) {
+    if (i >= count) {
+      return upper;
+    }
+
+    const auto record = RecordAt(i, slots()[i].key_size, sizeof(NodeId));
+    NodeId child = kNoNode;
+    std::memcpy(&child, record.data(), record.size());
+    return child;
+  }
+
+  void SetChildAt(size_t i, NodeId child) {
+    assert(page_type == kInterior);
+    if (i == count) {
+      upper = child;
+      return;
+    }
+
+    const auto& slot = slots()[i];
+    std::memcpy(page() + slot.offset + slot.key_size, &child, sizeof(NodeId));
+  }
+
+  // Returns the bytes an insert of the entry takes, including the growth of
+  // the stored keys if the prefix has to be shrunk for the key
+  size_t InsertSize(std::string_view key, std::string_view value) {
+    const size_t common = CommonPrefix(key, Prefix());
+    return EntrySize(page_type, key.size() - common, value.size()) +
+           ((prefix_size - common) * count);
+  }
+
+  // Returns the first slot with the key not less than `key` and whether the
+  // key is equal
+  std::pair<size_t, bool> LowerBound(std::string_view key) {
+    // The keys not starting with the prefix are before or after all the keys
+    const auto prefix = Prefix();
+    if (!key.starts_with(prefix)) {
+      return {key < prefix ? 0 : count, false};
+    }
+    key.remove_prefix(prefix.size());
+
+    const uint64_t head = KeyHead(key);
+
+    size_t lo = 0;
+    size_t hi = count;
+    bool exact = false;
+    while (lo < hi) {
+      const size_t mid = lo + ((hi - lo) / 2);
+      const uint64_t mid_head = slots()[mid].head;
+
+      int cmp = mid_head < head ? -1 : 1;
+      if (mid_head == head) {
+        cmp = SuffixAt(mid).compare(key);
+      }
+
+      if (cmp < 0) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+        exact = cmp == 0;
+      }
+    }
+    return {lo, exact};
+  }
+
+  // The caller must check there is enough space with `HasSpaceFor()` for the
+  // `InsertSize()`
+  void Insert(size_t pos, std::string_view key, std::string_view value,
+              NodeId child, ValueType value_type) {
+    assert(HasSpaceFor(InsertSize(key, value)));
+    if (!key.starts_with(Prefix()) ||
+        FreeSpace() <
+            EntrySize(page_type, key.size() - prefix_size, value.size())) {
+      Compact(key);
+    }
+
+    const auto suffix = key.substr(prefix_size);
+    const size_t entry_size = EntrySize(page_type, suffix.size(), value.size());
+    heap_offset -= entry_size - sizeof(Slot);
+
+    auto* record = page() + heap_offset;
+    std::memcpy(record, suffix.data(), suffix.size());
+    if (page_type == kInterior) {
+      std::memcpy(record + suffix.size(), &child, sizeof(NodeId));
+    } else {
+      std::memcpy(record + suffix.size(), value.data(), value.size());
+    }
+
+    std::memmove(&slots()[pos + 1], &slots()[pos],
+                 (count - pos) * sizeof(Slot));
+    slots()[pos] = {
+        .head = KeyHead(suffix),
+        .offset = heap_offset,
+        .key_size = static_cast<uint16_t>(suffix.size()),
+        .value_size = static_cast<uint16_t>(
+            page_type == kInterior ? sizeof(NodeId) : value.size()),
+        .value_type = static_cast<uint16_t>(value_type)};
+    count += 1;
+  }
+
+  void Remove(size_t pos) {
+    const auto& slot = slots()[pos];
+    garbage += EntrySize(page_type, slot.key_size, slot.value_size) -
+               sizeof(Slot);
+
+    std::memmove(&slots()[pos], &slots()[pos + 1],
+                 (count - pos - 1) * sizeof(Slot));
+    count -= 1;
+  }
+
+  // Moves all records to the end of the page to merge the holes left by the
+  // removed records into the free space. The prefix is taken anew to be
+  // shared by the keys and `key`.
+  void Compact(std::string_view key) {
+    auto copy = std::make_unique_for_overwrite<std::byte[]>(btree_page_size);
+    std::memcpy(copy.get(), page(), btree_page_size);
+    auto* old = reinterpret_cast<BTreeNode*>(copy.get());
+
+    // The first and the last keys share the prefix with the ones between
+    const auto old_prefix = old->Prefix();
+    std::string prefix;
+    if (count > 0) {
+      prefix = old->KeyAt(0);
+      prefix.resize(std::min(
+          old_prefix.size() +
+              CommonPrefix(old->SuffixAt(0), old->SuffixAt(count - 1)),
+          CommonPrefix(prefix, key)));
+    }
+
+    const size_t n = count;
+    Reset(prefix);
+    for (size_t i = 0; i < n; ++i) {
+      const auto& slot = old->slots()[i];
+
+      // The new suffix is the rest of the old prefix followed by the old
+      // suffix, or the old suffix cut further
+      const size_t cut = std::min(prefix.size(), old_prefix.size());
+      const auto head = old_prefix.substr(cut);
+      const auto tail = old->SuffixAt(i).substr(prefix.size() - cut);
+      const auto value = old->RecordAt(i, slot.key_size, slot.value_size);
+
+      const size_t key_size = head.size() + tail.size();
+      heap_offset -= key_size + value.size();
+      auto* record = page() + heap_offset;
+      std::memcpy(record, head.data(), head.size());
+      std::memcpy(record + head.size(), tail.data(), tail.size());
+      std::memcpy(record + key_size, value.data(), value.size());
+
+      const std::string_view stored(reinterpret_cast<const char*>(record),
+                                    key_size);
+      slots()[i] = {.head = KeyHead(stored),
+                    .offset = heap_offset,
+                    .key_size = static_cast<uint16_t>(key_size),
+                    .value_size = slot.value_size,
+                    .value_type = slot.value_type};
+    }
+    count = n;
+  }
+};
+
+// The readers don't lock the nodes: they take the version of a node, read it
+// and validate the version, a changed one restarts the read. A child is
+// pinned and its version is taken before the parent is validated, so the
+// child is known to be the one the parent pointed to (lock coupling). The
+// writer latches a node when it marks it dirty and releases it with the
+// reference.
+class DB::NodeRef {
+ public:
+  NodeRef() = default;
+  explicit NodeRef(BufferPool::PageRef page) : page_(std::move(page)) {}
+
+  explicit operator bool() const { return static_cast<bool>(page_); }
+
+  BTreeNode* operator->() const {
+    return reinterpret_cast<BTreeNode*>(page_.data());
+  }
+
+  // Must be called before the node is modified
+  void MarkDirty() const { page_.MarkDirty(); }
+
+  [[nodiscard]] uint64_t Version() const { return page_.Version(); }
+  [[nodiscard]] bool Validate(uint64_t version) const {
+    return page_.Validate(version);
+  }
+
+  void Unlatch() const { page_.Unlatch(); }
+  void Reset() { page_.Reset(); }
+
+ private:
+  BufferPool::PageRef page_;
+};
+
+// An entry detached from the page
+struct DB::Entry {
+  std::string key;
+  std::string value;
+  NodeId child;
+  ValueType value_type;
+
+  // Appends copies of all entries of the node
+  static void Collect(const NodeRef& node, std::vector<Entry>* entries) {
+    const bool leaf = node->page_type == kLeaf;
+    for (size_t i = 0; i < node->count; ++i) {
+      entries->push_back(
+          {.key = node->KeyAt(i),
+           .value = leaf ? std::string(node->ValueAt(i)) : std::string(),
+           .child = leaf ? kNoNode : node->ChildAt(i),
+           .value_type = leaf ? node->ValueTypeAt(i) : ValueType::kInline});
+    }
+  }
+
+  // Returns the length of the prefix shared by the sorted entries
+  static size_t Prefix(std::span<const Entry> entries) {
+    return entries.empty()
+               ? 0
+               : CommonPrefix(entries.front().key, entries.back().key);
+  }
+
+  // Returns the bytes taken by the entries in a node of the type, the keys
+  // are stored without their common prefix
+  static size_t TotalSize(NodeType type, std::span<const Entry> entries) {
+    const size_t prefix = Prefix(entries);
+    size_t total = prefix;
+    for (const auto& e : entries) {
+      total +=
+          BTreeNode::EntrySize(type, e.key.size() - prefix, e.value.size());
+    }
+    return total;
+  }
+
+  // Returns the index dividing the entries into two nodes, the larger of which
+  // is as small as possible. Both halves are not empty and for interior nodes
+  // the entries after the middle are not empty either.
+  //
+  // The halves are measured with their own prefixes: a key breaking the
+  // prefix of a full node would take as much space again if the keys were
+  // divided evenly.
+  static size_t Middle(NodeType type, const std::vector<Entry>& entries) {
+    const bool leaf = type == kLeaf;
+
+    // The bytes of the first `i` entries with the whole keys
+    std::vector<size_t> sizes(entries.size() + 1);
+    for (size_t i = 0; i < entries.size(); ++i) {
+      const auto& e = entries[i];
+      sizes[i + 1] =
+          sizes[i] + BTreeNode::EntrySize(type, e.key.size(), e.value.size());
+    }
+    const auto half_size = [&](size_t begin, size_t end) {
+      const size_t prefix =
+          CommonPrefix(entries[begin].key, entries[end - 1].key);
+      return sizes[end] - sizes[begin] - ((end - begin - 1) * prefix);
+    };
+
+    size_t middle = 1;
+    size_t best = std::numeric_limits<size_t>::max();
+    for (size_t i = 1; i + (leaf ? 0 : 1) < entries.size(); ++i) {
+      const size_t size = std::max(
+          half_size(0, i), half_size(leaf ? i : i + 1, entries.size()));
+      if (size < best) {
+        best = size;
+        middle = i;
+      }
+    }
+    return middle;
+  }
+
+  // Replaces the entries of the node, the keys share the prefix of the first
+  // and the last ones
+  static void Store(const NodeRef& node, std::span<const Entry> entries) {
+    node->Reset(entries.empty()
+                    ? std::string_view()
+                    : std::string_view(entries.front().key)
+                          .substr(0, Prefix(entries)));
+    for (size_t i = 0; i < entries.size(); ++i) {
+      const auto& e = entries[i];
+      node->Insert(i, e.key, e.value, e.child, e.value_type);
+    }
+  }
+};
+
+struct DB::Meta {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t page_size;
+
+  uint64_t sequence;  // the version of the commit, grows with every one
+
+  NodeId root_id;  // `kNoNode` for the empty tree
+  NodeId pages;
+  NodeId free_head;
+
+  // The log records before this LSN are in the datafile
+  uint64_t lsn;
+
+  // The oldest segment of the value log, the ones before it are collected
+  uint32_t value_log_tail;
+
+  uint32_t codec;  // the compression of the pages, see Codec::id()
+
+  // The lists after the meta, so the open doesn't scan the tree: the free
+  // pages of the copy-on-write mode as the runs of (first page, count) and
+  // the bytes referenced in every value log segment from the tail. The
+  // in-place mode keeps no runs, its free pages are linked from `free_head`.
+  uint32_t free_runs;
+  uint32_t value_log_segments;
+
+  uint32_t checksum;  // crc32c of the fields above and of the lists
+
+  // The checksum of the meta at the beginning of `buffer`, the lists included
+  static uint32_t Checksum(std::span<const std::byte> buffer, size_t size) {
+    const uint32_t crc = Crc32c(buffer.first(offsetof(Meta, checksum)));
+    return Crc32c(buffer.subspan(sizeof(Meta), size - sizeof(Meta)), crc);
+  }
+
+  // The bytes of the meta with the lists
+  [[nodiscard]] size_t Size() const {
+    return sizeof(Meta) +
+           (free_runs != kNotKept ? free_runs * 2 * sizeof(NodeId) : 0) +
+           (value_log_segments != kNotKept
+                ? value_log_segments * sizeof(uint64_t)
+                : 0);
+  }
+};
+
+struct DB::PathNode {
+  NodeRef node;
+  size_t pos;  // the slot of the key or of the child the search went through
+};
+
+// The keys of a leaf are in (lower, upper], a missing bound means the first
+// or the last leaf. The neighbor leaves are the ones of the upper bound's
+// successor and of the lower bound itself.
+struct DB::LeafBounds {
+  std::optional<std::string> lower;
+  std::optional<std::string> upper;
+
+  // Narrows the bounds to the child `pos` of the interior node, the
+  // separators of the deeper levels are the closer ones
+  void Narrow(const NodeRef& node, size_t pos) {
+    if (pos > 0) {
+      lower.emplace(node->KeyAt(pos - 1));
+    }
+    if (pos < node->count) {
+      upper.emplace(node->KeyAt(pos));
+    }
+  }
+
+  [[nodiscard]] bool Contains(std::string_view key) const {
+    return (!lower.has_value() || key > *lower) &&
+           (!upper.has_value() || key <= *upper);
+  }
+};
+
+// The nodes from the root to the leaf of the last modification. Until a split
+// or a rebalance changes the tree above the leaf, the following keys within
+// the leaf bounds are found without a descent.
+struct DB::WritePath {
+  std::vector<PathNode> nodes;
+  LeafBounds bounds;
+
+  // Releases the latches taken by the modification, the nodes stay pinned
+  // for the next one
+  void Unlatch() const {
+    for (const auto& [node, pos] : nodes) {
+      node.Unlatch();
+    }
+  }
+};
+
+class DB::IteratorImpl final : public Iterator {
+ public:
+  IteratorImpl(DB* db, IteratorOptions options)
+      : db_(db), options_(std::move(options)) {}
+
+  [[nodiscard]] bool Valid() const override { return static_cast<bool>(leaf_); }
+
+  Status SeekToFirst() override {
+    return Seek(options_.lower_bound.value_or(std::string()));
+  }
+
+  Status SeekToLast() override {
+    if (options_.upper_bound.has_value()) {
+      return SeekBefore(*options_.upper_bound);
+    }
+
+    if (auto st = Find(std::nullopt); !st.IsOk() || !leaf_) {
+      return st;
+    }
+    return Backward(node()->count);
+  }
+
+  Status Seek(std::string_view key) override {
+    if (options_.lower_bound.has_value() && key < *options_.lower_bound) {
+      key = *options_.lower_bound;
+    }
+
+    key_.assign(key);
+    if (auto st = Find(key_); !st.IsOk() || !leaf_) {
+      return st;
+    }
+    pos_ = node()->LowerBound(key_).first;
+    return Forward();
+  }
+
+  Status SeekForPrev(std::string_view key) override {
+    if (options_.upper_bound.has_value() && key >= *options_.upper_bound) {
+      return SeekBefore(*options_.upper_bound);
+    }
+
+    key_.assign(key);
+    if (auto st = Find(key_); !st.IsOk() || !leaf_) {
+      return st;
+    }
+    const auto [pos, exact] = node()->LowerBound(key_);
+    return Backward(exact ? pos + 1 : pos);
+  }
+
+  Status Next() override {
+    assert(Valid());
+    bool exact = true;
+    if (Stale()) {
+      if (auto st = Restore(&exact); !st.IsOk() || !leaf_) {
+        return st;
+      }
+    }
+
+    pos_ += exact ? 1 : 0;
+    return Forward();
+  }
+
+  Status Prev() override {
+    assert(Valid());
+    bool exact = true;
+    if (Stale()) {
+      if (auto st = Restore(&exact); !st.IsOk() || !leaf_) {
+        return st;
+      }
+    }
+
+    return Backward(pos_);
+  }
+
+  [[nodiscard]] std::string_view key() const override {
+    assert(Valid());
+    return key_;
+  }
+
+  [[nodiscard]] std::string_view value() const override {
+    assert(Valid());
+    return node()->ValueTypeAt(pos_) != ValueType::kInline
+               ? value_
+               : node()->ValueAt(pos_);
+  }
+
+ private:
+  // Positions at the last entry with the key less than `key`
+  Status SeekBefore(std::string_view key) {
+    key_.assign(key);
+    if (auto st = Find(key_); !st.IsOk() || !leaf_) {
+      return st;
+    }
+    return Backward(node()->LowerBound(key_).first);
+  }
+
+  // Finds the current key again after its leaf was modified, the position is
+  // its lower bound
+  Status Restore(bool* exact) {
+    if (auto st = Find(key_); !st.IsOk() || !leaf_) {
+      return st;
+    }
+    std::tie(pos_, *exact) = node()->LowerBound(key_);
+    return Status::Ok();
+  }
+
+  // Positions at the first entry starting from `pos_`, the following leaves
+  // are visited if the current one is exhausted
+  Status Forward() {
+    while (pos_ >= node()->count) {
+      if (auto st = NextLeaf(); !st.IsOk() || !leaf_) {
+        return st;
+      }
+    }
+    return Load(true);
+  }
+
+  // Positions at the entry before `pos` going to the previous leaves if needed
+  Status Backward(size_t pos) {
+    pos_ = pos;
+    while (pos_ == 0) {
+      if (auto st = PrevLeaf(); !st.IsOk() || !leaf_) {
+        return st;
+      }
+    }
+    pos_ -= 1;
+    return Load(false);
+  }
+
+  // The copy-on-write mode doesn't link the leaves
+  [[nodiscard]] bool linked() const { return !db_->options_.copy_on_write; }
+
+  // The copy of the current leaf
+  [[nodiscard]] BTreeNode* node() const {
+    return reinterpret_cast<BTreeNode*>(copy_.get());
+  }
+
+  // Whether the leaf has been modified since it was copied, the pages of a
+  // snapshot never change
+  [[nodiscard]] bool Stale() const { return !leaf_.Validate(version_); }
+
+  // Pins and copies the leaf of the key, the rightmost one without a key. The
+  // key must not point into the copy.
+  Status Find(std::optional<std::string_view> key) {
+    for (;;) {
+      leaf_.Reset();
+      uint64_t version = 0;
+      if (auto st = db_->FindLeaf(options_.snapshot.get(), key, &leaf_,
+                                  &version, &bounds_);
+          !st.IsOk() || !leaf_) {
+        leaf_.Reset();
+        return st;
+      }
+
+      bounded_ = true;
+      if (Copy(version)) {
+        return Status::Ok();
+      }
+    }
+  }
+
+  // Copies the pinned leaf, fails if the leaf was modified meanwhile
+  bool Copy(uint64_t version) {
+    if (copy_ == nullptr) {
+      copy_ = std::make_unique_for_overwrite<std::byte[]>(btree_page_size);
+    }
+    std::memcpy(copy_.get(), leaf_->page(), btree_page_size);
+    version_ = version;
+    return leaf_.Validate(version);
+  }
+
+  // Follows the link of the copied leaf. The link is current while the leaf
+  // is unchanged, the sibling is pinned before the leaf is validated again.
+  Status Follow(NodeId sibling, bool* moved) {
+    *moved = false;
+    if (!leaf_.Validate(version_)) {
+      return Status::Ok();
+    }
+    if (sibling == kNoNode) {
+      leaf_.Reset();
+      *moved = true;
+      return Status::Ok();
+    }
+
+    NodeRef node;
+    if (auto st = db_->GetNode(sibling, &node); !st.IsOk()) {
+      return st;
+    }
+    const uint64_t version = node.Version();
+    if (!leaf_.Validate(version_)) {
+      return Status::Ok();
+    }
+
+    leaf_ = std::move(node);
+    bounded_ = false;
+    *moved = Copy(version);
+    return Status::Ok();
+  }
+
+  // Moves to the next leaf and to its first entry after the ones already seen,
+  // the iterator becomes invalid past the end
+  Status NextLeaf() {
+    if (linked()) {
+      bool moved = false;
+      if (auto st = Follow(node()->next, &moved); !st.IsOk() || moved) {
+        pos_ = 0;
+        return st;
+      }
+    }
+
+    // The upper bound separates the leaf from the next one. Without the bounds
+    // the search starts after the last seen key.
+    std::string from;
+    if (bounded_) {
+      if (!bounds_.upper.has_value()) {
+        leaf_.Reset();
+        return Status::Ok();
+      }
+      from = *bounds_.upper;
+    } else {
+      from = key_;
+    }
+    from.push_back('\0');
+
+    if (auto st = Find(from); !st.IsOk() || !leaf_) {
+      return st;
+    }
+    pos_ = node()->LowerBound(from).first;
+    return Status::Ok();
+  }
+
+  // Moves to the previous leaf and past its last entry before the ones
+  // already seen
+  Status PrevLeaf() {
+    if (linked()) {
+      bool moved = false;
+      if (auto st = Follow(node()->prev, &moved); !st.IsOk() || moved) {
+        pos_ = leaf_ ? node()->count : 0;
+        return st;
+      }
+    }
+
+    // The lower bound is the greatest key of the previous leaf
+    std::string from;
+    if (bounded_) {
+      if (!bounds_.lower.has_value()) {
+        leaf_.Reset();
+        return Status::Ok();
+      }
+      from = *bounds_.lower;
+    } else {
+      from = key_;
+    }
+    const bool inclusive = bounded_;
+
+    if (auto st = Find(from); !st.IsOk() || !leaf_) {
+      return st;
+    }
+    const auto [pos, exact] = node()->LowerBound(from);
+    pos_ = inclusive && exact ? pos + 1 : pos;
+    return Status::Ok();
+  }
+
+  // Remembers the key of the current entry and reads its value if it's stored
+  // out of the leaf, the iterator leaving the range becomes invalid
+  Status Load(bool forward) {
+    key_.assign(node()->Prefix());
+    key_.append(node()->SuffixAt(pos_));
+
+    if ((options_.lower_bound.has_value() && key_ < *options_.lower_bound) ||
+        (options_.upper_bound.has_value() && key_ >= *options_.upper_bound)) {
+      leaf_.Reset();
+      return Status::Ok();
+    }
+    const auto value_type = node()->ValueTypeAt(pos_);
+    if (value_type == ValueType::kInline) {
+      return Status::Ok();
+    }
+
+    bool valid = false;
+    if (auto st = db_->ReadValue(leaf_, version_, value_type,
+                                 node()->ValueAt(pos_), &value_, &valid);
+        !st.IsOk() || valid) {
+      return st;
+    }
+
+    // The leaf has been modified meanwhile, the entry is read again or skipped
+    // if it's gone
+    bool exact = false;
+    if (auto st = Restore(&exact); !st.IsOk() || !leaf_) {
+      return st;
+    }
+    if (exact) {
+      return Load(forward);
+    }
+    return forward ? Forward() : Backward(pos_);
+  }
+
+  DB* db_;
+  const IteratorOptions options_;
+
+  // The pinned leaf and its copy at the version
+  NodeRef leaf_;
+  uint64_t version_ = 0;
+  std::unique_ptr<std::byte[]> copy_;
+
+  // The bounds are known only for the leaves found from the root
+  LeafBounds bounds_;
+  bool bounded_ = false;
+
+  size_t pos_ = 0;
+  std::string key_;
+
+  // The value of the current entry if it's stored out of the leaf
+  std::string value_;
+};
+
+// static
+Status DB::Open(std::string_view filename, const Options& options,
+                std::shared_ptr<DB>* dbptr) {
+  // A mapped page is used as it's stored
+  if (options.mmap_reads && options.compression != nullptr) {
+    return Status::InvalidArgument(
+        "mapped datafile can't be compressed",
+        std::format("codec {}", options.compression->id()));
+  }
+
+  std::unique_ptr<OS> os;
+  if (auto st = OS::Create(&os); !st.IsOk()) {
+    return st;
+  }
+
+  // Pages are written at their own offsets, the file must not be opened with
+  // O_APPEND: Linux ignores the offset of positioned writes in that mode.
+  std::unique_ptr<File> datafile;
+  const File::Flags flags{.read = true, .write = true, .creat = true};
+  if (auto st = os->OpenDatafile(filename, flags, &datafile); !st.IsOk()) {
+    return st;
+  }
+
+  int64_t filesize;
+  if (auto st = datafile->GetFileSize(&filesize); !st.IsOk()) {
+    return st;
+  }
+
+  std::shared_ptr<DB> db(
+      new (std::nothrow) DB(options, std::move(os), std::move(datafile)));
+  if (db == nullptr) {
+    return Status::NoMemory();
+  }
+
+  if (auto st = db->Recover(filename, filesize); !st.IsOk()) {
+    // Nothing may be written back to a datafile that failed to open
+    db->closed_ = true;
+    return st;
+  }
+
+  *dbptr = std::move(db);
+  return Status::Ok();
+}
+
+Status DB::Recover(std::string_view filename, int64_t filesize) {
+  // The log is opened even with the option off, the tree may reference it
+  uint32_t value_log_tail = 0;
+  std::optional<std::vector<uint64_t>> value_log_live = std::vector<uint64_t>();
+  bool free_pages_kept = true;
+  if (filesize != 0) {
+    if (auto st = ReadMeta(&value_log_tail, &value_log_live,
+                           &free_pages_kept);
+        !st.IsOk()) {
+      return st;
+    }
+  }
+
+  const auto value_log_filename = std::string(filename) + ".vlog";
+  if (auto st = ValueLog::Open(os_.get(), value_log_filename, value_log_tail,
+                               options_.value_log_segment_size, &value_log_);
+      !st.IsOk()) {
+    return st;
+  }
+
+  if (filesize == 0) {
+    // A new database, both copies are written so the older one is valid too
+    pages_ = kMetaPages;
+    for (int i = 0; i < kMetaPages; ++i) {
+      if (auto st = WriteMeta(); !st.IsOk()) {
+        return st;
+      }
+    }
+  }
+
+  // The pages written in place since the last commit are restored before the
+  // tree is read: the meta page commits the tree atomically in both modes,
+  // and the log is replayed over the committed tree
+  if (!options_.copy_on_write) {
+    const auto journal_filename = std::string(filename) + ".journal";
+    if (auto st = Journal::Open(os_.get(), journal_filename, datafile_.get(),
+                                btree_page_size, &journal_);
+        !st.IsOk()) {
+      return st;
+    }
+    if (filesize != 0) {
+      if (auto st = journal_->Rollback(meta_sequence_); !st.IsOk()) {
+        return st;
+      }
+    }
+    if (auto st = journal_->Reset(meta_sequence_, pages_); !st.IsOk()) {
+      return st;
+    }
+    pool_->SetJournal(journal_.get());
+  }
+
+  // The scans of the tree below read ahead, the lookups afterwards don't
+  if (options_.mmap_reads) {
+    if (auto st = pool_->Map(); !st.IsOk()) {
+      return st;
+    }
+    if (auto st = pool_->Advise(MappedRegion::Access::kSequential);
+        !st.IsOk()) {
+      return st;
+    }
+  }
+
+  // The free pages and the garbage of the value log are kept by the commit,
+  // the tree is scanned only for the lists which didn't fit into the meta
+  if (options_.copy_on_write && !free_pages_kept) {
+    if (auto st = CollectFreePages(); !st.IsOk()) {
+      return st;
+    }
+  }
+  if (value_log_live.has_value()) {
+    std::map<uint32_t, uint64_t> live;
+    for (size_t i = 0; i < value_log_live->size(); ++i) {
+      live[value_log_tail + static_cast<uint32_t>(i)] = (*value_log_live)[i];
+    }
+    value_log_->CountGarbage(live);
+  } else if (auto st = CountValueLogGarbage(); !st.IsOk()) {
+    return st;
+  }
+
+  // The keys of the tree are added by the following operations, the ones of
+  // the log by the replay
+  if (options_.bloom_filter_size > 0) {
+    filter_ = std::make_unique<BloomFilter>(options_.bloom_filter_size);
+    filter_filled_ = root_id_ == kNoNode;
+  }
+
+  if (options_.mmap_reads) {
+    if (auto st = pool_->Advise(MappedRegion::Access::kRandom); !st.IsOk()) {
+      return st;
+    }
+  }
+
+  if (!options_.wal) {
+    return Status::Ok();
+  }
+
+  const auto wal_filename = std::string(filename) + ".wal";
+  if (auto st = WriteAheadLog::Open(os_.get(), wal_filename, options_.sync,
+                                    &wal_);
+      !st.IsOk()) {
+    return st;
+  }
+
+  // Redo the changes made after the last checkpoint and start a new one,
+  // the records of the same leaf share the path
+  WritePath path;
+  auto st = wal_->Replay(wal_lsn_, [this, &path](
+                                       WriteAheadLog::RecordType type,
+                                       std::string_view key,
+                                       std::string_view value) {
+    bool found = false;
+    switch (type) {
+      case WriteAheadLog::RecordType::kPut:
+        return Insert(key, value, &found, &path);
+      case WriteAheadLog::RecordType::kDelete:
+        return Remove(key, &found, &path);
+      case WriteAheadLog::RecordType::kBatch:
+        break;
+    }
+
+    // The batch modifies the tree along its own paths
+    path.nodes.clear();
+    std::vector<WriteBatch::Op> ops;
+    if (auto decode_st = WriteBatch::Decode(value, &ops); !decode_st.IsOk()) {
+      return decode_st;
+    }
+    return Apply(std::move(ops));
+  });
+
+  // Unpin the nodes before the checkpoint
+  path.nodes.clear();
+  if (!st.IsOk()) {
+    return st;
+  }
+
+  return Checkpoint();
+}
+
+DB::DB(Options options, std::unique_ptr<OS> os, std::unique_ptr<File> datafile)
+    : options_(options), os_(std::move(os)), datafile_(std::move(datafile)) {
+  pool_ = std::make_unique<BufferPool>(
+      os_.get(), datafile_.get(), btree_page_size,
+      std::max(kMinCachePages, options_.cache_size / btree_page_size),
+      options_.compression);
+  write_path_ = std::make_unique<WritePath>();
+
+  static_assert(std::is_trivial_v<BTreeNode> &&
+                std::is_standard_layout_v<BTreeNode>);
+  static_assert(3 * btree_maxsize_entry <= btree_page_size - sizeof(BTreeNode));
+  static_assert(offsetof(BTreeNode, id) == BufferPool::kHeaderSize);
+  static_assert(btree_maxsize_key + sizeof(NodeId) < btree_maxsize_entry);
+  static_assert(btree_maxsize_entry - sizeof(BTreeNode::Slot) < (1U << 14U),
+                "the values must fit Slot::value_size");
+}
+
+DB::~DB() {
+  if (!closed_) {
+    Close().PermitUncheckedError();
+  }
+}
+
+Status DB::Close() {
+  closed_ = true;
+
+  if (auto st = Sync(); !st.IsOk()) {
+    return st;
+  }
+
+  if (auto st = datafile_->Close(); !st.IsOk()) {
+    return st;
+  }
+
+  if (value_log_ != nullptr) {
+    if (auto st = value_log_->Close(); !st.IsOk()) {
+      return st;
+    }
+  }
+
+  if (wal_ != nullptr) {
+    if (auto st = wal_->Close(); !st.IsOk()) {
+      return st;
+    }
+  }
+
+  if (journal_ != nullptr) {
+    if (auto st = journal_->Close(); !st.IsOk()) {
+      return st;
+    }
+  }
+
+  if (auto st = os_->Close(); !st.IsOk()) {
+    return st;
+  }
+
+  return Status::Ok();
+}
+
+void DB::Get(
+    std::string_view key,
+    CallbackRef<std::optional<std::string>> callback) {
+  std::string value;
+  bool found = false;
+  auto st = Lookup(nullptr, key, &value, &found);
+  callback(st, found ? std::optional(std::move(value)) : std::nullopt);
+}
+
+void DB::Get(
+    const Snapshot& snapshot, std::string_view key,
+    CallbackRef<std::optional<std::string>> callback) {
+  std::string value;
+  bool found = false;
+  auto st = Lookup(&snapshot, key, &value, &found);
+  callback(st, found ? std::optional(std::move(value)) : std::nullopt);
+}
+
+void DB::Get(std::string_view key, std::string* value,
+             CallbackRef<bool> callback) {
+  bool found = false;
+  auto st = Lookup(nullptr, key, value, &found);
+  callback(st, found);
+}
+
+void DB::Get(const Snapshot& snapshot, std::string_view key,
+             std::string* value, CallbackRef<bool> callback) {
+  bool found = false;
+  auto st = Lookup(&snapshot, key, value, &found);
+  callback(st, found);
+}
+
+void DB::GetView(const Snapshot& snapshot, std::string_view key,
+                 CallbackRef<std::optional<std::string_view>> callback) {
+  if (!MayContain(key)) {
+    filtered_lookups_.fetch_add(1, std::memory_order_relaxed);
+    callback(Status::Ok(), std::nullopt);
+    return;
+  }
+
+  // The leaf is found optimistically, but once found it's never modified
+  NodeRef leaf;
+  uint64_t version = 0;
+  if (auto st = FindLeaf(&snapshot, key, &leaf, &version); !st.IsOk()) {
+    callback(st, std::nullopt);
+    return;
+  }
+  if (!leaf) {
+    callback(Status::Ok(), std::nullopt);
+    return;
+  }
+
+  const auto [pos, found] = leaf->LowerBound(key);
+  if (!found) {
+    callback(Status::Ok(), std::nullopt);
+    return;
+  }
+
+  const auto value_type = leaf->ValueTypeAt(pos);
+  if (value_type == ValueType::kInline) {
+    callback(Status::Ok(), leaf->ValueAt(pos));
+    return;
+  }
+
+  // The leaf's version changes when it's written back, only the pages of
+  // the value are read again then
+  std::string value;
+  for (bool valid = false; !valid;) {
+    version = leaf.Version();
+    if (auto st = ReadValue(leaf, version, value_type, leaf->ValueAt(pos),
+                            &value, &valid);
+        !st.IsOk()) {
+      callback(st, std::nullopt);
+      return;
+    }
+  }
+  callback(Status::Ok(), value);
+}
+
+Status DB::Lookup(const Snapshot* snapshot, std::string_view key,
+                  std::string* value, bool* found) {
+  value->clear();
+  *found = false;
+  if (!MayContain(key)) {
+    filtered_lookups_.fetch_add(1, std::memory_order_relaxed);
+    return Status::Ok();
+  }
+
+  // The value is copied before the leaf is validated, a modified leaf is
+  // searched for again
+  for (;;) {
+    NodeRef leaf;
+    uint64_t version = 0;
+    if (auto st = FindLeaf(snapshot, key, &leaf, &version); !st.IsOk()) {
+      return st;
+    }
+    if (!leaf) {
+      return Status::Ok();
+    }
+
+    const auto [pos, exact] = leaf->LowerBound(key);
+    const auto value_type = exact ? leaf->ValueTypeAt(pos) : ValueType::kInline;
+    if (exact) {
+      value->assign(leaf->ValueAt(pos));
+    } else {
+      value->clear();
+    }
+    if (!leaf.Validate(version)) {
+      continue;
+    }
+
+    bool valid = true;
+    if (value_type != ValueType::kInline) {
+      // The caller's buffer keeps its capacity for the value
+      const std::string ref(*value);
+      if (auto st = ReadValue(leaf, version, value_type, ref, value, &valid);
+          !st.IsOk()) {
+        value->clear();
+        return st;
+      }
+    }
+    if (valid) {
+      *found = exact;
+      return Status::Ok();
+    }
+  }
+}
+
+Status DB::PutEntry(std::string_view key, std::string_view value,
+                    bool* rewritten, bool* deferred, MakeWaiter defer) {
+  if (auto st = CheckEntry(key, value); !st.IsOk()) {
+    return st;
+  }
+
+  const std::lock_guard lock(mutex_);
+  if (auto st = MaybeCheckpoint(); !st.IsOk()) {
+    return st;
+  }
+
+  // The consecutive modifications of a leaf, appends above all, reuse the
+  // path of the previous one
+  if (auto st = Insert(key, value, rewritten, write_path_.get());
+      !st.IsOk()) {
+    write_path_->nodes.clear();
+    return st;
+  }
+  write_path_->Unlatch();
+
+  if (wal_ == nullptr) {
+    return Status::Ok();
+  }
+
+  // Only a record waiting for the sync takes a copy of the callback
+  if (!options_.sync) {
+    return wal_->Append(WriteAheadLog::RecordType::kPut, key, value);
+  }
+  *deferred = true;
+  wal_->Append(WriteAheadLog::RecordType::kPut, key, value, defer());
+  return Status::Ok();
+}
+
+Status DB::DeleteEntry(std::string_view key, bool* found, bool* deferred,
+                       MakeWaiter defer) {
+  const std::lock_guard lock(mutex_);
+  if (auto st = MaybeCheckpoint(); !st.IsOk()) {
+    return st;
+  }
+
+  if (auto st = Remove(key, found, write_path_.get()); !st.IsOk()) {
+    write_path_->nodes.clear();
+    return st;
+  }
+  write_path_->Unlatch();
+
+  if (wal_ == nullptr || !*found) {
+    return Status::Ok();
+  }
+
+  if (!options_.sync) {
+    return wal_->Append(WriteAheadLog::RecordType::kDelete, key, {});
+  }
+  *deferred = true;
+  wal_->Append(WriteAheadLog::RecordType::kDelete, key, {}, defer());
+  return Status::Ok();
+}
+
+void DB::Write(const WriteBatch& batch, const Callback<>& callback) {
+  std::vector<WriteBatch::Op> ops;
+  if (auto st = WriteBatch::Decode(batch.rep_, &ops); !st.IsOk()) {
+    callback(st);
+    return;
+  }
+
+  // Nothing is applied unless every entry fits
+  for (const auto& op : ops) {
+    if (op.type != WriteBatch::Type::kPut) {
+      continue;
+    }
+    if (auto st = CheckEntry(op.key, op.value); !st.IsOk()) {
+      callback(st);
+      return;
+    }
+  }
+  if (batch.rep_.size() > std::numeric_limits<uint32_t>::max()) {
+    callback(Status::InvalidArgument(
+        "write batch is too large",
+        std::format("{} bytes in {} records", batch.rep_.size(),
+                    batch.Count())));
+    return;
+  }
+
+  const std::lock_guard lock(mutex_);
+  if (auto st = MaybeCheckpoint(); !st.IsOk()) {
+    callback(st);
+    return;
+  }
+
+  // The batch may split or merge the nodes of the cached path
+  write_path_->nodes.clear();
+  if (auto st = Apply(std::move(ops)); !st.IsOk()) {
+    callback(st);
+    return;
+  }
+
+  if (wal_ == nullptr || batch.Count() == 0) {
+    callback(Status::Ok());
+    return;
+  }
+
+  wal_->Append(WriteAheadLog::RecordType::kBatch, {}, batch.rep_, callback);
+}
+
+Status DB::Wait() {
+  // The records of the writes acknowledged so far reach the log file
+  if (wal_ != nullptr && !options_.sync) {
+    const std::lock_guard lock(mutex_);
+    if (auto st = wal_->Flush(); !st.IsOk()) {
+      return st;
+    }
+  }
+
+  while (os_->Pending() > 0) {
+    if (auto st = os_->Wait(); !st.IsOk()) {
+      return st;
+    }
+  }
+  return Status::Ok();
+}
+
+// static
+Status DB::CheckEntry(std::string_view key, std::string_view value) {
+  if (key.size() > btree_maxsize_key) {
+    return Status::InvalidArgument(
+        "key is too large",
+        std::format("{} bytes, at most {} bytes are allowed", key.size(),
+                    btree_maxsize_key));
+  }
+  // The size of a value is a 32-bit field of the log records
+  if (value.size() > std::numeric_limits<uint32_t>::max()) {
+    return Status::InvalidArgument(
+        "value is too large",
+        std::format("{} bytes with {} bytes key", value.size(), key.size()));
+  }
+  return Status::Ok();
+}
+
+Status DB::Insert(std::string_view key, std::string_view value,
+                  bool* rewritten, WritePath* path) {
+  std::string ref;
+  auto value_type = ValueType::kInline;
+  if (auto st = StoreValue(key, &value, &ref, &value_type); !st.IsOk()) {
+    return st;
+  }
+
+  std::optional<Entry> replaced;
+  bool placed = false;
+  if (auto st =
+          PlaceEntry(key, value, value_type, &replaced, &placed, path);
+      !st.IsOk()) {
+    if (!placed) {
+      ReleaseValue(value_type, value).PermitUncheckedError();
+    }
+    return st;
+  }
+
+  *rewritten = replaced.has_value();
+  if (replaced.has_value()) {
+    // The key is modified already, a chain which can't be read is leaked
+    ReleaseValue(replaced->value_type, replaced->value).PermitUncheckedError();
+  }
+  return Status::Ok();
+}
+
+Status DB::PlaceEntry(std::string_view key, std::string_view value,
+                      ValueType value_type, std::optional<Entry>* replaced,
+                      bool* placed, WritePath* path) {
+  changes_ += 1;
+
+  // The readers finding the key in the tree find it in the filter
+  if (filter_ != nullptr) {
+    filter_->Add(key);
+  }
+
+  if (root_id_ == kNoNode) {
+    NodeRef root;
+    if (auto st = AddNode(kLeaf, &root); !st.IsOk()) {
+      return st;
+    }
+
+    root_id_ = root->id;
+  }
+
+  bool found = false;
+  if (auto st = Descend(key, path, &found); !st.IsOk()) {
+    return st;
+  }
+
+  if (auto st = ShadowPath(&path->nodes); !st.IsOk()) {
+    return st;
+  }
+
+  const auto& [leaf, pos] = path->nodes.back();
+  leaf.MarkDirty();
+
+  if (found) {
+    *replaced = Entry{.key = std::string(key),
+                      .value = std::string(leaf->ValueAt(pos)),
+                      .child = kNoNode,
+                      .value_type = leaf->ValueTypeAt(pos)};
+    leaf->Remove(pos);
+  }
+
+  // A split consumes the path, the next key is found from the root
+  const size_t depth = path->nodes.size();
+  auto st = NodeInsert(&path->nodes, key, value, kNoNode, value_type);
+  *placed = st.IsOk() || path->nodes.size() != depth;
+  if (path->nodes.size() != depth) {
+    path->nodes.clear();
+  } else if (!st.IsOk() && replaced->has_value()) {
+    // The leaf had the room for the replaced entry
+    leaf->Insert(pos, key, (*replaced)->value, kNoNode,
+                 (*replaced)->value_type);
+    replaced->reset();
+  }
+  return st;
+}
+
+Status DB::StoreValue(std::string_view key, std::string_view* value,
+                      std::string* ref, ValueType* value_type) {
+  if (options_.value_log && value->size() >= options_.value_log_threshold) {
+    ValueLog::Ref log_ref;
+    if (auto st = value_log_->Append(key, *value, &log_ref); !st.IsOk()) {
+      return st;
+    }
+    *ref = log_ref.Encode();
+    *value = *ref;
+    *value_type = ValueType::kLog;
+  } else if (value->size() > options_.max_inline_value ||
+             BTreeNode::EntrySize(kLeaf, key.size(), value->size()) >
+                 btree_maxsize_entry) {
+    if (auto st = WriteOverflow(*value, ref); !st.IsOk()) {
+      return st;
+    }
+    *value = *ref;
+    *value_type = ValueType::kOverflow;
+  }
+  return Status::Ok();
+}
+
+Status DB::Remove(std::string_view key, bool* found, WritePath* path) {
+  std::optional<Entry> removed;
+  auto st = TakeEntry(key, &removed, path);
+  *found = removed.has_value();
+  if (!st.IsOk() || !removed.has_value()) {
+    return st;
+  }
+
+  ReleaseValue(removed->value_type, removed->value).PermitUncheckedError();
+  return Status::Ok();
+}
+
+Status DB::TakeEntry(std::string_view key, std::optional<Entry>* removed,
+                     WritePath* path) {
+  if (root_id_ == kNoNode) {
+    return Status::Ok();
+  }
+
+  bool found = false;
+  if (auto st = Descend(key, path, &found); !st.IsOk()) {
+    return st;
+  }
+
+  if (!found) {
+    return Status::Ok();
+  }
+
+  changes_ += 1;
+
+  if (auto st = ShadowPath(&path->nodes); !st.IsOk()) {
+    return st;
+  }
+
+  const auto& [leaf, pos] = path->nodes.back();
+  leaf.MarkDirty();
+  *removed = Entry{.key = std::string(key),
+                   .value = std::string(leaf->ValueAt(pos)),
+                   .child = kNoNode,
+                   .value_type = leaf->ValueTypeAt(pos)};
+  leaf->Remove(pos);
+
+  if (leaf->UsedSpace() >= btree_minsize_node) {
+    return Status::Ok();
+  }
+
+  auto st = NodeRebalance(&path->nodes);
+  path->nodes.clear();
+  return st;
+}
+
+Status DB::Apply(std::vector<WriteBatch::Op> ops) {
+  // The sort is stable, so the last modification of a key wins
+  std::ranges::stable_sort(ops, {}, &WriteBatch::Op::key);
+  std::vector<WriteBatch::Op> last;
+  last.reserve(ops.size());
+  for (size_t i = 0; i < ops.size(); ++i) {
+    if (i + 1 == ops.size() || ops[i + 1].key != ops[i].key) {
+      last.push_back(ops[i]);
+    }
+  }
+
+  // The values stored out of the leaves, the references point into `refs`
+  std::vector<std::string> refs(last.size());
+  std::vector<ValueType> value_types(last.size(), ValueType::kInline);
+  const auto release_stored = [&](size_t end) {
+    for (size_t i = 0; i < end; ++i) {
+      ReleaseValue(value_types[i], last[i].value).PermitUncheckedError();
+    }
+  };
+
+  for (size_t i = 0; i < last.size(); ++i) {
+    if (last[i].type != WriteBatch::Type::kPut) {
+      continue;
+    }
+    if (auto st =
+            StoreValue(last[i].key, &last[i].value, &refs[i], &value_types[i]);
+        !st.IsOk()) {
+      release_stored(i);
+      return st;
+    }
+  }
+
+  WritePath path;
+  std::vector<std::optional<Entry>> replaced(last.size());
+  size_t applied = 0;
+  Status st;
+  for (; applied < last.size(); ++applied) {
+    const auto& op = last[applied];
+    bool placed = false;
+    st = op.type == WriteBatch::Type::kPut
+             ? PlaceEntry(op.key, op.value, value_types[applied],
+                          &replaced[applied], &placed, &path)
+             : TakeEntry(op.key, &replaced[applied], &path);
+    if (!st.IsOk()) {
+      if (placed || (op.type != WriteBatch::Type::kPut &&
+                     replaced[applied].has_value())) {
+        // The tree is broken, nothing can be undone
+        return st;
+      }
+      break;
+    }
+  }
+
+  if (st.IsOk()) {
+    for (const auto& entry : replaced) {
+      if (entry.has_value()) {
+        ReleaseValue(entry->value_type, entry->value).PermitUncheckedError();
+      }
+    }
+    return Status::Ok();
+  }
+
+  // Put the replaced entries back, the stored values aren't referenced then
+  path.nodes.clear();
+  for (size_t i = applied; i-- > 0;) {
+    std::optional<Entry> undone;
+    bool placed = false;
+    auto undo_st = replaced[i].has_value()
+                       ? PlaceEntry(last[i].key, replaced[i]->value,
+                                    replaced[i]->value_type, &undone, &placed,
+                                    &path)
+                       : TakeEntry(last[i].key, &undone, &path);
+    if (!undo_st.IsOk()) {
+      // The batch stays partially applied, with its values leaked
+      undo_st.PermitUncheckedError();
+      return st;
+    }
+  }
+  release_stored(last.size());
+  return st;
+}
+
+Status DB::BulkLoad(const BulkLoadSource& next, double fill_factor) {
+  if (!(fill_factor > 0 && fill_factor <= 1)) {
+    return Status::InvalidArgument("fill factor must be in (0, 1]",
+                                   std::format("{}", fill_factor));
+  }
+
+  const std::lock_guard lock(mutex_);
+
+  // A database emptied by deletes keeps an empty leaf as its root, which is
+  // replaced by the loaded tree
+  NodeRef empty_root;
+  if (root_id_ != kNoNode) {
+    if (auto st = GetNode(root_id_, &empty_root); !st.IsOk()) {
+      return st;
+    }
+    if (empty_root->page_type != kLeaf || empty_root->count > 0) {
+      return Status::InvalidArgument("bulk load requires an empty database");
+    }
+  }
+
+  const auto budget = static_cast<size_t>(
+      fill_factor * static_cast<double>(btree_page_size - sizeof(BTreeNode)));
+
+  BulkLevel level;
+  std::vector<NodeId> created;
+  size_t dirty = 0;
+  auto st = BulkLoadLeaves(next, budget, &level, &created, &dirty);
+  while (st.IsOk() && level.size() > 1) {
+    st = BulkLoadLevel(budget, &level, &created, &dirty);
+  }
+
+  if (!st.IsOk()) {
+    // Nothing references the created pages, they are freed with the values
+    // stored out of the leaves
+    for (const NodeId id : created) {
+      NodeRef node;
+      if (!GetNode(id, &node).IsOk()) {
+        continue;
+      }
+      for (size_t i = 0; node->page_type == kLeaf && i < node->count; ++i) {
+        ReleaseValue(node, i).PermitUncheckedError();
+      }
+      FreeNode(node);
+    }
+    return st;
+  }
+
+  if (!level.empty()) {
+    if (empty_root) {
+      FreeNode(empty_root);
+    }
+    root_id_ = level.front().second;
+    changes_ += 1;
+  }
+  empty_root.Reset();
+  return Checkpoint();
+}
+
+Status DB::BulkLoadLeaves(const BulkLoadSource& next, size_t budget,
+                          BulkLevel* level, std::vector<NodeId>* created,
+                          size_t* dirty) {
+  std::vector<Entry> entries;
+  size_t total = 0;  // the bytes of the entries with the whole keys
+
+  // The previous leaf stays pinned until the next one is linked to it
+  NodeRef prev;
+  std::string prev_key;
+
+  const auto store = [&]() {
+    NodeRef leaf;
+    if (auto st = AddNode(kLeaf, &leaf); !st.IsOk()) {
+      return st;
+    }
+    created->push_back(leaf->id);
+    Entry::Store(leaf, entries);
+
+    std::string separator;
+    if (prev) {
+      separator = ShortestSeparator(prev_key, entries.front().key);
+      if (!options_.copy_on_write) {
+        // The previous leaf may have been written back meanwhile
+        prev.MarkDirty();
+        prev->next = leaf->id;
+        leaf->prev = prev->id;
+      }
+    }
+    level->emplace_back(std::move(separator), leaf->id);
+
+    prev_key = std::move(entries.back().key);
+    prev = std::move(leaf);
+    entries.clear();
+    total = 0;
+    return BulkLoadFlush(dirty);
+  };
+
+  std::string_view key;
+  std::string_view value;
+  auto st = Status::Ok();
+  while (st.IsOk() && next(&key, &value)) {
+    st = CheckEntry(key, value);
+    if (st.IsOk() && (entries.empty() ? prev && key <= prev_key
+                                      : key <= entries.back().key)) {
+      st = Status::InvalidArgument("bulk load keys are not ascending",
+                                   std::string(key));
+    }
+    if (!st.IsOk()) {
+      break;
+    }
+
+    if (filter_ != nullptr) {
+      filter_->Add(key);
+    }
+
+    std::string ref;
+    auto value_type = ValueType::kInline;
+    if (st = StoreValue(key, &value, &ref, &value_type); !st.IsOk()) {
+      break;
+    }
+
+    // The keys of a leaf are stored without the prefix of its first and last
+    // ones, so the leaf is full once the prefix is taken into account
+    const size_t size = BTreeNode::EntrySize(kLeaf, key.size(), value.size());
+    if (!entries.empty()) {
+      const size_t prefix = CommonPrefix(entries.front().key, key);
+      if (total + size - (entries.size() * prefix) > budget) {
+        st = store();
+      }
+    }
+
+    entries.push_back({.key = std::string(key),
+                       .value = std::string(value),
+                       .child = kNoNode,
+                       .value_type = value_type});
+    total += size;
+  }
+
+  if (st.IsOk() && !entries.empty()) {
+    return store();
+  }
+
+  // The values of the entries not stored in a leaf
+  for (const auto& e : entries) {
+    ReleaseValue(e.value_type, e.value).PermitUncheckedError();
+  }
+  return st;
+}
+
+Status DB::BulkLoadLevel(size_t budget, BulkLevel* level,
+                         std::vector<NodeId>* created, size_t* dirty) {
+  // The children [begin, end) of a node: the separators between them are the
+  // keys, the last child is the upper one
+  std::vector<size_t> ends;
+  for (size_t begin = 0; begin < level->size(); begin = ends.back()) {
+    size_t end = begin + 1;
+    size_t total = 0;
+    for (; end < level->size(); ++end) {
+      const auto& separator = (*level)[end].first;
+      const size_t size =
+          BTreeNode::EntrySize(kInterior, separator.size(), sizeof(NodeId));
+      const size_t keys = end - begin - 1;
+      if (keys > 0) {
+        const size_t prefix =
+            CommonPrefix((*level)[begin + 1].first, separator);
+        if (total + size - (keys * prefix) > budget) {
+          break;
+        }
+      }
+      total += size;
+    }
+    ends.push_back(end);
+  }
+
+  // A single child can't make a node, the last one borrows a child from the
+  // previous node or takes all of its children. The keys are short enough
+  // for a few of them to fit any node.
+  if (ends.size() > 1 && ends[ends.size() - 1] - ends[ends.size() - 2] == 1) {
+    const size_t begin = ends.size() > 2 ? ends[ends.size() - 3] : 0;
+    if (ends[ends.size() - 2] - begin > 2) {
+      ends[ends.size() - 2] -= 1;
+    } else {
+      ends.erase(ends.end() - 2);
+    }
+  }
+
+  BulkLevel parents;
+  size_t begin = 0;
+  for (const size_t end : ends) {
+    NodeRef node;
+    if (auto st = AddNode(kInterior, &node); !st.IsOk()) {
+      return st;
+    }
+    created->push_back(node->id);
+
+    std::vector<Entry> entries;
+    for (size_t i = begin; i + 1 < end; ++i) {
+      entries.push_back({.key = (*level)[i + 1].first,
+                         .value = {},
+                         .child = (*level)[i].second,
+                         .value_type = ValueType::kInline});
+    }
+    Entry::Store(node, entries);
+    node->upper = (*level)[end - 1].second;
+
+    parents.emplace_back(std::move((*level)[begin].first), node->id);
+    node.Reset();
+    if (auto st = BulkLoadFlush(dirty); !st.IsOk()) {
+      return st;
+    }
+    begin = end;
+  }
+
+  *level = std::move(parents);
+  return Status::Ok();
+}
+
+Status DB::BulkLoadFlush(size_t* dirty) {
+  // The pages are written in the order of their ids, which is mostly the
+  // order they are created in
+  *dirty += 1;
+  if (*dirty < pool_->capacity() / 2) {
+    return Status::Ok();
+  }
+  *dirty = 0;
+  return pool_->Flush();
+}
+
+std::unique_ptr<Iterator> DB::NewIterator(const IteratorOptions& options) {
+  return std::make_unique<IteratorImpl>(this, options);
+}
+
+Status DB::GetSnapshot(std::shared_ptr<const Snapshot>* snapshot_ptr) {
+  if (!options_.copy_on_write) {
+    return Status::InvalidArgument(
+        "snapshots require the copy-on-write mode");
+  }
+
+  const std::lock_guard lock(mutex_);
+
+  // The pages of the captured version are copied before any modification
+  auto* snapshot = new (std::nothrow) Snapshot(root_id_, version_);
+  if (snapshot == nullptr) {
+    return Status::NoMemory();
+  }
+  snapshots_.insert(version_);
+  version_ += 1;
+
+  *snapshot_ptr = std::shared_ptr<const Snapshot>(
+      snapshot, [this](const Snapshot* released) {
+        ReleaseSnapshot(released);
+        delete released;
+      });
+  return Status::Ok();
+}
+
+Statistics DB::GetStatistics() const {
+  return {.page_bytes_read = pool_->bytes_read(),
+          .page_bytes_written = pool_->bytes_written(),
+          .filtered_lookups =
+              filtered_lookups_.load(std::memory_order_relaxed)};
+}
+
+void DB::ReleaseSnapshot(const Snapshot* snapshot) {
+  const std::lock_guard lock(mutex_);
+  snapshots_.erase(snapshots_.find(snapshot->version_));
+  ReleasePages();
+}
+
+Status DB::WriteOverflow(std::string_view value, std::string* ref) {
+  constexpr size_t kCapacity = btree_page_size - sizeof(BTreeNode);
+
+  OverflowRef chain{.first = kNoNode, .size = value.size()};
+  NodeRef prev;
+  for (size_t pos = 0; pos < value.size(); pos += kCapacity) {
+    NodeRef node;
+    if (auto st = AddNode(kOverflow, &node); !st.IsOk()) {
+      // The pages added so far are linked, they are freed as a whole chain
+      prev.Reset();
+      if (chain.first != kNoNode) {
+        FreeOverflow(std::string_view(reinterpret_cast<const char*>(&chain),
+                                      sizeof(chain)))
+            .PermitUncheckedError();
+      }
+      return st;
+    }
+
+    const auto part = value.substr(pos, kCapacity);
+    node->heap_offset = btree_page_size - part.size();
+    std::memcpy(node->page() + node->heap_offset, part.data(), part.size());
+
+    if (prev) {
+      prev->next = node->id;
+    } else {
+      chain.first = node->id;
+    }
+    prev = std::move(node);
+  }
+
+  ref->assign(reinterpret_cast<const char*>(&chain), sizeof(chain));
+  return Status::Ok();
+}
+
+Status DB::FreeOverflow(std::string_view ref) {
+  for (NodeId id = OverflowRef::Decode(ref).first; id != kNoNode;) {
+    NodeRef node;
+    if (auto st = GetNode(id, &node); !st.IsOk()) {
+      return st;
+    }
+    if (node->page_type != kOverflow) {
+      return Status::CorruptedDatafile("overflow chain is broken",
+                                       std::format("page {}", id));
+    }
+
+    id = node->next;
+    FreeNode(node);
+  }
+  return Status::Ok();
+}
+
+Status DB::ReadOverflow(const NodeRef& leaf, uint64_t version,
+                        std::string_view ref, std::string* value,
+                        bool* valid) {
+  const auto chain = OverflowRef::Decode(ref);
+  value->clear();
+  value->reserve(chain.size);
+
+  // The link of a page is followed once the leaf is known to be unchanged
+  *valid = true;
+  for (NodeId id = chain.first; value->size() < chain.size;) {
+    if (id == kNoNode) {
+      return Status::CorruptedDatafile(
+          "overflow chain is too short",
+          std::format("{} of {} bytes", value->size(), chain.size));
+    }
+
+    NodeRef node;
+    if (auto st = GetNode(id, &node); !st.IsOk()) {
+      return st;
+    }
+    const bool overflow = node->page_type == kOverflow;
+    value->append(
+        node->Bytes(node->heap_offset, chain.size - value->size()));
+    id = node->next;
+
+    if (!leaf.Validate(version)) {
+      *valid = false;
+      return Status::Ok();
+    }
+    if (!overflow) {
+      return Status::CorruptedDatafile("overflow chain is broken",
+                                       std::format("page {}", node->id));
+    }
+  }
+  return Status::Ok();
+}
+
+Status DB::ReadValue(const NodeRef& leaf, uint64_t version,
+                     ValueType value_type, std::string_view ref,
+                     std::string* value, bool* valid) {
+  if (value_type == ValueType::kOverflow) {
+    return ReadOverflow(leaf, version, ref, value, valid);
+  }
+
+  // A segment is collected only with the leaf modified, the error of a read
+  // from a removed one is discarded with the value
+  assert(value_type == ValueType::kLog);
+  auto st = value_log_->Read(ValueLog::Ref::Decode(ref), value);
+  *valid = leaf.Validate(version);
+  if (!*valid) {
+    st.PermitUncheckedError();
+    return Status::Ok();
+  }
+  return st;
+}
+
+Status DB::ReleaseValue(const NodeRef& leaf, size_t pos) {
+  return ReleaseValue(leaf->ValueTypeAt(pos), leaf->ValueAt(pos));
+}
+
+Status DB::ReleaseValue(ValueType value_type, std::string_view ref) {
+  switch (value_type) {
+    case ValueType::kInline:
+      break;
+    case ValueType::kOverflow:
+      return FreeOverflow(ref);
+    case ValueType::kLog:
+      value_log_->AddGarbage(ValueLog::Ref::Decode(ref));
+      break;
+  }
+  return Status::Ok();
+}
+
+Status DB::CollectValueLog() {
+  if (!snapshots_.empty()) {
+    return Status::Ok();
+  }
+
+  std::vector<ValueLog::Record> records;
+  bool found = false;
+  if (auto st = value_log_->ReadCollectable(options_.value_log_gc_ratio,
+                                            &records, &found);
+      !st.IsOk() || !found) {
+    return st;
+  }
+
+  // The records of the same leaf share the path in the key order. A record is
+  // live if the entry of its key still references it, the reference is
+  // replaced in place since it has the same size.
+  std::ranges::sort(records, {}, &ValueLog::Record::key);
+  WritePath path;
+  for (const auto& record : records) {
+    bool live = false;
+    if (root_id_ != kNoNode) {
+      if (auto st = Descend(record.key, &path, &live); !st.IsOk()) {
+        return st;
+      }
+    }
+    if (!live) {
+      continue;
+    }
+
+    const auto& [leaf, pos] = path.nodes.back();
+    if (leaf->ValueTypeAt(pos) != ValueType::kLog ||
+        ValueLog::Ref::Decode(leaf->ValueAt(pos)) != record.ref) {
+      continue;
+    }
+
+    ValueLog::Ref ref;
+    if (auto st = value_log_->Append(record.key, record.value, &ref);
+        !st.IsOk()) {
+      return st;
+    }
+    if (auto st = ShadowPath(&path.nodes); !st.IsOk()) {
+      return st;
+    }
+
+    const auto& [copy, copy_pos] = path.nodes.back();
+    copy.MarkDirty();
+    copy->SetValueAt(copy_pos, ref.Encode());
+  }
+
+  // The release is committed with the next meta page even if no value moved
+  value_log_->ReleaseTail();
+  changes_ += 1;
+  return Status::Ok();
+}
+
+Status DB::AddNode(NodeType page_type, NodeRef* node_ptr) {
+  NodeRef node;
+  if (!free_pages_.empty()) {
+    // The old content of the page is of no use, it isn't read
+    BufferPool::PageRef page;
+    if (auto st = pool_->Create(free_pages_.back(), &page); !st.IsOk()) {
+      return st;
+    }
+
+    node = NodeRef(std::move(page));
+    node->id = free_pages_.back();
+    free_pages_.pop_back();
+  } else if (free_head_ != kNoNode) {
+    if (auto st = GetNode(free_head_, &node); !st.IsOk()) {
+      return st;
+    }
+    assert(node->page_type == kFree);
+
+    node.MarkDirty();
+    free_head_ = node->next;
+  } else {
+    BufferPool::PageRef page;
+    if (auto st = pool_->Create(pages_, &page); !st.IsOk()) {
+      return st;
+    }
+
+    node = NodeRef(std::move(page));
+    node->id = pages_;
+    pages_ += 1;
+  }
+
+  node->upper = kNoNode;
+  node->prev = kNoNode;
+  node->next = kNoNode;
+  node->sequence = version_;
+  node->page_type = page_type;
+  node->Reset();
+
+  *node_ptr = std::move(node);
+  return Status::Ok();
+}
+
+void DB::FreeNode(const NodeRef& node) {
+  if (options_.copy_on_write) {
+    // The pages of the frozen versions must stay intact while a commit or a
+    // snapshot may read them
+    if (node->sequence < version_) {
+      retired_pages_.push_back(
+          {.id = node->id, .sequence = node->sequence, .retired = version_});
+    } else {
+      free_pages_.insert(
+          std::ranges::upper_bound(free_pages_, node->id, std::greater{}),
+          node->id);
+    }
+    return;
+  }
+
+  node.MarkDirty();
+  node->page_type = kFree;
+  node->Reset();
+  node->next = free_head_;
+  free_head_ = node->id;
+}
+
+Status DB::GetNode(NodeId id, NodeRef* node_ptr) {
+  BufferPool::PageRef page;
+  if (auto st = pool_->Fetch(id, &page); !st.IsOk()) {
+    return st;
+  }
+
+  *node_ptr = NodeRef(std::move(page));
+  return Status::Ok();
+}
+
+Status DB::ShadowNode(const NodeRef& parent, size_t pos, NodeRef* node) {
+  if (!options_.copy_on_write || (*node)->sequence == version_) {
+    return Status::Ok();
+  }
+
+  NodeRef copy;
+  if (auto st = AddNode((*node)->page_type, &copy); !st.IsOk()) {
+    return st;
+  }
+
+  const NodeId id = copy->id;
+  const uint64_t sequence = copy->sequence;
+  std::memcpy(copy->page(), (*node)->page(), btree_page_size);
+  copy->id = id;
+  copy->sequence = sequence;
 
-// NOLINTBEGIN(*-avoid-c-arrays)
-struct alignas(8) DB::BTreeNodeKey {
-  alignas(8) size_t size;
-  alignas(8) char bytes[btree_maxsize_key];
+  if (parent) {
+    parent.MarkDirty();
+    parent->SetChildAt(pos, id);
+  } else {
+    assert(root_id_ == (*node)->id);
+    root_id_ = id;
+  }
+
+  FreeNode(*node);
+  *node = std::move(copy);
+  return Status::Ok();
+}
+
+Status DB::ShadowPath(std::vector<PathNode>* path) {
+  if (!options_.copy_on_write) {
+    return Status::Ok();
+  }
 
-  static std::string ToString(const BTreeNodeKey& x) {
-    return {&(x.bytes)[0], x.size};
+  // Top down, so the parent of each node is a copy already
+  const NodeRef no_parent;
+  for (size_t i = 0; i < path->size(); ++i) {
+    const auto& parent = i > 0 ? (*path)[i - 1].node : no_parent;
+    const size_t pos = i > 0 ? (*path)[i - 1].pos : 0;
+    if (auto st = ShadowNode(parent, pos, &(*path)[i].node); !st.IsOk()) {
+      return st;
+    }
   }
+  return Status::Ok();
+}
+
+Status DB::CollectFreePages() {
+  std::vector<bool> used(static_cast<size_t>(pages_));
+  free_head_ = kNoNode;
+  free_pages_.clear();
+
+  if (root_id_ != kNoNode) {
+    used[static_cast<size_t>(root_id_)] = true;
 
-  static int Compare(const BTreeNodeKey& lhs, std::string_view rhs) {
-    const int result = std::memcmp(&(lhs.bytes[0]), rhs.data(),
-                                   std::min(lhs.size, rhs.size()));
-    if (result == 0) {
-      if (lhs.size < rhs.size()) {
-        return -1;
+    // All leaves are on the same level, only the levels above are read
+    size_t height = 0;
+    for (NodeId id = root_id_;; ++height) {
+      NodeRef node;
+      if (auto st = GetNode(id, &node); !st.IsOk()) {
+        return st;
       }
-      if (lhs.size > rhs.size()) {
-        return 1;
+      if (node->page_type == kLeaf) {
+        break;
       }
+      id = node->ChildAt(0);
+    }
+
+    std::vector<NodeId> level{root_id_};
+    for (size_t depth = 0; depth < height; ++depth) {
+      std::vector<NodeId> children;
+      for (const NodeId id : level) {
+        NodeRef node;
+        if (auto st = GetNode(id, &node); !st.IsOk()) {
+          return st;
+        }
+
+        for (size_t i = 0; i <= node->count; ++i) {
+          const NodeId child = node->ChildAt(i);
+          if (child < kMetaPages || child >= pages_) {
+            return Status::CorruptedDatafile(
+                "child page is out of the datafile",
+                std::format("page {}, child {}", id, child));
+          }
+          used[static_cast<size_t>(child)] = true;
+          children.push_back(child);
+        }
+      }
+      level = std::move(children);
     }
-    return result;
-  }
 
-  static int Compare(const BTreeNodeKey& lhs, const BTreeNodeKey& rhs) {
-    const int result = std::memcmp(&(lhs.bytes[0]), &(rhs.bytes[0]),
-                                   std::min(lhs.size, rhs.size));
-    if (result == 0) {
-      if (lhs.size < rhs.size) {
-        return -1;
+    // The overflow chains are referenced by the leaves
+    for (const NodeId id : level) {
+      NodeRef leaf;
+      if (auto st = GetNode(id, &leaf); !st.IsOk()) {
+        return st;
       }
-      if (lhs.size > rhs.size) {
-        return 1;
+
+      for (size_t i = 0; i < leaf->count; ++i) {
+        if (leaf->ValueTypeAt(i) != ValueType::kOverflow) {
+          continue;
+        }
+
+        NodeId page = OverflowRef::Decode(leaf->ValueAt(i)).first;
+        while (page != kNoNode) {
+          if (page < kMetaPages || page >= pages_ ||
+              used[static_cast<size_t>(page)]) {
+            return Status::CorruptedDatafile(
+                "overflow chain is broken",
+                std::format("page {}, overflow page {}", id, page));
+          }
+          used[static_cast<size_t>(page)] = true;
+
+          NodeRef node;
+          if (auto st = GetNode(page, &node); !st.IsOk()) {
+            return st;
+          }
+          page = node->next;
+        }
       }
     }
-    return result;
   }
 
-  static void Copy(BTreeNodeKey& dest, std::string_view src) {
-    dest.size = src.size();
-    std::memcpy(&(dest.bytes)[0], src.data(),
-                std::min(btree_maxsize_key, src.size()));
+  for (NodeId id = pages_ - 1; id >= kMetaPages; --id) {
+    if (!used[static_cast<size_t>(id)]) {
+      free_pages_.push_back(id);
+    }
   }
-  static void Copy(BTreeNodeKey& dest, const BTreeNodeKey& src) {
-    dest.size = src.size;
-    std::memcpy(&(dest.bytes[0]), &(src.bytes[0]), src.size);
+  return Status::Ok();
+}
+
+Status DB::CountValueLogGarbage() {
+  // The bytes of the value log segments referenced by the tree
+  std::map<uint32_t, uint64_t> live;
+  if (root_id_ == kNoNode) {
+    value_log_->CountGarbage(live);
+    return Status::Ok();
   }
-};
 
-struct alignas(8) DB::BTreeNodeVal {
-  alignas(8) size_t size;
-  alignas(8) char bytes[btree_maxsize_value];
+  // Depth first, so only the children of the nodes on the way are kept
+  std::vector<NodeId> stack{root_id_};
+  while (!stack.empty()) {
+    const NodeId id = stack.back();
+    stack.pop_back();
+
+    NodeRef node;
+    if (auto st = GetNode(id, &node); !st.IsOk()) {
+      return st;
+    }
+
+    if (node->page_type == kLeaf) {
+      for (size_t i = 0; i < node->count; ++i) {
+        if (node->ValueTypeAt(i) == ValueType::kLog) {
+          const auto ref = ValueLog::Ref::Decode(node->ValueAt(i));
+          live[ref.segment] += ref.size;
+        }
+      }
+      continue;
+    }
+
+    for (size_t i = node->count + 1; i-- > 0;) {
+      const NodeId child = node->ChildAt(i);
+      if (child < kMetaPages || child >= pages_) {
+        return Status::CorruptedDatafile(
+            "child page is out of the datafile",
+            std::format("page {}, child {}", id, child));
+      }
+      stack.push_back(child);
+    }
+  }
+
+  value_log_->CountGarbage(live);
+  return Status::Ok();
+}
+
+Status DB::FillFilter() {
+  for (size_t i = 0; i < kFilterFillLeaves; ++i) {
+    // The modifications are excluded, the leaf is read as it is
+    NodeRef leaf;
+    uint64_t version = 0;
+    LeafBounds bounds;
+    if (auto st = FindLeaf(nullptr, filter_cursor_, &leaf, &version, &bounds);
+        !st.IsOk()) {
+      return st;
+    }
+
+    if (leaf) {
+      for (size_t pos = 0; pos < leaf->count; ++pos) {
+        filter_->Add(leaf->KeyAt(pos));
+      }
+    }
+    if (!leaf || !bounds.upper.has_value()) {
+      filter_filled_.store(true, std::memory_order_release);
+      filter_cursor_.clear();
+      return Status::Ok();
+    }
+
+    // The successor of the upper bound is in the next leaf
+    filter_cursor_ = std::move(*bounds.upper);
+    filter_cursor_.push_back('\0');
+  }
+  return Status::Ok();
+}
 
-  static std::string ToString(const BTreeNodeVal& x) {
-    return {&(x.bytes)[0], x.size};
+bool DB::MayContain(std::string_view key) {
+  if (filter_ == nullptr) {
+    return true;
   }
 
-  static void Copy(BTreeNodeVal& dest, std::string_view src) {
-    dest.size = src.size();
-    std::memcpy(&(dest.bytes)[0], src.data(),
-                std::min(btree_maxsize_value, src.size()));
+  // A lookup fills the filter unless a writer is busy, the writes fill it too
+  if (!filter_filled_.load(std::memory_order_acquire)) {
+    if (const std::unique_lock lock(mutex_, std::try_to_lock);
+        lock.owns_lock() && !filter_filled_.load(std::memory_order_relaxed)) {
+      // A failed fill is retried by the next lookup or write
+      FillFilter().PermitUncheckedError();
+    }
+    if (!filter_filled_.load(std::memory_order_acquire)) {
+      return true;
+    }
   }
-  static void Copy(BTreeNodeVal& dest, const BTreeNodeVal& src) {
-    dest.size = src.size;
-    std::memcpy(&(dest.bytes[0]), &(src.bytes[0]), src.size);
+  return filter_->MayContain(key);
+}
+
+void DB::ReleasePages() {
+  const auto visible = [this](const RetiredPage& page) {
+    const auto reads = [&page](uint64_t version) {
+      return page.sequence <= version && version < page.retired;
+    };
+    const auto it = snapshots_.lower_bound(page.sequence);
+    return reads(meta_sequence_) || (it != snapshots_.end() && reads(*it));
+  };
+
+  const size_t size = free_pages_.size();
+  std::erase_if(retired_pages_, [&](const RetiredPage& page) {
+    if (visible(page)) {
+      return false;
+    }
+    free_pages_.push_back(page.id);
+    return true;
+  });
+
+  if (free_pages_.size() != size) {
+    std::ranges::sort(free_pages_, std::greater{});
   }
-};
+}
 
-struct alignas(128) DB::BTreeNode {
-  alignas(8) NodeId id;
-  alignas(8) NodeType page_type;
+Status DB::Sync() {
+  const std::lock_guard lock(mutex_);
+  return Checkpoint();
+}
 
-  alignas(8) int64_t size;
-  alignas(8) BTreeNodeKey keys[(2 * btree_page_keys) - 1];
-  alignas(8) BTreeNodeVal vals[(2 * btree_page_keys) - 1];
+Status DB::Checkpoint() {
+  // The tree may hold the changes whose records failed to be logged, they are
+  // never committed: the next open replays the log over the last commit
+  if (wal_ != nullptr) {
+    if (auto st = wal_->status(); !st.IsOk()) {
+      return st;
+    }
+  }
 
-  alignas(8) NodeId children[2 * btree_page_keys];
-};
-// NOLINTEND(*-avoid-c-arrays)
+  // The pages are written back and replaced unpinned
+  write_path_->nodes.clear();
 
-// static
-Status DB::Open(std::string_view filename, const Options& options,
-                std::shared_ptr<DB>* dbptr) {
-  std::unique_ptr<OS> os;
-  if (auto st = OS::Create(&os); !st.IsOk()) {
+  if (auto st = CollectValueLog(); !st.IsOk()) {
     return st;
   }
 
-  std::unique_ptr<File> datafile;
-  const File::Flags flags{
-      .read = true, .write = true, .creat = true, .append = true};
-  if (auto st = os->OpenDatafile(filename, flags, &datafile); !st.IsOk()) {
-    return st;
+  if (changes_ != synced_changes_) {
+    // The values referenced by the pages must be durable before them
+    if (auto st = value_log_->Sync(); !st.IsOk()) {
+      return st;
+    }
+
+    if (auto st = pool_->Flush(); !st.IsOk()) {
+      return st;
+    }
+
+    // The pages are durable, switch the root atomically
+    if (auto st = WriteMeta(); !st.IsOk()) {
+      return st;
+    }
+    synced_changes_ = changes_;
+
+    // The saved images are of the replaced commit
+    if (journal_ != nullptr) {
+      if (auto st = journal_->Reset(meta_sequence_, pages_); !st.IsOk()) {
+        return st;
+      }
+    }
+
+    // The previous commit doesn't need its replaced pages and the collected
+    // value log segments anymore
+    ReleasePages();
+    if (auto st = value_log_->RemoveReleased(); !st.IsOk()) {
+      return st;
+    }
   }
 
-  int64_t filesize;
-  if (auto st = datafile->GetFileSize(&filesize); !st.IsOk()) {
-    return st;
+  if (wal_ != nullptr && wal_->size() > 0) {
+    return wal_->Reset();
   }
+  return Status::Ok();
+}
 
-  auto* db = new (std::nothrow) DB(options, std::move(os), std::move(datafile));
-  if (db == nullptr) {
+Status DB::ReadMeta(uint32_t* value_log_tail,
+                    std::optional<std::vector<uint64_t>>* value_log_live,
+                    bool* free_pages_kept) {
+  auto buffer = NewMetaBuffer(btree_page_size);
+  if (buffer == nullptr) {
     return Status::NoMemory();
   }
-  dbptr->reset(db);
+  const auto page = std::span(buffer.get(), btree_page_size);
+
+  std::optional<Meta> current;
+  std::optional<Meta> unsupported;
+  std::vector<NodeId> runs;
+  std::vector<uint64_t> live;
+  for (int64_t i = 0; i < kMetaPages; ++i) {
+    const auto offset = static_cast<off_t>(i * btree_page_size);
+    auto st = os_->Await([&](const Callback<>& callback) {
+      datafile_->Read(page.first(kMetaSize), offset, callback);
+    });
+    if (!st.IsOk()) {
+      return st;
+    }
+
+    Meta meta;
+    std::memcpy(&meta, page.data(), sizeof(Meta));
+    if (meta.magic != kMetaMagic) {
+      continue;
+    }
+    // The lists are laid out by the format, a copy of another one is
+    // reported only if neither is valid
+    if (meta.version != kMetaVersion || meta.page_size != btree_page_size) {
+      unsupported = meta;
+      continue;
+    }
+    const size_t size = meta.Size();
+    if (size > btree_page_size) {
+      continue;
+    }
+
+    // The lists past the first sector
+    if (size > kMetaSize) {
+      const size_t end = (size + kMetaSize - 1) / kMetaSize * kMetaSize;
+      st = os_->Await([&](const Callback<>& callback) {
+        datafile_->Read(page.subspan(kMetaSize, end - kMetaSize),
+                        offset + static_cast<off_t>(kMetaSize), callback);
+      });
+      if (!st.IsOk()) {
+        return st;
+      }
+    }
+
+    // A torn write leaves the copy invalid, the other one is used then
+    if (meta.checksum != Meta::Checksum(page, size)) {
+      continue;
+    }
+    if (current.has_value() && meta.sequence <= current->sequence) {
+      continue;
+    }
+    current = meta;
+    meta_slot_ = i;
+
+    auto lists = page.subspan(sizeof(Meta));
+    runs.clear();
+    if (meta.free_runs != kNotKept) {
+      runs.resize(size_t{meta.free_runs} * 2);
+      const auto bytes = std::as_writable_bytes(std::span(runs));
+      std::ranges::copy(lists.first(bytes.size()), bytes.begin());
+      lists = lists.subspan(bytes.size());
+    }
+    live.clear();
+    if (meta.value_log_segments != kNotKept) {
+      live.resize(meta.value_log_segments);
+      const auto bytes = std::as_writable_bytes(std::span(live));
+      std::ranges::copy(lists.first(bytes.size()), bytes.begin());
+    }
+  }
 
-  if (auto div = filesize % static_cast<int64_t>(btree_page_size); div != 0) {
+  if (!current.has_value() && unsupported.has_value()) {
+    return Status::CorruptedDatafile(
+        "unsupported datafile format",
+        std::format("version {}, page size {}", unsupported->version,
+                    unsupported->page_size));
+  }
+  if (!current.has_value()) {
+    return Status::CorruptedDatafile("no valid meta page");
+  }
+  if (current->codec != CodecId()) {
+    return Status::InvalidArgument(
+        "compression doesn't match the datafile",
+        std::format("datafile codec {}, options codec {}", current->codec,
+                    CodecId()));
+  }
+  if (current->pages < kMetaPages || current->root_id >= current->pages ||
+      current->free_head >= current->pages) {
     return Status::CorruptedDatafile(
-        "data file size is not a multiple of page size",
-        std::format("{} bytes", div));
+        "meta page is inconsistent",
+        std::format("root {}, free list {}, {} pages", current->root_id,
+                    current->free_head, current->pages));
+  }
+
+  meta_sequence_ = current->sequence;
+  version_ = meta_sequence_ + 1;
+  root_id_ = current->root_id;
+  pages_ = current->pages;
+  free_head_ = current->free_head;
+  wal_lsn_ = current->lsn;
+  *value_log_tail = current->value_log_tail;
+
+  value_log_live->reset();
+  if (current->value_log_segments != kNotKept) {
+    *value_log_live = std::move(live);
   }
 
-  db->pages_ = filesize / static_cast<int64_t>(btree_page_size);
+  // The runs are of the copy-on-write mode only, the free pages are kept in
+  // the descending order
+  *free_pages_kept = options_.copy_on_write && current->free_runs != kNotKept;
+  if (*free_pages_kept) {
+    free_pages_.clear();
+    for (size_t i = runs.size(); i > 0; i -= 2) {
+      const NodeId first = runs[i - 2];
+      const NodeId count = runs[i - 1];
+      if (first < kMetaPages || count <= 0 || first + count > pages_) {
+        return Status::CorruptedDatafile(
+            "free pages are out of the datafile",
+            std::format("pages {}-{}, {} pages", first, first + count - 1,
+                        pages_));
+      }
+      for (NodeId id = first + count; id-- > first;) {
+        free_pages_.push_back(id);
+      }
+    }
+  }
 
   return Status::Ok();
 }
 
-DB::DB(Options options, std::unique_ptr<OS> os, std::unique_ptr<File> datafile)
-    : options_(options), os_(std::move(os)), datafile_(std::move(datafile)) {
-  static_assert(sizeof(DB::BTreeNode) <= btree_page_size);
-  static_assert(std::is_trivial_v<BTreeNode> &&
-                std::is_standard_layout_v<BTreeNode>);
-  static_assert(std::is_trivial_v<BTreeNodeKey> &&
-                std::is_standard_layout_v<BTreeNodeKey>);
-  static_assert(std::is_trivial_v<BTreeNodeVal> &&
-                std::is_standard_layout_v<BTreeNodeVal>);
+uint32_t DB::CodecId() const {
+  return options_.compression == nullptr ? 0 : options_.compression->id();
 }
 
-DB::~DB() {
-  if (!closed_) {
-    std::ignore = Close();
+Status DB::WriteMeta() {
+  if (wal_ != nullptr) {
+    wal_lsn_ = wal_->lsn();
   }
-}
 
-Status DB::Close() {
-  closed_ = true;
+  // The retired pages aren't read by the committed tree, so they are free
+  // once it's reopened
+  std::vector<NodeId> runs;
+  if (options_.copy_on_write) {
+    std::vector<NodeId> free(free_pages_.rbegin(), free_pages_.rend());
+    for (const auto& page : retired_pages_) {
+      free.push_back(page.id);
+    }
+    std::ranges::sort(free);
+    for (const NodeId id : free) {
+      if (!runs.empty() && runs[runs.size() - 2] + runs.back() == id) {
+        runs.back() += 1;
+      } else {
+        runs.push_back(id);
+        runs.push_back(1);
+      }
+    }
+  }
+  const auto live = value_log_->Live();
+
+  // The lists which don't fit are left to the scans on open
+  size_t space = btree_page_size - sizeof(Meta);
+  uint32_t value_log_segments = kNotKept;
+  if (live.size() * sizeof(uint64_t) <= space) {
+    value_log_segments = static_cast<uint32_t>(live.size());
+    space -= live.size() * sizeof(uint64_t);
+  }
+  uint32_t free_runs = kNotKept;
+  if (options_.copy_on_write && runs.size() * sizeof(NodeId) <= space) {
+    free_runs = static_cast<uint32_t>(runs.size() / 2);
+  }
 
-  if (auto st = Sync(); !st.IsOk()) {
-    return st;
+  Meta meta{.magic = kMetaMagic,
+            .version = kMetaVersion,
+            .page_size = btree_page_size,
+            .sequence = version_,
+            .root_id = root_id_,
+            .pages = pages_,
+            .free_head = free_head_,
+            .lsn = wal_lsn_,
+            .value_log_tail = value_log_->tail(),
+            .codec = CodecId(),
+            .free_runs = free_runs,
+            .value_log_segments = value_log_segments,
+            .checksum = 0};
+
+  const size_t size = meta.Size();
+  const size_t buffer_size = (size + kMetaSize - 1) / kMetaSize * kMetaSize;
+  auto buffer = NewMetaBuffer(buffer_size);
+  if (buffer == nullptr) {
+    return Status::NoMemory();
+  }
+  const auto page = std::span(buffer.get(), buffer_size);
+  std::ranges::fill(page, std::byte{0});
+
+  auto lists = page.subspan(sizeof(Meta));
+  if (free_runs != kNotKept) {
+    const auto bytes = std::as_bytes(std::span(runs));
+    std::ranges::copy(bytes, lists.begin());
+    lists = lists.subspan(bytes.size());
+  }
+  if (value_log_segments != kNotKept) {
+    std::ranges::copy(std::as_bytes(std::span(live)), lists.begin());
   }
 
-  if (auto st = datafile_->Close(); !st.IsOk()) {
+  std::memcpy(page.data(), &meta, sizeof(Meta));
+  meta.checksum = Meta::Checksum(page, size);
+  std::memcpy(page.data() + offsetof(Meta, checksum), &meta.checksum,
+              sizeof(meta.checksum));
+
+  // Overwrite the older copy, the current one stays valid until the write is
+  // durable
+  const NodeId slot = (meta_slot_ + 1) % kMetaPages;
+  const auto offset = static_cast<off_t>(slot * btree_page_size);
+  auto st = os_->Await([&](const Callback<>& callback) {
+    datafile_->Write(page, offset, callback);
+  });
+  if (!st.IsOk()) {
     return st;
   }
 
-  if (auto st = os_->Close(); !st.IsOk()) {
+  st = os_->Await([&](const Callback<>& callback) {
+    datafile_->Sync(File::SyncMode::kDataOnly, callback);
+  });
+  if (!st.IsOk()) {
     return st;
   }
 
+  // The committed version is frozen, the modifications go to a new one
+  meta_sequence_ = meta.sequence;
+  meta_slot_ = slot;
+  version_ += 1;
   return Status::Ok();
 }
 
-void DB::Get(
-    std::string_view key,
-    const std::function<void(Status, std::optional<std::string>)>& callback) {
-  if (pages_ == 0) {
-    callback(Status::Ok(), std::nullopt);
-    return;
+Status DB::MaybeCheckpoint() {
+  // Nothing is applied once the log has failed, only the changes appended
+  // while the failed write was in flight are left out of it
+  if (wal_ != nullptr) {
+    if (auto st = wal_->status(); !st.IsOk()) {
+      return st;
+    }
   }
 
-  std::optional<NodeId> node_id = root_id_;
+  // A failed fill is retried by the next write or lookup
+  if (filter_ != nullptr && !filter_filled_.load(std::memory_order_relaxed)) {
+    FillFilter().PermitUncheckedError();
+  }
 
-  while (node_id != std::nullopt) {
-    const auto node = GetNode(*node_id);
-    node_id = std::nullopt;
+  if (wal_ != nullptr &&
+      !std::cmp_less(wal_->size(), options_.wal_checkpoint_size)) {
+    return Checkpoint();
+  }
 
-    if (BTreeNodeKey::Compare(node->keys[0], key) > 0) {
-      if (node->page_type == kLeaf) {
-        break;
-      }
-      node_id = static_cast<int64_t>(node->children[0]);
-      continue;
-    }
+  // The readers evict the clean pages, half of the cache is kept clean for
+  // them between the checkpoints
+  if (pool_->dirty() > pool_->capacity() / 2) {
+    return pool_->WriteDirty();
+  }
+  return Status::Ok();
+}
 
-    if (BTreeNodeKey::Compare(node->keys[node->size - 1], key) < 0) {
-      if (node->page_type == kLeaf) {
-        break;
-      }
-      node_id = static_cast<int64_t>(node->children[node->size]);
-      continue;
+Status DB::FindLeaf(const Snapshot* snapshot,
+                    std::optional<std::string_view> key, NodeRef* leaf_ptr,
+                    uint64_t* version_ptr, LeafBounds* bounds) {
+  // A node modified by the writer while it's read restarts the descent
+  for (;;) {
+    if (bounds != nullptr) {
+      *bounds = {};
     }
 
-    for (int64_t i = 0; i < node->size; ++i) {
-      const int cmp = BTreeNodeKey::Compare(node->keys[i], key);
+    const NodeId root =
+        snapshot != nullptr ? snapshot->root_id_ : root_id_.load();
+    if (root == kNoNode) {
+      leaf_ptr->Reset();
+      return Status::Ok();
+    }
 
-      if (cmp == 0) {
-        callback(Status::Ok(), BTreeNodeVal::ToString(node->vals[i]));
-        return;
+    NodeRef node;
+    if (auto st = GetNode(root, &node); !st.IsOk()) {
+      return st;
+    }
+    uint64_t version = node.Version();
+
+    // The tree may have grown or shrunk before the version was taken
+    bool valid = snapshot != nullptr || root_id_.load() == root;
+    while (valid && node->page_type != kLeaf) {
+      const size_t pos =
+          key.has_value() ? node->LowerBound(*key).first : node->count;
+      if (bounds != nullptr) {
+        bounds->Narrow(node, pos);
       }
 
-      if (cmp > 0) {
-        if (node->page_type == kLeaf) {
-          callback(Status::Ok(), std::nullopt);
-          return;
-        }
+      const NodeId child_id = node->ChildAt(pos);
+      if (!node.Validate(version)) {
+        valid = false;
+        break;
+      }
 
-        node_id = static_cast<int64_t>(node->children[i]);
+      NodeRef child;
+      if (auto st = GetNode(child_id, &child); !st.IsOk()) {
+        return st;
       }
+      const uint64_t child_version = child.Version();
+      valid = node.Validate(version);
+
+      node = std::move(child);
+      version = child_version;
     }
-  }
 
-  callback(Status::Ok(), std::nullopt);
+    if (valid) {
+      *leaf_ptr = std::move(node);
+      *version_ptr = version;
+      return Status::Ok();
+    }
+  }
 }
 
-void DB::Put(std::string_view key, std::string_view value,
-             const std::function<void(Status, bool rewritten)>& callback) {
-  std::shared_ptr<BTreeNode> root;
-  if (nodes_.empty()) {
-    root = AddNode(kLeaf);
-    root->size = 0;
-
-    root_id_ = root->id;
-  } else {
-    root = GetNode(root_id_);
+Status DB::Descend(std::string_view key, WritePath* path, bool* found) {
+  if (!path->nodes.empty() && path->bounds.Contains(key)) {
+    auto& leaf = path->nodes.back();
+    std::tie(leaf.pos, *found) = leaf.node->LowerBound(key);
+    return Status::Ok();
   }
 
-  if (root->size == 2 * btree_page_keys - 1) {
-    auto new_root = AddNode(kInterior);
-    new_root->size = 0;
-    new_root->children[0] = root->id;
-    root_id_ = new_root->id;
+  path->nodes.clear();
+  path->bounds = {};
+  NodeId node_id = root_id_;
 
-    NodeSplit(new_root, 0);
-  }
+  for (;;) {
+    NodeRef node;
+    if (auto st = GetNode(node_id, &node); !st.IsOk()) {
+      return st;
+    }
 
-  NodeInsert(root_id_, key, value);
+    const auto [pos, exact] = node->LowerBound(key);
+    const bool leaf = node->page_type == kLeaf;
+    if (!leaf) {
+      path->bounds.Narrow(node, pos);
+      node_id = node->ChildAt(pos);
+    }
 
-  callback(Status::Ok(), false);
-}
+    path->nodes.push_back({.node = std::move(node), .pos = pos});
 
-void DB::Delete(std::string_view key,
-                const std::function<void(Status, bool found)>& callback) {
-  // not implemented
-  std::ignore = key;
-  std::ignore = callback;
+    if (leaf) {
+      *found = exact;
+      return Status::Ok();
+    }
+  }
 }
 
-std::shared_ptr<DB::BTreeNode> DB::AddNode(NodeType page_type) {
-  auto* buffer = new std::byte[btree_page_size];
-  auto node = std::shared_ptr<BTreeNode>(
-      new (buffer) BTreeNode(), [](BTreeNode* rawptr) {
-        auto* bptr = reinterpret_cast<std::byte*>(rawptr);
-        delete[] bptr;
-      });
-  node->id = pages_;
-  node->size = 0;
-  node->page_type = page_type;
+Status DB::NodeInsert(std::vector<PathNode>* path, std::string_view key,
+                      std::string_view value, NodeId child,
+                      ValueType value_type) {
+  Entry promoted;
+
+  // An insert past the last key of every node on the path appends to the
+  // tree, the following keys will go to the right of it too
+  const bool append = std::ranges::all_of(
+      *path, [](const PathNode& p) { return p.pos == p.node->count; });
+
+  while (!path->empty()) {
+    const auto& [node, pos] = path->back();
+    node.MarkDirty();
+
+    if (node->HasSpaceFor(node->InsertSize(key, value))) {
+      node->Insert(pos, key, value, child, value_type);
+      return Status::Ok();
+    }
+
+    if (auto st = NodeSplit(node, pos,
+                            {.key = std::string(key),
+                             .value = std::string(value),
+                             .child = child,
+                             .value_type = value_type},
+                            append, &promoted);
+        !st.IsOk()) {
+      return st;
+    }
+
+    // The split node keeps the greater half, so the parent's pointer to it
+    // stays valid and the separator with the smaller half goes before it
+    key = promoted.key;
+    value = {};
+    child = promoted.child;
+    value_type = ValueType::kInline;
+
+    path->pop_back();
+  }
 
-  auto [it, success] = nodes_.emplace(pages_, std::move(node));
-  assert(success);
+  // The root has been split, grow the tree by one level
+  NodeRef root;
+  if (auto st = AddNode(kInterior, &root); !st.IsOk()) {
+    return st;
+  }
+  root->upper = root_id_;
+  root->Insert(0, key, value, child, ValueType::kInline);
+  root_id_ = root->id;
 
-  pages_ += 1;
-  return it->second;
+  return Status::Ok();
 }
 
-auto DB::GetNode(NodeId id) -> std::shared_ptr<BTreeNode> {
-  if (nodes_.contains(id)) {
-    return nodes_.at(id);
+Status DB::NodeSplit(const NodeRef& node, size_t pos, Entry entry,
+                     bool append, Entry* promoted) {
+  const bool leaf = node->page_type == kLeaf;
+
+  std::vector<Entry> entries;
+  entries.reserve(node->count + 1);
+  Entry::Collect(node, &entries);
+  entries.insert(entries.begin() + static_cast<ptrdiff_t>(pos),
+                 std::move(entry));
+
+  // Leaves are split into [0, middle) and [middle, n) with the shortest key
+  // between the halves as the separator. The interior middle entry itself
+  // moves to the parent. An append leaves the old entries full in the new
+  // node and only the appended one in the split node, halves would never be
+  // filled again.
+  assert(leaf || entries.size() >= 3);
+  const size_t middle = append ? entries.size() - (leaf ? 1 : 2)
+                               : Entry::Middle(node->page_type, entries);
+
+  // The pages are found before the node is modified, so a failure leaves
+  // it as it was
+  NodeRef left;
+  if (auto st = AddNode(node->page_type, &left); !st.IsOk()) {
+    return st;
+  }
+  NodeRef prev;
+  if (leaf && !options_.copy_on_write && node->prev != kNoNode) {
+    if (auto st = GetNode(node->prev, &prev); !st.IsOk()) {
+      FreeNode(left);
+      return st;
+    }
   }
 
-  auto* buffer = new std::byte[btree_page_size];
+  const size_t skip = leaf ? middle : middle + 1;
+  const NodeId upper = node->upper;
+  Entry::Store(left, std::span(entries).first(middle));
+  Entry::Store(node, std::span(entries).subspan(skip));
 
-  datafile_->Read(std::span(buffer, btree_page_size),
-                  static_cast<off_t>(id * btree_page_size),
-                  [](const Status& st) {
-                    if (!st.IsOk()) {
-                      std::cerr << st.ToString();
-                      std::abort();
-                    }
-                  });
+  if (leaf) {
+    // Link the new node between the split node and its previous sibling
+    if (prev) {
+      prev.MarkDirty();
+      prev->next = left->id;
+    }
 
-  // Cast bytes to packaged struct
-  const std::shared_ptr<BTreeNode> ptr(
-      reinterpret_cast<BTreeNode*>(buffer), [](BTreeNode* rawptr) {
-        auto* bptr = reinterpret_cast<std::byte*>(rawptr);
-        delete[] bptr;
-      });
+    if (!options_.copy_on_write) {
+      left->prev = node->prev;
+      left->next = node->id;
+      node->prev = left->id;
+    }
 
-  return nodes_[id] = ptr;
-}
+    *promoted = {.key = ShortestSeparator(entries[middle - 1].key,
+                                          entries[middle].key),
+                 .child = left->id};
+  } else {
+    left->upper = entries[middle].child;
+    node->upper = upper;
 
-Status DB::Sync() {
-  for (const auto& [id, node] : nodes_) {
-    const auto* buffer = reinterpret_cast<const std::byte*>(node.get());
-
-    datafile_->Write(std::span(buffer, btree_page_size),
-                     static_cast<off_t>(id * btree_page_size),
-                     [](const Status& st) {
-                       if (!st.IsOk()) {
-                         std::cerr << st.ToString();
-                         std::abort();
-                       }
-                     });
-
-    datafile_->Sync(File::SyncMode::kNormal, [](const Status& st) {
-      if (!st.IsOk()) {
-        std::cerr << st.ToString();
-        std::abort();
-      }
-    });
+    *promoted = {.key = std::move(entries[middle].key), .child = left->id};
   }
 
   return Status::Ok();
 }
 
-// NOLINTBEGIN(misc-no-recursion)
-void DB::NodeInsert(NodeId node_id, std::string_view k, std::string_view v) {
-  auto node = GetNode(node_id);
-  assert(std::cmp_less(node->size, (btree_page_keys * 2) - 1));
+Status DB::NodeRebalance(std::vector<PathNode>* path) {
+  for (; path->size() > 1; path->pop_back()) {
+    if (path->back().node->UsedSpace() >= btree_minsize_node) {
+      break;
+    }
 
-  int64_t i = node->size - 1;
+    const auto& [parent, pos] = (*path)[path->size() - 2];
+    if (parent->count == 0) {
+      continue;  // no siblings, the parent itself is rebalanced
+    }
 
-  switch (node->page_type) {
-    case kLeaf:
-      for (; i >= 0 && BTreeNodeKey::Compare(node->keys[i], k) > 0; --i) {
-        BTreeNodeKey::Copy(node->keys[i + 1], node->keys[i]);
-        BTreeNodeVal::Copy(node->vals[i + 1], node->vals[i]);
-      }
-      i += 1;
+    // The node and its right sibling or, for the last child, its left sibling
+    // are separated by the parent's slot `sep`
+    const size_t sep = pos < parent->count ? pos : pos - 1;
 
-      BTreeNodeKey::Copy(node->keys[i], k);
-      BTreeNodeVal::Copy(node->vals[i], v);
-      node->size += 1;
+    NodeRef left;
+    NodeRef right;
+    if (auto st = GetNode(parent->ChildAt(sep), &left); !st.IsOk()) {
+      return st;
+    }
+    if (auto st = GetNode(parent->ChildAt(sep + 1), &right); !st.IsOk()) {
+      return st;
+    }
 
-      // Fsync(node);
-      break;
+    const NodeType type = left->page_type;
+    const bool leaf = type == kLeaf;
 
-    case kInterior:
-      for (; i >= 0 && BTreeNodeKey::Compare(node->keys[i], k) > 0; --i) {
-      }
-      i += 1;
+    // The separator goes down between the interior entries, its child is the
+    // one with the keys after the left node's slots
+    std::vector<Entry> entries;
+    Entry::Collect(left, &entries);
+    if (!leaf) {
+      entries.push_back({.key = parent->KeyAt(sep),
+                         .child = left->upper});
+    }
+    Entry::Collect(right, &entries);
 
-      auto child = GetNode(node->children[i]);
+    // The parent is on the path, so it's a copy already
+    parent.MarkDirty();
 
-      if (child->size == 2 * btree_page_keys - 1) {
-        NodeSplit(node, i);
-        if (BTreeNodeKey::Compare(node->keys[i], k) < 0) {
-          i += 1;
+    // Merge into the right node, the parent's pointer to it stays valid
+    if (Entry::TotalSize(type, entries) <=
+        btree_page_size - sizeof(BTreeNode)) {
+      if (auto st = ShadowNode(parent, sep + 1, &right); !st.IsOk()) {
+        return st;
+      }
+      right.MarkDirty();
+      Entry::Store(right, entries);
+
+      if (leaf && !options_.copy_on_write) {
+        if (left->prev != kNoNode) {
+          NodeRef prev;
+          if (auto st = GetNode(left->prev, &prev); !st.IsOk()) {
+            return st;
+          }
+          prev.MarkDirty();
+          prev->next = right->id;
         }
+        right->prev = left->prev;
       }
 
-      NodeInsert(node->children[i], k, v);
+      parent->Remove(sep);
+      FreeNode(left);
+      continue;
+    }
 
+    // Redistribute the entries, the parent must fit the new separator
+    const size_t middle = Entry::Middle(type, entries);
+    const std::string separator =
+        leaf ? ShortestSeparator(entries[middle - 1].key, entries[middle].key)
+             : entries[middle].key;
+
+    const auto& old_slot = parent->slots()[sep];
+    const size_t old_size =
+        BTreeNode::EntrySize(kInterior, old_slot.key_size, 0);
+    const size_t new_size = parent->InsertSize(separator, {});
+    if (!parent->HasSpaceFor(new_size - std::min(new_size, old_size))) {
       break;
-  }
-}
-// NOLINTEND(misc-no-recursion)
-
-void DB::NodeSplit(const std::shared_ptr<BTreeNode>& x, NodeId child_id) {
-  auto y = GetNode(x->children[child_id]);
+    }
 
-  auto z = AddNode(y->page_type);
-  z->size = btree_page_keys - 1;
+    if (auto st = ShadowNode(parent, sep, &left); !st.IsOk()) {
+      return st;
+    }
+    if (auto st = ShadowNode(parent, sep + 1, &right); !st.IsOk()) {
+      return st;
+    }
+    left.MarkDirty();
+    right.MarkDirty();
+
+    const size_t skip = leaf ? middle : middle + 1;
+    const NodeId upper = right->upper;
+    Entry::Store(left, std::span(entries).first(middle));
+    Entry::Store(right, std::span(entries).subspan(skip));
+    if (!leaf) {
+      left->upper = entries[middle].child;
+      right->upper = upper;
+    }
 
-  for (size_t j = 0; j < btree_page_keys - 1; ++j) {
-    BTreeNodeKey::Copy(z->keys[j], y->keys[j + btree_page_keys]);
-    BTreeNodeVal::Copy(z->vals[j], y->vals[j + btree_page_keys]);
+    parent->Remove(sep);
+    parent->Insert(sep, separator, {}, left->id, ValueType::kInline);
+    break;
   }
 
-  if (y->page_type != kLeaf) {
-    for (size_t j = 0; j < btree_page_keys - 1; ++j) {
-      z->children[j] = y->children[j + btree_page_keys];
+  // Merges may leave the root with a single child
+  for (;;) {
+    NodeRef root;
+    if (auto st = GetNode(root_id_, &root); !st.IsOk()) {
+      return st;
+    }
+    if (root->page_type == kLeaf || root->count > 0) {
+      break;
     }
-  }
-
-  y->size = btree_page_keys - 1;
 
-  for (int64_t j = x->size; j >= child_id + 1; j--) {
-    x->children[j + 1] = x->children[j];
+    root_id_ = root->upper;
+    FreeNode(root);
   }
-  x->children[child_id + 1] = z->id;
 
-  for (int64_t j = x->size - 1; j >= child_id; --j) {
-    BTreeNodeKey::Copy(x->keys[j + 1], x->keys[j]);
-    BTreeNodeVal::Copy(x->vals[j + 1], x->vals[j]);
-  }
-  BTreeNodeKey::Copy(x->keys[child_id], y->keys[btree_page_keys - 1]);
-  BTreeNodeVal::Copy(x->vals[child_id], y->vals[btree_page_keys - 1]);
-  x->size += 1;
+  return Status::Ok();
 }
 
 #ifndef NDEBUG
@@ -438,16 +3147,21 @@ void DB::NodeSplit(const std::shared_ptr<BTreeNode>& x, NodeId child_id) {
 
 void DB::DebugRenderBTree(std::ostream& in) {
   in << "\n\n===================\n";
-  in << std::format("root id: {}\n", root_id_);
-  in << std::format("nodes count: {}\n", nodes_.size());
-  in << std::format("btree_page_keys: {}\n", btree_page_keys);
+  in << std::format("root id: {}\n", root_id_.load());
+  in << std::format("cached nodes: {}\n", pool_->size());
+  in << std::format("btree_page_size: {}\n", btree_page_size);
   in << "\n";
 
   std::queue<NodeId> q;
   q.push(root_id_);
 
   for (size_t t = 0; t < 10 && !q.empty(); ++t) {
-    const auto node = GetNode(q.front());
+    NodeRef node;
+    if (auto st = GetNode(q.front(), &node); !st.IsOk()) {
+      in << std::format("=> failed to read node {}: {}\n", q.front(),
+                        st.ToString());
+      break;
+    }
     q.pop();
 
     std::string type;
@@ -458,20 +3172,33 @@ void DB::DebugRenderBTree(std::ostream& in) {
       case kInterior:
         type = "interior";
         break;
+      case kFree:
+        type = "free";
+        break;
+      case kOverflow:
+        type = "overflow";
+        break;
     }
 
     in << std::format("=> " BOLD("node") "[{}]:\t",
                       static_cast<int64_t>(node->id));
-    in << std::format(BOLD("size") "={}\t", node->size);
+    in << std::format(BOLD("size") "={}\t", node->count);
+    in << std::format(BOLD("free") "={}\t", node->FreeSpace());
+    in << std::format(BOLD("prefix") "='{}'\t", node->Prefix());
     in << std::format(BOLD("type") "={}\t", type);
 
+    if (node->page_type == kLeaf) {
+      in << std::format(BOLD("siblings") "=[{}, {}]\t", node->prev,
+                        node->next);
+    }
+
     if (node->page_type != kLeaf) {
       in << BOLD("children") "=[";
-      for (int64_t i = 0; i <= node->size; ++i) {
-        q.push(node->children[i]);
+      for (size_t i = 0; i <= node->count; ++i) {
+        q.push(node->ChildAt(i));
 
-        in << node->children[i];
-        if (i + 1 <= node->size) {
+        in << node->ChildAt(i);
+        if (i + 1 <= node->count) {
           in << ", ";
         }
       }
@@ -479,10 +3206,23 @@ void DB::DebugRenderBTree(std::ostream& in) {
     }
 
     in << BOLD("data") "=[";
-    for (int64_t i = 0; i < node->size; ++i) {
-      in << std::format("'{}'=\'{}\'", BTreeNodeKey::ToString(node->keys[i]),
-                        BTreeNodeVal::ToString(node->vals[i]))
-         << (i + 1 < node->size ? ", " : "");
+    for (size_t i = 0; i < node->count; ++i) {
+      const auto value_type =
+          node->page_type == kLeaf ? node->ValueTypeAt(i) : ValueType::kInline;
+      if (value_type == ValueType::kOverflow) {
+        const auto chain = OverflowRef::Decode(node->ValueAt(i));
+        in << std::format("'{}'=<{} bytes at {}>", node->KeyAt(i), chain.size,
+                          chain.first);
+      } else if (value_type == ValueType::kLog) {
+        const auto ref = ValueLog::Ref::Decode(node->ValueAt(i));
+        in << std::format("'{}'=<{} bytes at {}:{}>", node->KeyAt(i), ref.size,
+                          ref.segment, ref.offset);
+      } else if (node->page_type == kLeaf) {
+        in << std::format("'{}'=\'{}\'", node->KeyAt(i), node->ValueAt(i));
+      } else {
+        in << std::format("'{}'", node->KeyAt(i));
+      }
+      in << (i + 1 < node->count ? ", " : "");
     }
     in << "]";
 
@@ -5,20 +5,32 @@
 #include "nimbledb/db.h"
 
 #include <gtest/gtest.h>
+#include <sys/stat.h>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <filesystem>
+#include <format>
+#include <fstream>
 #include <memory>
 #include <optional>
 #include <string>
 #include <string_view>
 #include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "nimbledb/base.h"
+#include "nimbledb/codec.h"
 #include "nimbledb/system.h"
+#include "src/buffer_pool.h"
+#include "src/crc32c.h"
 
 namespace NIMBLEDB_NAMESPACE {
 
@@ -94,6 +106,403 @@ TEST_F(OSTest, CanOpenReadWrite) {
   EXPECT_EQ(dst_buf_, src_buf_);
 }
 
+TEST_F(OSTest, QueuesMoreRequestsThanRingDepth) {
+  constexpr unsigned kQueueDepth = 8;
+  constexpr size_t kBlocks = 100;
+
+  const Status st1 = OS::Create(&os_, kQueueDepth);
+  ASSERT_TRUE(st1.IsOk()) << st1.ToString();
+
+  const File::Flags flags{.read = true, .write = true, .creat = true};
+  const Status st2 = os_->OpenDatafile(kTestFilePath, flags, &file_);
+  ASSERT_TRUE(st2.IsOk()) << st2.ToString();
+
+  std::array<std::array<std::byte, kBufferSize>, kBlocks> blocks{};
+  for (size_t i = 0; i < kBlocks; ++i) {
+    blocks[i].fill(std::byte(i));
+  }
+
+  size_t written = 0;
+  for (size_t i = 0; i < kBlocks; ++i) {
+    file_->Write(blocks[i], static_cast<off_t>(i * kBufferSize),
+                 [&](const Status& st) {
+                   EXPECT_TRUE(st.IsOk()) << st.ToString();
+                   written += 1;
+                 });
+  }
+
+  bool synced = false;
+  file_->Sync(File::SyncMode::kDataOnly, [&](const Status& st) {
+    EXPECT_TRUE(st.IsOk()) << st.ToString();
+    EXPECT_EQ(written, kBlocks);
+    synced = true;
+  });
+
+  // Callbacks are never invoked before the event loop runs
+  EXPECT_EQ(written, 0);
+  EXPECT_EQ(os_->Pending(), kBlocks + 1);
+
+  while (os_->Pending() > 0) {
+    auto st = os_->Wait();
+    ASSERT_TRUE(st.IsOk()) << st.ToString();
+  }
+  EXPECT_TRUE(synced);
+
+  std::array<std::array<std::byte, kBufferSize>, kBlocks> readed{};
+  for (size_t i = 0; i < kBlocks; ++i) {
+    file_->Read(readed[i], static_cast<off_t>(i * kBufferSize),
+                [](const Status& st) { EXPECT_TRUE(st.IsOk()); });
+  }
+
+  // Reading past the end of file is reported as an error
+  file_->Read(dst_buf_, static_cast<off_t>(kBlocks * kBufferSize),
+              [](const Status& st) { EXPECT_TRUE(st.IsIOError()); });
+
+  while (os_->Pending() > 0) {
+    auto st = os_->Wait();
+    ASSERT_TRUE(st.IsOk()) << st.ToString();
+  }
+  EXPECT_EQ(readed, blocks);
+
+  auto st = os_->Close();
+  ASSERT_TRUE(st.IsOk()) << st.ToString();
+}
+
+TEST_F(OSTest, BufferPoolFlushesOnlyDirtyPages) {
+  constexpr size_t kPageSize = 4096;
+  constexpr BufferPool::PageId kPages = 4;
+
+  const Status st1 = OS::Create(&os_);
+  ASSERT_TRUE(st1.IsOk()) << st1.ToString();
+
+  const File::Flags flags{.read = true, .write = true, .creat = true};
+  const Status st2 = os_->OpenDatafile(kTestFilePath, flags, &file_);
+  ASSERT_TRUE(st2.IsOk()) << st2.ToString();
+
+  BufferPool pool(os_.get(), file_.get(), kPageSize, kPages);
+  for (BufferPool::PageId id = 0; id < kPages; ++id) {
+    BufferPool::PageRef page;
+    auto st = pool.Create(id, &page);
+    ASSERT_TRUE(st.IsOk()) << st.ToString();
+    std::memset(page.data(), 'a' + static_cast<int>(id), kPageSize);
+  }
+
+  auto st = pool.Flush();
+  ASSERT_TRUE(st.IsOk()) << st.ToString();
+
+  // Change a clean page behind the pool's back, a flush must not restore it
+  std::array<std::byte, kPageSize> page_buf{};
+  page_buf.fill(std::byte('x'));
+  st = os_->Await([&](const Callback<>& callback) {
+    file_->Write(page_buf, kPageSize, callback);
+  });
+  ASSERT_TRUE(st.IsOk()) << st.ToString();
+
+  {
+    BufferPool::PageRef page;
+    st = pool.Fetch(2, &page);
+    ASSERT_TRUE(st.IsOk()) << st.ToString();
+    std::memset(page.data(), 'y', kPageSize);
+    page.MarkDirty();
+  }
+
+  st = pool.Flush();
+  ASSERT_TRUE(st.IsOk()) << st.ToString();
+
+  for (const auto& [offset, expected] :
+       {std::pair{kPageSize, 'x'}, std::pair{2 * kPageSize, 'y'},
+        std::pair{3 * kPageSize, 'd'}}) {
+    st = os_->Await([&](const Callback<>& callback) {
+      file_->Read(page_buf, static_cast<off_t>(offset), callback);
+    });
+    ASSERT_TRUE(st.IsOk()) << st.ToString();
+    EXPECT_EQ(page_buf[BufferPool::kHeaderSize], std::byte(expected))
+        << offset;
+    EXPECT_EQ(page_buf[kPageSize - 1], std::byte(expected)) << offset;
+  }
+
+  st = os_->Close();
+  ASSERT_TRUE(st.IsOk()) << st.ToString();
+}
+
+TEST_F(OSTest, BufferPoolVerifiesChecksums) {
+  constexpr size_t kPageSize = 4096;
+  constexpr BufferPool::PageId kPages = 4;
+
+  auto st = OS::Create(&os_);
+  ASSERT_TRUE(st.IsOk()) << st.ToString();
+
+  const File::Flags flags{.read = true, .write = true, .creat = true};
+  st = os_->OpenDatafile(kTestFilePath, flags, &file_);
+  ASSERT_TRUE(st.IsOk()) << st.ToString();
+
+  {
+    BufferPool pool(os_.get(), file_.get(), kPageSize, kPages);
+    for (BufferPool::PageId id = 0; id < kPages; ++id) {
+      BufferPool::PageRef page;
+      st = pool.Create(id, &page);
+      ASSERT_TRUE(st.IsOk()) << st.ToString();
+      std::memset(page.data(), 'a' + static_cast<int>(id), kPageSize);
+    }
+
+    st = pool.Flush();
+    ASSERT_TRUE(st.IsOk()) << st.ToString();
+  }
+
+  // A single flipped bit in the middle of a page
+  std::array<std::byte, 1> byte{std::byte('c' ^ 0x10)};
+  st = os_->Await([&](const Callback<>& callback) {
+    file_->Write(byte, (2 * kPageSize) + 1000, callback);
+  });
+  ASSERT_TRUE(st.IsOk()) << st.ToString();
+
+  BufferPool pool(os_.get(), file_.get(), kPageSize, kPages);
+  for (BufferPool::PageId id = 0; id < kPages; ++id) {
+    BufferPool::PageRef page;
+    st = pool.Fetch(id, &page);
+    if (id == 2) {
+      EXPECT_TRUE(st.IsCorruptedDatafile()) << st.ToString();
+      continue;
+    }
+    ASSERT_TRUE(st.IsOk()) << st.ToString();
+    EXPECT_EQ(page.data()[kPageSize - 1], std::byte('a' + id));
+  }
+
+  st = os_->Close();
+  ASSERT_TRUE(st.IsOk()) << st.ToString();
+}
+
+TEST_F(OSTest, BufferPoolEvictsCleanPagesFirst) {
+  constexpr size_t kPageSize = 4096;
+  constexpr BufferPool::PageId kPages = 8;
+  constexpr size_t kCapacity = 4;
+
+  auto st = OS::Create(&os_);
+  ASSERT_TRUE(st.IsOk()) << st.ToString();
+
+  const File::Flags flags{.read = true, .write = true, .creat = true};
+  st = os_->OpenDatafile(kTestFilePath, flags, &file_);
+  ASSERT_TRUE(st.IsOk()) << st.ToString();
+
+  BufferPool pool(os_.get(), file_.get(), kPageSize, kCapacity);
+  for (BufferPool::PageId id = 0; id < kPages; ++id) {
+    BufferPool::PageRef page;
+    st = pool.Create(id, &page);
+    ASSERT_TRUE(st.IsOk()) << st.ToString();
+    std::memset(page.data(), 'a' + static_cast<int>(id), kPageSize);
+  }
+  st = pool.Flush();
+  ASSERT_TRUE(st.IsOk()) << st.ToString();
+
+  // Two of the cached pages are modified
+  for (const BufferPool::PageId id : {0, 1}) {
+    BufferPool::PageRef page;
+    st = pool.Fetch(id, &page);
+    ASSERT_TRUE(st.IsOk()) << st.ToString();
+    page.MarkDirty();
+    page.data()[kPageSize - 1] = std::byte('z');
+  }
+  EXPECT_EQ(pool.dirty(), 2);
+  const uint64_t written = pool.bytes_written();
+
+  // The misses evict the clean pages only
+  for (BufferPool::PageId id = 2; id < kPages; ++id) {
+    BufferPool::PageRef page;
+    st = pool.Fetch(id, &page);
+    ASSERT_TRUE(st.IsOk()) << st.ToString();
+  }
+  EXPECT_EQ(pool.dirty(), 2);
+  EXPECT_EQ(pool.bytes_written(), written);
+
+  st = pool.WriteDirty();
+  ASSERT_TRUE(st.IsOk()) << st.ToString();
+  EXPECT_EQ(pool.dirty(), 0);
+  EXPECT_EQ(pool.bytes_written(), written + (2 * kPageSize));
+
+  // A dirty page is written back when no clean one is left to evict
+  std::vector<BufferPool::PageRef> pinned(kCapacity - 1);
+  for (size_t i = 0; i < pinned.size(); ++i) {
+    st = pool.Fetch(static_cast<BufferPool::PageId>(i) + 2, &pinned[i]);
+    ASSERT_TRUE(st.IsOk()) << st.ToString();
+  }
+  {
+    BufferPool::PageRef page;
+    st = pool.Fetch(0, &page);
+    ASSERT_TRUE(st.IsOk()) << st.ToString();
+    page.MarkDirty();
+    page.data()[kPageSize - 1] = std::byte('y');
+  }
+  {
+    BufferPool::PageRef page;
+    st = pool.Fetch(kPages - 1, &page);
+    ASSERT_TRUE(st.IsOk()) << st.ToString();
+  }
+  EXPECT_EQ(pool.dirty(), 0);
+  pinned.clear();
+
+  BufferPool::PageRef page;
+  st = pool.Fetch(0, &page);
+  ASSERT_TRUE(st.IsOk()) << st.ToString();
+  EXPECT_EQ(page.data()[kPageSize - 1], std::byte('y'));
+  page.Reset();
+
+  st = os_->Close();
+  ASSERT_TRUE(st.IsOk()) << st.ToString();
+}
+
+TEST_F(OSTest, MappedPoolBuffersModifiedPages) {
+  constexpr size_t kPageSize = 4096;
+  constexpr BufferPool::PageId kPages = 8;
+  constexpr size_t kCapacity = 4;
+
+  auto st = OS::Create(&os_);
+  ASSERT_TRUE(st.IsOk()) << st.ToString();
+
+  const File::Flags flags{.read = true, .write = true, .creat = true};
+  st = os_->OpenDatafile(kTestFilePath, flags, &file_);
+  ASSERT_TRUE(st.IsOk()) << st.ToString();
+
+  {
+    BufferPool pool(os_.get(), file_.get(), kPageSize, kCapacity);
+    for (BufferPool::PageId id = 0; id < kPages; ++id) {
+      BufferPool::PageRef page;
+      st = pool.Create(id, &page);
+      ASSERT_TRUE(st.IsOk()) << st.ToString();
+      std::memset(page.data(), 'a' + static_cast<int>(id), kPageSize);
+    }
+    st = pool.Flush();
+    ASSERT_TRUE(st.IsOk()) << st.ToString();
+    EXPECT_EQ(pool.buffers(), kCapacity);
+  }
+
+  BufferPool pool(os_.get(), file_.get(), kPageSize, kCapacity);
+  st = pool.Map();
+  ASSERT_TRUE(st.IsOk()) << st.ToString();
+
+  // The pages read are the mapped ones
+  for (BufferPool::PageId id = 0; id < kPages; ++id) {
+    BufferPool::PageRef page;
+    st = pool.Fetch(id, &page);
+    ASSERT_TRUE(st.IsOk()) << st.ToString();
+    EXPECT_EQ(page.data()[kPageSize - 1], std::byte('a' + id));
+  }
+  EXPECT_EQ(pool.size(), kCapacity);
+  EXPECT_EQ(pool.buffers(), 0);
+
+  // A modified page is copied, its buffer is freed with the eviction
+  {
+    BufferPool::PageRef page;
+    st = pool.Fetch(1, &page);
+    ASSERT_TRUE(st.IsOk()) << st.ToString();
+    page.MarkDirty();
+    std::memset(page.data() + BufferPool::kHeaderSize, 'z',
+                kPageSize - BufferPool::kHeaderSize);
+  }
+  EXPECT_EQ(pool.buffers(), 1);
+
+  st = pool.WriteDirty();
+  ASSERT_TRUE(st.IsOk()) << st.ToString();
+  for (BufferPool::PageId id = 2; id < kPages; ++id) {
+    BufferPool::PageRef page;
+    st = pool.Fetch(id, &page);
+    ASSERT_TRUE(st.IsOk()) << st.ToString();
+  }
+  EXPECT_EQ(pool.buffers(), 0);
+
+  BufferPool::PageRef page;
+  st = pool.Fetch(1, &page);
+  ASSERT_TRUE(st.IsOk()) << st.ToString();
+  EXPECT_EQ(page.data()[kPageSize - 1], std::byte('z'));
+  page.Reset();
+
+  st = os_->Close();
+  ASSERT_TRUE(st.IsOk()) << st.ToString();
+}
+
+TEST(Crc32c, MatchesPortable) {
+  // The check value of CRC-32C
+  const std::string_view check = "123456789";
+  EXPECT_EQ(Crc32c(std::as_bytes(std::span(check))), 0xe3069283);
+  EXPECT_EQ(Crc32cPortable(std::as_bytes(std::span(check))), 0xe3069283);
+
+  // The sizes around the blocks of the interleaved streams and of the split
+  // between the multiply and the CRC instruction, at odd addresses
+  std::vector<std::byte> data((3 << 16) + 64);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<std::byte>((i * 2654435761U) >> 13U);
+  }
+  for (const auto& implementation : Crc32cImplementations()) {
+    const auto crc32c = implementation.function;
+    EXPECT_EQ(crc32c(std::as_bytes(std::span(check)), 0), 0xe3069283)
+        << implementation.name;
+
+    for (const size_t size :
+         {0, 1, 7, 8, 255, 768, 769, 1023, 1024, 1535, 16127, 16128, 16135,
+          24575, 24576, 24583, 32256, 1 << 16, (1 << 16) + 775, 3 << 16}) {
+      const auto bytes = std::span(data).subspan(3, size);
+      EXPECT_EQ(crc32c(bytes, 0), Crc32cPortable(bytes))
+          << implementation.name << " " << size;
+
+      // The checksum continues over the parts
+      const size_t half = size / 2;
+      EXPECT_EQ(crc32c(bytes.subspan(half), crc32c(bytes.first(half), 0)),
+                crc32c(bytes, 0))
+          << implementation.name << " " << size;
+    }
+  }
+}
+
+TEST(LzCodec, RoundTrips) {
+  const auto codec = NewLzCodec();
+
+  std::string text;
+  for (int i = 0; text.size() < (1 << 16); ++i) {
+    text += std::format("key-{:08} value-{} ", i, i % 7);
+  }
+  std::string noise(4096, '\0');
+  for (size_t i = 0; i < noise.size(); ++i) {
+    noise[i] = static_cast<char>((i * 2654435761U) >> 13U);
+  }
+
+  for (const std::string& input :
+       {std::string(), std::string("abc"), std::string(1000, 'x'),
+        std::string("abcabcabcabcabcabcabcabcabc!"), text, noise}) {
+    const auto bytes = std::as_bytes(std::span(input));
+
+    std::vector<std::byte> compressed(input.size() + (input.size() / 64) + 16);
+    const size_t size = codec->Compress(bytes, compressed);
+    ASSERT_GT(size, 0) << input.size();
+    if (input == text) {
+      EXPECT_LT(size, input.size() / 3);
+    }
+
+    std::vector<std::byte> output(input.size());
+    ASSERT_TRUE(codec->Decompress(std::span(compressed).first(size), output))
+        << input.size();
+    EXPECT_TRUE(std::ranges::equal(output, bytes)) << input.size();
+
+    // The output size is known, a different one is malformed input
+    if (!input.empty()) {
+      std::vector<std::byte> shorter(input.size() - 1);
+      EXPECT_FALSE(
+          codec->Decompress(std::span(compressed).first(size), shorter));
+      EXPECT_FALSE(
+          codec->Decompress(std::span(compressed).first(size - 1), output));
+    }
+  }
+
+  // The output doesn't fit
+  std::vector<std::byte> small(64);
+  EXPECT_EQ(codec->Compress(std::as_bytes(std::span(noise)), small), 0);
+
+  // Garbage neither crashes nor reads out of the buffers
+  std::vector<std::byte> output(256);
+  for (size_t i = 0; i + 32 <= noise.size(); i += 32) {
+    const auto garbage = std::as_bytes(std::span(noise)).subspan(i, 32);
+    (void)codec->Decompress(garbage, output);
+  }
+}
+
 class TestDB : public DB {};
 
 TEST(DB, Smoke) {
@@ -224,6 +633,2465 @@ TEST(DB, SomeTreeLevels) {
   status = db->Close();
   ASSERT_TRUE(status.IsOk());
 }
+TEST(DB, EvictsPagesOverCacheBudget) {
+  constexpr int kKeys = 10000;
+
+  // Zero budget is rounded up to the minimal cache, the tree is a lot bigger
+  std::shared_ptr<DB> db;
+  auto status = DB::Open("_db_test_evicts.bin", {.cache_size = 0}, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  for (int i = 0; i < kKeys; ++i) {
+    db->Put(std::format("key-{:05}", (i * 7919) % kKeys), std::to_string(i),
+            [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+  }
+
+  for (int i = 0; i < kKeys; ++i) {
+    db->Get(std::format("key-{:05}", (i * 7919) % kKeys),
+            [i](const Status& st, const std::optional<std::string>& value) {
+              ASSERT_TRUE(st.IsOk()) << st.ToString();
+              ASSERT_TRUE(value.has_value()) << i;
+              EXPECT_EQ(*value, std::to_string(i));
+            });
+  }
+
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+}
+TEST(DB, SeparatorKeysAreNotValues) {
+  constexpr int kKeys = 5000;
+
+  const auto make_key = [](int i) { return std::format("key-{:05}", i * 2); };
+  const auto missing_key = [](int i) {
+    return std::format("key-{:05}", (i * 2) + 1);
+  };
+
+  std::shared_ptr<DB> db;
+  auto status = DB::Open("_db_test_separators.bin", {}, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  // Descending order splits every leaf at its smallest end
+  for (int i = kKeys - 1; i >= 0; --i) {
+    db->Put(make_key(i), std::string(200, 'a'),
+            [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+  }
+
+  // Keys copied to the interior nodes must be rewritten in the leaves only
+  for (int i = 0; i < kKeys; ++i) {
+    db->Put(make_key(i), std::to_string(i),
+            [](const Status& st, bool rewritten) {
+              EXPECT_TRUE(st.IsOk()) << st.ToString();
+              EXPECT_TRUE(rewritten);
+            });
+  }
+
+  for (int i = 0; i < kKeys; ++i) {
+    db->Get(make_key(i), [i](const Status& st,
+                             const std::optional<std::string>& value) {
+      ASSERT_TRUE(st.IsOk()) << st.ToString();
+      ASSERT_TRUE(value.has_value()) << i;
+      EXPECT_EQ(*value, std::to_string(i));
+    });
+    db->Get(missing_key(i), [i](const Status& st,
+                                const std::optional<std::string>& value) {
+      EXPECT_TRUE(st.IsOk()) << st.ToString();
+      EXPECT_FALSE(value.has_value()) << i;
+    });
+  }
+
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+}
+
+TEST(DB, IteratorWalksLeaves) {
+  constexpr int kKeys = 3000;
+
+  const auto make_key = [](int i) { return std::format("key-{:05}", i * 2); };
+
+  std::shared_ptr<DB> db;
+  auto status = DB::Open("_db_test_iterator.bin", {}, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  {
+    auto it = db->NewIterator();
+    ASSERT_TRUE(it->SeekToFirst().IsOk());
+    EXPECT_FALSE(it->Valid());
+  }
+
+  // Insert in a scattered order, values are large enough to fill many leaves
+  for (int i = 0; i < kKeys; ++i) {
+    const int k = (i * 7919) % kKeys;
+    db->Put(make_key(k), std::format("{:0>300}", k),
+            [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+  }
+
+  auto it = db->NewIterator();
+
+  int count = 0;
+  for (status = it->SeekToFirst(); status.IsOk() && it->Valid();
+       status = it->Next()) {
+    ASSERT_EQ(it->key(), make_key(count));
+    ASSERT_EQ(it->value(), std::format("{:0>300}", count));
+    count += 1;
+  }
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  EXPECT_EQ(count, kKeys);
+
+  for (status = it->SeekToLast(); status.IsOk() && it->Valid();
+       status = it->Prev()) {
+    count -= 1;
+    ASSERT_EQ(it->key(), make_key(count));
+  }
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  EXPECT_EQ(count, 0);
+
+  // Odd keys are missing
+  ASSERT_TRUE(it->Seek("key-01001").IsOk());
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ(it->key(), "key-01002");
+  ASSERT_TRUE(it->SeekForPrev("key-01001").IsOk());
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ(it->key(), "key-01000");
+  ASSERT_TRUE(it->SeekForPrev("key-01000").IsOk());
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ(it->key(), "key-01000");
+  ASSERT_TRUE(it->Seek("zzz").IsOk());
+  EXPECT_FALSE(it->Valid());
+  ASSERT_TRUE(it->SeekForPrev("a").IsOk());
+  EXPECT_FALSE(it->Valid());
+
+  // The iterator continues from its key after the tree has been modified
+  ASSERT_TRUE(it->Seek("key-02000").IsOk());
+  for (int i = 0; i < kKeys; ++i) {
+    db->Put(std::format("key-{:05}", (i * 2) + 1), std::string(300, 'b'),
+            [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+  }
+  ASSERT_TRUE(it->Next().IsOk());
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ(it->key(), "key-02001");
+  ASSERT_TRUE(it->Prev().IsOk());
+  ASSERT_TRUE(it->Prev().IsOk());
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ(it->key(), "key-01999");
+
+  {
+    auto bounded = db->NewIterator(
+        {.lower_bound = "key-00100", .upper_bound = "key-00200"});
+
+    count = 0;
+    for (status = bounded->SeekToFirst(); status.IsOk() && bounded->Valid();
+         status = bounded->Next()) {
+      ASSERT_EQ(bounded->key(), std::format("key-{:05}", 100 + count));
+      count += 1;
+    }
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+    EXPECT_EQ(count, 100);
+
+    ASSERT_TRUE(bounded->SeekToLast().IsOk());
+    ASSERT_TRUE(bounded->Valid());
+    EXPECT_EQ(bounded->key(), "key-00199");
+    ASSERT_TRUE(bounded->SeekForPrev("key-00050").IsOk());
+    EXPECT_FALSE(bounded->Valid());
+    ASSERT_TRUE(bounded->Seek("key-00000").IsOk());
+    ASSERT_TRUE(bounded->Valid());
+    EXPECT_EQ(bounded->key(), "key-00100");
+  }
+
+  it.reset();
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+}
+
+TEST(DB, KeysWithEqualHeads) {
+  using namespace std::string_literals;
+
+  // Keys differing only after the first 8 bytes or by trailing zero bytes
+  std::vector<std::string> keys = {""s,
+                                   "\0"s,
+                                   "\0\0"s,
+                                   "a"s,
+                                   "a\0"s,
+                                   "a\0\0\0\0\0\0\0"s,
+                                   "a\0\0\0\0\0\0\0\0"s,
+                                   "\x7f\x80"s,
+                                   "\x80\x7f"s,
+                                   "\xff"s,
+                                   "\xff\xff"s};
+  for (int i = 0; i < 2000; ++i) {
+    keys.push_back(std::format("common-prefix-{}", i));
+    keys.push_back(std::format("common-p{}", i));
+  }
+
+  std::shared_ptr<DB> db;
+  auto status = DB::Open("_db_test_heads.bin", {}, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  for (const auto& key : keys) {
+    db->Put(key, key + "=" + std::string(100, 'v'),
+            [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+  }
+
+  for (const auto& key : keys) {
+    db->Get(key, [&key](const Status& st,
+                        const std::optional<std::string>& value) {
+      ASSERT_TRUE(st.IsOk()) << st.ToString();
+      ASSERT_TRUE(value.has_value());
+      EXPECT_EQ(*value, key + "=" + std::string(100, 'v'));
+    });
+  }
+  db->Get("a\0\0"s,
+          [](const Status& st, const std::optional<std::string>& value) {
+            EXPECT_TRUE(st.IsOk()) << st.ToString();
+            EXPECT_FALSE(value.has_value());
+          });
+
+  std::ranges::sort(keys);
+
+  auto it = db->NewIterator();
+  size_t index = 0;
+  for (status = it->SeekToFirst(); status.IsOk() && it->Valid();
+       status = it->Next()) {
+    ASSERT_LT(index, keys.size());
+    ASSERT_EQ(it->key(), keys[index]);
+    index += 1;
+  }
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  EXPECT_EQ(index, keys.size());
+
+  it.reset();
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+}
+
+TEST(DB, DeleteRebalancesAndReusesPages) {
+  constexpr int kKeys = 20000;
+
+  const auto make_key = [](int i) { return std::format("key-{:06}", i); };
+  const auto insert_all = [&](DB* db) {
+    for (int i = 0; i < kKeys; ++i) {
+      const int k = (i * 7919) % kKeys;
+      db->Put(make_key(k), std::string(static_cast<size_t>(k % 500), 'v'),
+              [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+    }
+  };
+
+  std::filesystem::remove("_db_test_delete_filled.bin");
+  std::filesystem::remove("_db_test_delete.bin");
+
+  uintmax_t filled_size = 0;
+  {
+    std::shared_ptr<DB> db;
+    auto status = DB::Open("_db_test_delete_filled.bin", {}, &db);
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+    insert_all(db.get());
+    status = db->Close();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    filled_size = std::filesystem::file_size("_db_test_delete_filled.bin");
+  }
+
+  std::shared_ptr<DB> db;
+  auto status = DB::Open("_db_test_delete.bin", {}, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  insert_all(db.get());
+
+  // Remove the odd keys from the right to the left
+  for (int i = kKeys - 1; i >= 0; i -= 2) {
+    db->Delete(make_key(i), [](const Status& st, bool found) {
+      EXPECT_TRUE(st.IsOk()) << st.ToString();
+      EXPECT_TRUE(found);
+    });
+  }
+  db->Delete(make_key(1), [](const Status& st, bool found) {
+    EXPECT_TRUE(st.IsOk()) << st.ToString();
+    EXPECT_FALSE(found);
+  });
+
+  for (int i = 0; i < kKeys; ++i) {
+    db->Get(make_key(i), [i](const Status& st,
+                             const std::optional<std::string>& value) {
+      ASSERT_TRUE(st.IsOk()) << st.ToString();
+      EXPECT_EQ(value.has_value(), i % 2 == 0) << i;
+    });
+  }
+
+  {
+    auto it = db->NewIterator();
+    int count = 0;
+    for (status = it->SeekToFirst(); status.IsOk() && it->Valid();
+         status = it->Next()) {
+      ASSERT_EQ(it->key(), make_key(count * 2));
+      count += 1;
+    }
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+    EXPECT_EQ(count, kKeys / 2);
+
+    for (status = it->SeekToLast(); status.IsOk() && it->Valid();
+         status = it->Prev()) {
+      count -= 1;
+      ASSERT_EQ(it->key(), make_key(count * 2));
+    }
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+    EXPECT_EQ(count, 0);
+  }
+
+  // Empty the tree in a scattered order and fill it again
+  for (int i = 0; i < kKeys; i += 2) {
+    db->Delete(make_key((i * 7919) % kKeys), [](const Status& st, bool found) {
+      EXPECT_TRUE(st.IsOk()) << st.ToString();
+      EXPECT_TRUE(found);
+    });
+  }
+
+  {
+    auto it = db->NewIterator();
+    ASSERT_TRUE(it->SeekToFirst().IsOk());
+    EXPECT_FALSE(it->Valid());
+  }
+
+  insert_all(db.get());
+  for (int i = 0; i < kKeys; ++i) {
+    db->Get(make_key(i), [i](const Status& st,
+                             const std::optional<std::string>& value) {
+      ASSERT_TRUE(st.IsOk()) << st.ToString();
+      ASSERT_TRUE(value.has_value()) << i;
+      EXPECT_EQ(value->size(), static_cast<size_t>(i % 500));
+    });
+  }
+
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  // The freed pages have been reused
+  EXPECT_LE(std::filesystem::file_size("_db_test_delete.bin"), filled_size);
+}
+
+TEST(DB, ReplaysWriteAheadLog) {
+  constexpr int kKeys = 1000;
+
+  const auto make_key = [](int i) { return std::format("key-{}", i); };
+
+  for (const auto* name : {"_db_test_wal.bin", "_db_test_wal.bin.wal",
+                           "_db_test_wal_crash.bin",
+                           "_db_test_wal_crash.bin.wal"}) {
+    std::filesystem::remove(name);
+  }
+
+  std::shared_ptr<DB> db;
+  auto status = DB::Open("_db_test_wal.bin", {.sync = true}, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  int committed = 0;
+  for (int i = 0; i < kKeys; ++i) {
+    db->Put(make_key(i), std::to_string(i), [&](const Status& st, bool) {
+      EXPECT_TRUE(st.IsOk()) << st.ToString();
+      committed += 1;
+    });
+  }
+  for (int i = 0; i < kKeys; i += 2) {
+    db->Delete(make_key(i), [&](const Status& st, bool found) {
+      EXPECT_TRUE(st.IsOk()) << st.ToString();
+      EXPECT_TRUE(found);
+      committed += 1;
+    });
+  }
+
+  // Commits wait for the log sync, which is done by the event loop
+  EXPECT_EQ(committed, 0);
+  status = db->Wait();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  EXPECT_EQ(committed, kKeys + (kKeys / 2));
+
+  // Take the files as they would be left by a crash, the last record is torn
+  std::filesystem::copy_file("_db_test_wal.bin", "_db_test_wal_crash.bin");
+  std::filesystem::copy_file("_db_test_wal.bin.wal",
+                             "_db_test_wal_crash.bin.wal");
+  std::filesystem::resize_file(
+      "_db_test_wal_crash.bin.wal",
+      std::filesystem::file_size("_db_test_wal_crash.bin.wal") - 1);
+
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  EXPECT_EQ(std::filesystem::file_size("_db_test_wal.bin.wal"), 0);
+
+  status = DB::Open("_db_test_wal_crash.bin", {}, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  for (int i = 0; i < kKeys - 2; ++i) {
+    db->Get(make_key(i), [i](const Status& st,
+                             const std::optional<std::string>& value) {
+      ASSERT_TRUE(st.IsOk()) << st.ToString();
+      if (i % 2 == 0) {
+        EXPECT_FALSE(value.has_value()) << i;
+      } else {
+        ASSERT_TRUE(value.has_value()) << i;
+        EXPECT_EQ(*value, std::to_string(i));
+      }
+    });
+  }
+
+  // The delete of the last even key has been lost with the torn record
+  db->Get(make_key(kKeys - 2),
+          [](const Status& st, const std::optional<std::string>& value) {
+            ASSERT_TRUE(st.IsOk()) << st.ToString();
+            EXPECT_TRUE(value.has_value());
+          });
+
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+}
+
+TEST(DB, WaitWritesBufferedLogRecords) {
+  constexpr int kKeys = 100;
+  constexpr char const* kPath = "_db_test_lazy_wal.bin";
+  constexpr char const* kCrashPath = "_db_test_lazy_wal_crash.bin";
+
+  const auto make_key = [](int i) { return std::format("key-{}", i); };
+
+  for (const auto* path : {kPath, kCrashPath}) {
+    for (const auto* suffix : {"", ".wal", ".journal"}) {
+      std::filesystem::remove(std::string(path) + suffix);
+    }
+  }
+
+  std::shared_ptr<DB> db;
+  auto status = DB::Open(kPath, {}, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  // Far less than the buffer holds
+  for (int i = 0; i < kKeys; ++i) {
+    db->Put(make_key(i), std::to_string(i), [](const Status& st, bool) {
+      EXPECT_TRUE(st.IsOk()) << st.ToString();
+    });
+  }
+  EXPECT_EQ(std::filesystem::file_size(std::string(kPath) + ".wal"), 0);
+
+  status = db->Wait();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  EXPECT_GT(std::filesystem::file_size(std::string(kPath) + ".wal"), 0);
+
+  // The process dies, the written records survive it
+  for (const auto* suffix : {"", ".wal", ".journal"}) {
+    std::filesystem::copy_file(std::string(kPath) + suffix,
+                               std::string(kCrashPath) + suffix);
+  }
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  status = DB::Open(kCrashPath, {}, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  for (int i = 0; i < kKeys; ++i) {
+    db->Get(make_key(i), [i](const Status& st,
+                             const std::optional<std::string>& value) {
+      ASSERT_TRUE(st.IsOk()) << st.ToString();
+      EXPECT_EQ(value, std::to_string(i)) << i;
+    });
+  }
+
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+}
+
+TEST(DB, RecoversAfterEvictingDirtyPages) {
+  constexpr int kKeys = 30000;
+  constexpr char const* kPath = "_db_test_evicted.bin";
+  constexpr char const* kCrashPath = "_db_test_evicted_crash.bin";
+  constexpr std::array<const char*, 3> kSuffixes = {"", ".wal", ".journal"};
+
+  const auto make_key = [](int i) { return std::format("key-{:06}", i); };
+  const auto make_value = [](int i, int round) {
+    return std::format("value-{:06}-{}-{}", i, round, std::string(80, 'v'));
+  };
+
+  for (const bool copy_on_write : {false, true}) {
+    for (const auto* path : {kPath, kCrashPath}) {
+      for (const auto* suffix : kSuffixes) {
+        std::filesystem::remove(std::string(path) + suffix);
+      }
+    }
+
+    // The tree outgrows the minimal cache many times, the dirty pages are
+    // evicted long before the next checkpoint
+    const Options options{.cache_size = 0,
+                          .sync = true,
+                          .wal_checkpoint_size = size_t{1} << 30,
+                          .copy_on_write = copy_on_write};
+    std::shared_ptr<DB> db;
+    auto status = DB::Open(kPath, options, &db);
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    for (int i = 0; i < kKeys; i += 2) {
+      db->Put(make_key(i), make_value(i, 0),
+              [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+    }
+    status = db->Sync();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    // The new keys split the committed leaves, the deletions merge them
+    for (int i = 0; i < kKeys; ++i) {
+      if (i % 7 == 0) {
+        db->Delete(make_key(i),
+                   [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+      } else {
+        db->Put(make_key(i), make_value(i, 1),
+                [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+      }
+    }
+    status = db->Wait();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    // The crash leaves the files as they are, the cached pages are lost
+    for (const auto* suffix : kSuffixes) {
+      if (std::filesystem::exists(std::string(kPath) + suffix)) {
+        std::filesystem::copy_file(std::string(kPath) + suffix,
+                                   std::string(kCrashPath) + suffix);
+      }
+    }
+    status = db->Close();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    status = DB::Open(kCrashPath, options, &db);
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    for (int i = 0; i < kKeys; ++i) {
+      db->Get(make_key(i), [&, i](const Status& st,
+                                  const std::optional<std::string>& value) {
+        ASSERT_TRUE(st.IsOk()) << st.ToString();
+        if (i % 7 == 0) {
+          EXPECT_FALSE(value.has_value()) << i;
+        } else {
+          EXPECT_EQ(value, make_value(i, 1)) << i;
+        }
+      });
+    }
+
+    auto it = db->NewIterator();
+    int count = 0;
+    for (status = it->SeekToFirst(); status.IsOk() && it->Valid();
+         status = it->Next()) {
+      count += 1;
+    }
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+    EXPECT_EQ(count, kKeys - ((kKeys + 6) / 7));
+    it.reset();
+
+    status = db->Close();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+  }
+}
+
+TEST(DB, CrashWithoutLogKeepsLastCommit) {
+  constexpr int kKeys = 30000;
+  constexpr char const* kPath = "_db_test_unlogged.bin";
+  constexpr char const* kCrashPath = "_db_test_unlogged_crash.bin";
+  constexpr std::array<const char*, 2> kSuffixes = {"", ".journal"};
+
+  const auto make_key = [](int i) { return std::format("key-{:06}", i); };
+  const auto make_value = [](int i, int round) {
+    return std::format("value-{:06}-{}-{}", i, round, std::string(80, 'v'));
+  };
+
+  for (const bool copy_on_write : {false, true}) {
+    for (const auto* path : {kPath, kCrashPath}) {
+      for (const auto* suffix : kSuffixes) {
+        std::filesystem::remove(std::string(path) + suffix);
+      }
+    }
+
+    const Options options{
+        .cache_size = 0, .wal = false, .copy_on_write = copy_on_write};
+    std::shared_ptr<DB> db;
+    auto status = DB::Open(kPath, options, &db);
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    for (int i = 0; i < kKeys; i += 2) {
+      db->Put(make_key(i), make_value(i, 0),
+              [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+    }
+    status = db->Sync();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    // The uncommitted changes are evicted to the datafile
+    for (int i = 0; i < kKeys; ++i) {
+      if (i % 7 == 0) {
+        db->Delete(make_key(i),
+                   [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+      } else {
+        db->Put(make_key(i), make_value(i, 1),
+                [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+      }
+    }
+
+    for (const auto* suffix : kSuffixes) {
+      if (std::filesystem::exists(std::string(kPath) + suffix)) {
+        std::filesystem::copy_file(std::string(kPath) + suffix,
+                                   std::string(kCrashPath) + suffix);
+      }
+    }
+    status = db->Close();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    // Without the log the database is as of the last commit
+    status = DB::Open(kCrashPath, options, &db);
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    for (int i = 0; i < kKeys; ++i) {
+      db->Get(make_key(i), [&, i](const Status& st,
+                                  const std::optional<std::string>& value) {
+        ASSERT_TRUE(st.IsOk()) << st.ToString();
+        if (i % 2 == 0) {
+          EXPECT_EQ(value, make_value(i, 0)) << i;
+        } else {
+          EXPECT_FALSE(value.has_value()) << i;
+        }
+      });
+    }
+
+    auto it = db->NewIterator();
+    int count = 0;
+    for (status = it->SeekToFirst(); status.IsOk() && it->Valid();
+         status = it->Next()) {
+      count += 1;
+    }
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+    EXPECT_EQ(count, kKeys / 2);
+    it.reset();
+
+    status = db->Close();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+  }
+}
+
+TEST(DB, ReopensFromMetaPage) {
+  constexpr int kKeys = 5000;
+  constexpr char const* kPath = "_db_test_meta.bin";
+
+  const auto make_key = [](int i) { return std::format("key-{:05}", i); };
+  const auto exists = [](int i) { return i >= kKeys || i % 3 != 0; };
+
+  std::filesystem::remove(kPath);
+  std::filesystem::remove(std::string(kPath) + ".wal");
+
+  {
+    std::shared_ptr<DB> db;
+    auto status = DB::Open(kPath, {}, &db);
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    for (int i = 0; i < kKeys; ++i) {
+      db->Put(make_key(i), std::string(100, 'v'),
+              [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+    }
+    for (int i = 0; i < kKeys; i += 3) {
+      db->Delete(make_key(i),
+                 [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+    }
+
+    status = db->Close();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+  }
+
+  // The root and the free list are restored without the log
+  {
+    std::shared_ptr<DB> db;
+    auto status = DB::Open(kPath, {.wal = false}, &db);
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    for (int i = kKeys; i < 2 * kKeys; ++i) {
+      db->Put(make_key(i), std::string(100, 'v'),
+              [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+    }
+
+    status = db->Close();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+  }
+
+  {
+    std::shared_ptr<DB> db;
+    auto status = DB::Open(kPath, {}, &db);
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    for (int i = 0; i < 2 * kKeys; ++i) {
+      db->Get(make_key(i), [&](const Status& st,
+                               const std::optional<std::string>& value) {
+        ASSERT_TRUE(st.IsOk()) << st.ToString();
+        EXPECT_EQ(value.has_value(), exists(i)) << i;
+      });
+    }
+
+    auto it = db->NewIterator();
+    int count = 0;
+    for (status = it->SeekToFirst(); status.IsOk() && it->Valid();
+         status = it->Next()) {
+      count += 1;
+    }
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+    EXPECT_EQ(count, (2 * kKeys) - ((kKeys + 2) / 3));
+
+    it.reset();
+    status = db->Close();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+  }
+
+  // Both copies of the meta page are damaged
+  {
+    std::fstream file(kPath, std::ios::in | std::ios::out | std::ios::binary);
+    for (const std::streamoff offset : {0, 1 << 16}) {
+      file.seekp(offset + 8);
+      file.write("garbage", 7);
+    }
+  }
+
+  std::shared_ptr<DB> db;
+  auto status = DB::Open(kPath, {}, &db);
+  EXPECT_TRUE(status.IsCorruptedDatafile()) << status.ToString();
+}
+
+TEST(DB, OpensWithoutScanningTree) {
+  constexpr int kKeys = 5000;
+  constexpr char const* kPath = "_db_test_open_scan.bin";
+
+  const auto make_key = [](int i) { return std::format("key-{:05}", i); };
+  const auto make_value = [](int i) {
+    return std::string(i % 2 == 0 ? 1000 : 100, 'v');
+  };
+
+  // The free pages, the garbage of the value log and the keys of the filter
+  // are restored without reading the tree
+  for (const bool copy_on_write : {false, true}) {
+    std::error_code rc;
+    for (const auto& file : std::filesystem::directory_iterator(".")) {
+      if (file.path().filename().string().starts_with(kPath)) {
+        std::filesystem::remove(file.path(), rc);
+      }
+    }
+
+    const Options options{.cache_size = 0,
+                          .value_log = true,
+                          .value_log_threshold = 500,
+                          .copy_on_write = copy_on_write,
+                          .bloom_filter_size = kKeys * 2};
+    std::shared_ptr<DB> db;
+    auto status = DB::Open(kPath, options, &db);
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    for (int i = 0; i < kKeys; ++i) {
+      db->Put(make_key(i), make_value(i),
+              [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+    }
+    status = db->Sync();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+    for (int i = 0; i < kKeys / 2; ++i) {
+      db->Delete(make_key(i),
+                 [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+    }
+    status = db->Close();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+    const auto size = std::filesystem::file_size(kPath);
+
+    status = DB::Open(kPath, options, &db);
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+    EXPECT_EQ(db->GetStatistics().page_bytes_read, 0) << copy_on_write;
+
+    // The freed pages take the new keys
+    for (int i = 0; i < kKeys / 4; ++i) {
+      db->Put(make_key(i), make_value(i + 1),
+              [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+    }
+    status = db->Sync();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+    EXPECT_EQ(std::filesystem::file_size(kPath), size) << copy_on_write;
+
+    // The lookups fill the filter, then it answers for the deleted keys
+    for (int pass = 0; pass < 2; ++pass) {
+      for (int i = 0; i < kKeys; ++i) {
+        db->Get(make_key(i), [&](const Status& st,
+                                 const std::optional<std::string>& value) {
+          ASSERT_TRUE(st.IsOk()) << st.ToString();
+          EXPECT_EQ(value.has_value(), i < kKeys / 4 || i >= kKeys / 2) << i;
+        });
+      }
+    }
+    EXPECT_GT(db->GetStatistics().filtered_lookups, kKeys / 4 * 95 / 100);
+
+    status = db->Close();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+  }
+}
+
+TEST(DB, CopyOnWriteCommits) {
+  constexpr int kKeys = 10000;
+  constexpr char const* kPath = "_db_test_cow.bin";
+  constexpr char const* kCrashPath = "_db_test_cow_crash.bin";
+
+  // Long keys make a tree of three levels
+  const auto make_key = [](int i) {
+    return std::format("key-{:05}-{}", i, std::string(500, 'k'));
+  };
+  const auto put_all = [&](DB* db, char value) {
+    for (int i = 0; i < kKeys; ++i) {
+      db->Put(make_key(i), std::string(200, value),
+              [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+    }
+  };
+  const auto count_keys = [](DB* db, char value) {
+    auto it = db->NewIterator();
+    std::string prev;
+    int count = 0;
+    auto st = it->SeekToFirst();
+    for (; st.IsOk() && it->Valid(); st = it->Next()) {
+      EXPECT_LT(prev, it->key());
+      EXPECT_EQ(it->value(), std::string(200, value));
+      prev = it->key();
+      count += 1;
+    }
+    EXPECT_TRUE(st.IsOk()) << st.ToString();
+
+    int backward = 0;
+    for (st = it->SeekToLast(); st.IsOk() && it->Valid(); st = it->Prev()) {
+      backward += 1;
+    }
+    EXPECT_TRUE(st.IsOk()) << st.ToString();
+    EXPECT_EQ(backward, count);
+    return count;
+  };
+
+  std::filesystem::remove(kPath);
+  std::filesystem::remove(kCrashPath);
+
+  // The small cache writes back uncommitted pages before the commit
+  const Options options{
+      .cache_size = 1 << 20, .wal = false, .copy_on_write = true};
+
+  std::shared_ptr<DB> db;
+  auto status = DB::Open(kPath, options, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  put_all(db.get(), 'a');
+  status = db->Sync();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  // Modify every leaf and take the datafile as it would be left by a crash
+  put_all(db.get(), 'b');
+  for (int i = 0; i < kKeys; i += 2) {
+    db->Delete(make_key(i),
+               [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+  }
+  EXPECT_EQ(count_keys(db.get(), 'b'), kKeys / 2);
+  std::filesystem::copy_file(kPath, kCrashPath);
+
+  // The pages replaced by a commit are reused after the next one
+  status = db->Sync();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  put_all(db.get(), 'c');
+  status = db->Sync();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  const auto size = std::filesystem::file_size(kPath);
+  for (const char value : {'d', 'e', 'f'}) {
+    put_all(db.get(), value);
+    status = db->Sync();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+  }
+  EXPECT_EQ(std::filesystem::file_size(kPath), size);
+  EXPECT_EQ(count_keys(db.get(), 'f'), kKeys);
+
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  // Only the committed version is visible after the crash
+  status = DB::Open(kCrashPath, options, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  EXPECT_EQ(count_keys(db.get(), 'a'), kKeys);
+
+  put_all(db.get(), 'g');
+  EXPECT_EQ(count_keys(db.get(), 'g'), kKeys);
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+}
+
+TEST(DB, SnapshotsKeepTheirVersion) {
+  constexpr int kKeys = 3000;
+  constexpr char const* kPath = "_db_test_snapshot.bin";
+
+  const auto make_key = [](int i) { return std::format("key-{:05}", i); };
+  const auto put_all = [&](DB* db, char value) {
+    for (int i = 0; i < kKeys; ++i) {
+      db->Put(make_key(i), std::string(100, value),
+              [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+    }
+  };
+  const auto count_keys = [](DB* db, const IteratorOptions& options,
+                             char value) {
+    auto it = db->NewIterator(options);
+    int count = 0;
+    auto st = it->SeekToFirst();
+    for (; st.IsOk() && it->Valid(); st = it->Next()) {
+      EXPECT_EQ(it->value(), std::string(100, value)) << it->key();
+      count += 1;
+    }
+    EXPECT_TRUE(st.IsOk()) << st.ToString();
+    return count;
+  };
+
+  std::filesystem::remove(kPath);
+
+  std::shared_ptr<DB> db;
+  auto status = DB::Open(kPath, {.wal = false}, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  std::shared_ptr<const Snapshot> snapshot;
+  EXPECT_TRUE(db->GetSnapshot(&snapshot).IsInvalidArgument());
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  const Options options{
+      .cache_size = 1 << 20, .wal = false, .copy_on_write = true};
+  status = DB::Open(kPath, options, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  put_all(db.get(), 'a');
+  std::shared_ptr<const Snapshot> first;
+  status = db->GetSnapshot(&first);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  // An iterator keeps reading its snapshot while the tree is modified
+  auto it = db->NewIterator({.snapshot = first});
+  status = it->SeekToFirst();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  put_all(db.get(), 'b');
+  for (int i = 0; i < kKeys; i += 2) {
+    db->Delete(make_key(i),
+               [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+  }
+
+  std::shared_ptr<const Snapshot> second;
+  status = db->GetSnapshot(&second);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  // The replaced pages of the snapshots survive the commits
+  for (const char value : {'c', 'd', 'e'}) {
+    put_all(db.get(), value);
+    status = db->Sync();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+  }
+
+  int count = 0;
+  for (; status.IsOk() && it->Valid(); status = it->Next()) {
+    EXPECT_EQ(it->key(), make_key(count));
+    EXPECT_EQ(it->value(), std::string(100, 'a'));
+    count += 1;
+  }
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  EXPECT_EQ(count, kKeys);
+  it.reset();
+
+  EXPECT_EQ(count_keys(db.get(), {.snapshot = first}, 'a'), kKeys);
+  EXPECT_EQ(count_keys(db.get(), {.snapshot = second}, 'b'), kKeys / 2);
+  EXPECT_EQ(count_keys(db.get(), {}, 'e'), kKeys);
+
+  for (const int i : {0, 1, kKeys - 1}) {
+    db->Get(*second, make_key(i),
+            [i](const Status& st, const std::optional<std::string>& value) {
+              ASSERT_TRUE(st.IsOk()) << st.ToString();
+              if (i % 2 == 0) {
+                EXPECT_FALSE(value.has_value()) << i;
+              } else {
+                EXPECT_EQ(value, std::string(100, 'b')) << i;
+              }
+            });
+  }
+
+  // Once the snapshots are released their pages are reused
+  first.reset();
+  second.reset();
+  put_all(db.get(), 'f');
+  status = db->Sync();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  const auto size = std::filesystem::file_size(kPath);
+  for (const char value : {'g', 'h', 'i'}) {
+    put_all(db.get(), value);
+    status = db->Sync();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+  }
+  EXPECT_EQ(std::filesystem::file_size(kPath), size);
+  EXPECT_EQ(count_keys(db.get(), {}, 'i'), kKeys);
+
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+}
+
+TEST(DB, GetsWithoutAllocation) {
+  constexpr int kKeys = 3000;
+  constexpr char const* kPath = "_db_test_get_view.bin";
+
+  const auto make_key = [](int i) { return std::format("key-{:05}", i); };
+  const auto make_value = [](int i, char fill) {
+    // Every 100th value takes an overflow chain
+    return std::format("{}-{}", i, std::string(i % 100 == 0 ? 10000 : 100,
+                                                fill));
+  };
+
+  std::filesystem::remove(kPath);
+  std::filesystem::remove(std::string(kPath) + ".wal");
+
+  std::shared_ptr<DB> db;
+  auto status = DB::Open(kPath,
+                         {.cache_size = 0, .copy_on_write = true}, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  for (int i = 0; i < kKeys; ++i) {
+    db->Put(make_key(i), make_value(i, 'a'),
+            [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+  }
+
+  // The buffer is reused once it fits the largest value
+  std::string buffer;
+  buffer.reserve(20000);
+  const auto* data = buffer.data();
+  for (int i = 0; i < kKeys; ++i) {
+    db->Get(make_key(i), &buffer, [&](const Status& st, bool found) {
+      ASSERT_TRUE(st.IsOk()) << st.ToString();
+      EXPECT_TRUE(found);
+      EXPECT_EQ(buffer, make_value(i, 'a')) << i;
+    });
+  }
+  EXPECT_EQ(buffer.data(), data);
+
+  db->Get("absent", &buffer, [&](const Status& st, bool found) {
+    ASSERT_TRUE(st.IsOk()) << st.ToString();
+    EXPECT_FALSE(found);
+    EXPECT_TRUE(buffer.empty());
+  });
+
+  // The views of the snapshot don't change with the database
+  std::shared_ptr<const Snapshot> snapshot;
+  status = db->GetSnapshot(&snapshot);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  for (int i = 0; i < kKeys; i += 2) {
+    db->Put(make_key(i), make_value(i, 'b'),
+            [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+  }
+  status = db->Sync();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  for (int i = 0; i < kKeys; ++i) {
+    db->GetView(*snapshot, make_key(i),
+                [&](const Status& st,
+                    const std::optional<std::string_view>& value) {
+                  ASSERT_TRUE(st.IsOk()) << st.ToString();
+                  EXPECT_EQ(value, make_value(i, 'a')) << i;
+                });
+    db->Get(*snapshot, make_key(i), &buffer,
+            [&](const Status& st, bool found) {
+              ASSERT_TRUE(st.IsOk()) << st.ToString();
+              EXPECT_TRUE(found);
+              EXPECT_EQ(buffer, make_value(i, 'a')) << i;
+            });
+    db->Get(make_key(i), &buffer, [&](const Status& st, bool found) {
+      ASSERT_TRUE(st.IsOk()) << st.ToString();
+      EXPECT_TRUE(found);
+      EXPECT_EQ(buffer, make_value(i, i % 2 == 0 ? 'b' : 'a')) << i;
+    });
+  }
+  db->GetView(*snapshot, "absent",
+              [](const Status& st,
+                 const std::optional<std::string_view>& value) {
+                ASSERT_TRUE(st.IsOk()) << st.ToString();
+                EXPECT_FALSE(value.has_value());
+              });
+
+  snapshot.reset();
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+}
+
+TEST(DB, WriteBatchIsAtomic) {
+  constexpr int kKeys = 3000;
+  constexpr char const* kPath = "_db_test_batch.bin";
+  constexpr char const* kCrashPath = "_db_test_batch_crash.bin";
+
+  const auto make_key = [](int i) { return std::format("key-{:05}", i); };
+
+  for (const auto* path : {kPath, kCrashPath}) {
+    std::filesystem::remove(path);
+    std::filesystem::remove(std::string(path) + ".wal");
+  }
+
+  std::shared_ptr<DB> db;
+  auto status = DB::Open(kPath, {.sync = true}, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  // The keys are added out of order, later modifications of a key win
+  WriteBatch batch;
+  for (int i = 0; i < kKeys; ++i) {
+    batch.Put(make_key((i * 7919) % kKeys), std::string(100, 'a'));
+  }
+  for (int i = 0; i < kKeys; i += 3) {
+    batch.Delete(make_key(i));
+  }
+  for (int i = 0; i < kKeys; i += 6) {
+    batch.Put(make_key(i), "b");
+  }
+  EXPECT_EQ(batch.Count(), kKeys + ((kKeys + 2) / 3) + ((kKeys + 5) / 6));
+
+  int committed = 0;
+  db->Write(batch, [&](const Status& st) {
+    EXPECT_TRUE(st.IsOk()) << st.ToString();
+    committed += 1;
+  });
+  status = db->Wait();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  EXPECT_EQ(committed, 1);
+
+  // A batch with an oversized entry isn't applied at all
+  WriteBatch invalid;
+  invalid.Put("valid", "value");
+  invalid.Put(std::string(2000, 'k'), "value");
+  db->Write(invalid, [](const Status& st) {
+    EXPECT_TRUE(st.IsInvalidArgument()) << st.ToString();
+  });
+
+  // The last batch is torn by the crash and is lost as a whole
+  WriteBatch lost;
+  for (int i = 0; i < kKeys; ++i) {
+    lost.Delete(make_key(i));
+  }
+  db->Write(lost, [](const Status& st) { EXPECT_TRUE(st.IsOk()); });
+  status = db->Wait();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  std::filesystem::copy_file(kPath, kCrashPath);
+  std::filesystem::copy_file(std::string(kPath) + ".wal",
+                             std::string(kCrashPath) + ".wal");
+  std::filesystem::resize_file(
+      std::string(kCrashPath) + ".wal",
+      std::filesystem::file_size(std::string(kCrashPath) + ".wal") - 1);
+
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  status = DB::Open(kCrashPath, {}, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  for (int i = 0; i < kKeys; ++i) {
+    db->Get(make_key(i), [i](const Status& st,
+                             const std::optional<std::string>& value) {
+      ASSERT_TRUE(st.IsOk()) << st.ToString();
+      if (i % 6 == 0) {
+        EXPECT_EQ(value, "b") << i;
+      } else if (i % 3 == 0) {
+        EXPECT_FALSE(value.has_value()) << i;
+      } else {
+        EXPECT_EQ(value, std::string(100, 'a')) << i;
+      }
+    });
+  }
+  db->Get("valid", [](const Status& st,
+                      const std::optional<std::string>& value) {
+    ASSERT_TRUE(st.IsOk()) << st.ToString();
+    EXPECT_FALSE(value.has_value());
+  });
+
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+}
+
+TEST(DB, FailedWritesChangeNothing) {
+  constexpr int kKeys = 10;
+  constexpr char const* kPath = "_db_test_failed_write.bin";
+  const std::string segment_prefix = std::string(kPath) + ".vlog.";
+
+  const auto make_key = [](int i) { return std::format("key-{:02}", i); };
+  const auto cleanup = [&] {
+    std::error_code rc;
+    std::filesystem::remove(kPath, rc);
+    std::filesystem::remove(std::string(kPath) + ".wal", rc);
+    for (int segment = 0; segment < 10; ++segment) {
+      std::filesystem::remove_all(
+          std::format("{}{:06}", segment_prefix, segment), rc);
+    }
+  };
+  cleanup();
+
+  const Options options{.value_log = true,
+                        .value_log_threshold = 100,
+                        .value_log_segment_size = 4 << 10};
+  std::shared_ptr<DB> db;
+  auto status = DB::Open(kPath, options, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  for (int i = 0; i < kKeys; ++i) {
+    db->Put(make_key(i), "old", [](const Status& st, bool) {
+      EXPECT_TRUE(st.IsOk()) << st.ToString();
+    });
+  }
+  db->Put("logged", std::string(1000, 'o'), [](const Status& st, bool) {
+    EXPECT_TRUE(st.IsOk()) << st.ToString();
+  });
+
+  const auto expect_old = [&] {
+    for (int i = 0; i < kKeys; ++i) {
+      db->Get(make_key(i), [i](const Status& st,
+                               const std::optional<std::string>& value) {
+        ASSERT_TRUE(st.IsOk()) << st.ToString();
+        EXPECT_EQ(value, "old") << i;
+      });
+    }
+    db->Get("logged",
+            [](const Status& st, const std::optional<std::string>& value) {
+              ASSERT_TRUE(st.IsOk()) << st.ToString();
+              EXPECT_EQ(value, std::string(1000, 'o'));
+            });
+  };
+
+  // The next segment can't be created, the values filling the first one are
+  // stored before the failure
+  std::filesystem::create_directory(segment_prefix + "000001");
+
+  WriteBatch batch;
+  for (int i = 0; i < kKeys; ++i) {
+    batch.Put(make_key(i), std::string(1000, 'n'));
+  }
+  batch.Delete("logged");
+  db->Write(batch, [](const Status& st) { EXPECT_FALSE(st.IsOk()); });
+  expect_old();
+
+  // A rewrite keeps the old value when the new one can't be stored
+  for (int i = 0; i < 5; ++i) {
+    db->Put("logged", std::string(1000, 'n'),
+            [](const Status& st, bool) { EXPECT_FALSE(st.IsOk()); });
+  }
+  expect_old();
+
+  // Nothing of the failed writes is replayed
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  std::filesystem::remove(segment_prefix + "000001");
+  status = DB::Open(kPath, options, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  expect_old();
+
+  db->Write(batch, [](const Status& st) {
+    EXPECT_TRUE(st.IsOk()) << st.ToString();
+  });
+  for (int i = 0; i < kKeys; ++i) {
+    db->Get(make_key(i),
+            [](const Status& st, const std::optional<std::string>& value) {
+              ASSERT_TRUE(st.IsOk()) << st.ToString();
+              EXPECT_EQ(value, std::string(1000, 'n'));
+            });
+  }
+
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  cleanup();
+}
+
+TEST(DB, FailedLogWriteChangesNothing) {
+  constexpr int kKeys = 10;
+  constexpr char const* kPath = "_db_test_failed_log.bin";
+  const std::string wal_path = std::string(kPath) + ".wal";
+
+  const auto make_key = [](int i) { return std::format("key-{:02}", i); };
+  const auto cleanup = [&] {
+    std::error_code rc;
+    std::filesystem::remove(kPath, rc);
+    std::filesystem::remove(wal_path, rc);
+    std::filesystem::remove(std::string(kPath) + ".journal", rc);
+  };
+  cleanup();
+
+  const Options options{.sync = true};
+  std::shared_ptr<DB> db;
+  auto status = DB::Open(kPath, options, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  for (int i = 0; i < kKeys; ++i) {
+    db->Put(make_key(i), "old", [](const Status& st, bool) {
+      EXPECT_TRUE(st.IsOk()) << st.ToString();
+    });
+  }
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  db.reset();
+
+  const auto expect_old = [&] {
+    for (int i = 0; i < kKeys; ++i) {
+      db->Get(make_key(i), [i](const Status& st,
+                               const std::optional<std::string>& value) {
+        ASSERT_TRUE(st.IsOk()) << st.ToString();
+        EXPECT_EQ(value, "old") << i;
+      });
+    }
+  };
+
+  // Every write of the log fails with no space left
+  std::filesystem::remove(wal_path);
+  std::filesystem::create_symlink("/dev/full", wal_path);
+  status = DB::Open(kPath, options, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  // The first write is applied before its record fails, the following ones
+  // aren't applied at all
+  db->Put(make_key(0), "new",
+          [](const Status& st, bool) { EXPECT_FALSE(st.IsOk()); });
+  status = db->Wait();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  for (int i = 1; i < kKeys; ++i) {
+    db->Put(make_key(i), "new",
+            [](const Status& st, bool) { EXPECT_FALSE(st.IsOk()); });
+  }
+  db->Delete(make_key(1),
+             [](const Status& st, bool) { EXPECT_FALSE(st.IsOk()); });
+  WriteBatch batch;
+  batch.Put(make_key(2), "new");
+  batch.Delete(make_key(3));
+  db->Write(batch, [](const Status& st) { EXPECT_FALSE(st.IsOk()); });
+  status = db->Wait();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  for (int i = 1; i < kKeys; ++i) {
+    db->Get(make_key(i), [i](const Status& st,
+                             const std::optional<std::string>& value) {
+      ASSERT_TRUE(st.IsOk()) << st.ToString();
+      EXPECT_EQ(value, "old") << i;
+    });
+  }
+
+  // Nothing is committed after the failure
+  status = db->Sync();
+  EXPECT_FALSE(status.IsOk());
+  status = db->Close();
+  EXPECT_FALSE(status.IsOk());
+  db.reset();
+
+  std::filesystem::remove(wal_path);
+  status = DB::Open(kPath, options, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  expect_old();
+
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  cleanup();
+}
+
+TEST(DB, VariableLengthRecords) {
+  constexpr int kKeys = 2000;
+
+  // Keys are longer than the old fixed slots, sizes vary from record to record
+  const auto make_key = [](int i) {
+    return std::format("{}:{}", i, std::string(static_cast<size_t>(i % 700),
+                                                'k'));
+  };
+  const auto make_value = [](int i, int version) {
+    return std::string(static_cast<size_t>((i * 37 + version * 11) % 6000),
+                       static_cast<char>('a' + ((i + version) % 26)));
+  };
+
+  std::shared_ptr<DB> db;
+  auto status = DB::Open("_db_test_varlen.bin", {}, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  for (int i = 0; i < kKeys; ++i) {
+    db->Put(make_key(i), make_value(i, 0),
+            [](const Status& st, bool rewritten) {
+              EXPECT_TRUE(st.IsOk()) << st.ToString();
+              EXPECT_FALSE(rewritten);
+            });
+  }
+
+  // Rewrite every other record with a value of a different size
+  for (int i = 0; i < kKeys; i += 2) {
+    db->Put(make_key(i), make_value(i, 1),
+            [](const Status& st, bool rewritten) {
+              EXPECT_TRUE(st.IsOk()) << st.ToString();
+              EXPECT_TRUE(rewritten);
+            });
+  }
+
+  for (int i = 0; i < kKeys; ++i) {
+    db->Get(make_key(i), [&](const Status& st,
+                             const std::optional<std::string>& value) {
+      ASSERT_TRUE(st.IsOk()) << st.ToString();
+      ASSERT_TRUE(value.has_value()) << i;
+      EXPECT_EQ(*value, make_value(i, i % 2 == 0 ? 1 : 0)) << i;
+    });
+  }
+
+  db->Get(make_key(kKeys), [](const Status& st,
+                              const std::optional<std::string>& value) {
+    EXPECT_TRUE(st.IsOk()) << st.ToString();
+    EXPECT_FALSE(value.has_value());
+  });
+
+  // Keys that don't fit are rejected instead of being truncated, large
+  // values go to overflow pages
+  db->Put(std::string(4096, 'k'), "value", [](const Status& st, bool) {
+    EXPECT_TRUE(st.IsInvalidArgument()) << st.ToString();
+  });
+  db->Put("key", std::string(1 << 20, 'v'), [](const Status& st, bool) {
+    EXPECT_TRUE(st.IsOk()) << st.ToString();
+  });
+  db->Get("key", [](const Status& st, const std::optional<std::string>& value) {
+    ASSERT_TRUE(st.IsOk()) << st.ToString();
+    EXPECT_EQ(value, std::string(1 << 20, 'v'));
+  });
+
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+}
+
+TEST(DB, LargeValuesInOverflowPages) {
+  constexpr int kDocs = 300;
+  constexpr char const* kPath = "_db_test_overflow.bin";
+
+  // Documents of 4-64KB and a few larger ones next to small metadata
+  const auto make_doc = [](int i, int version) {
+    const size_t size = i % 50 == 0 ? 200 << 10 : (4 << 10) + (i * 211 % 60000);
+    return std::string(size, static_cast<char>('a' + ((i + version) % 26)));
+  };
+  const auto doc_key = [](int i) { return std::format("doc:{:04}", i); };
+  const auto meta_key = [](int i) { return std::format("doc:{:04}:meta", i); };
+
+  for (const bool copy_on_write : {false, true}) {
+    std::error_code rc;
+    std::filesystem::remove(kPath, rc);
+    std::filesystem::remove(std::string(kPath) + ".wal", rc);
+
+    const Options options{.copy_on_write = copy_on_write};
+    std::shared_ptr<DB> db;
+    auto status = DB::Open(kPath, options, &db);
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    for (int i = 0; i < kDocs; ++i) {
+      db->Put(doc_key(i), make_doc(i, 0),
+              [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+      db->Put(meta_key(i), std::to_string(i),
+              [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+    }
+    status = db->Sync();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+    const auto filled_size = std::filesystem::file_size(kPath);
+
+    // Rewrites free the old chains, a value may move into the leaf and back
+    for (int version = 1; version <= 3; ++version) {
+      for (int i = 0; i < kDocs; ++i) {
+        db->Put(doc_key(i), i % 7 == version ? "inline" : make_doc(i, version),
+                [](const Status& st, bool rewritten) {
+                  EXPECT_TRUE(st.IsOk()) << st.ToString();
+                  EXPECT_TRUE(rewritten);
+                });
+      }
+      status = db->Sync();
+      ASSERT_TRUE(status.IsOk()) << status.ToString();
+    }
+    // The copy-on-write mode keeps the chains of the last commit meanwhile
+    EXPECT_LE(std::filesystem::file_size(kPath), filled_size * 2);
+
+    for (int i = 0; i < kDocs; i += 3) {
+      db->Delete(doc_key(i), [](const Status& st, bool found) {
+        EXPECT_TRUE(st.IsOk()) << st.ToString();
+        EXPECT_TRUE(found);
+      });
+    }
+
+    const auto expected = [&](int i) -> std::optional<std::string> {
+      if (i % 3 == 0) {
+        return std::nullopt;
+      }
+      return i % 7 == 3 ? "inline" : make_doc(i, 3);
+    };
+
+    // The free pages of the copy-on-write mode are found again on open
+    for (int pass = 0; pass < 2; ++pass) {
+      for (int i = 0; i < kDocs; ++i) {
+        db->Get(doc_key(i), [&, i](const Status& st,
+                                   const std::optional<std::string>& value) {
+          ASSERT_TRUE(st.IsOk()) << st.ToString();
+          EXPECT_EQ(value, expected(i)) << i;
+        });
+      }
+
+      auto it = db->NewIterator();
+      int docs = 0;
+      for (status = it->SeekToLast(); status.IsOk() && it->Valid();
+           status = it->Prev()) {
+        if (!it->key().starts_with("doc:")) {
+          continue;
+        }
+        const int i = std::stoi(std::string(it->key().substr(4, 4)));
+        if (it->key().ends_with(":meta")) {
+          EXPECT_EQ(it->value(), std::to_string(i));
+          continue;
+        }
+        EXPECT_EQ(it->value(), expected(i)) << i;
+        docs += 1;
+      }
+      ASSERT_TRUE(status.IsOk()) << status.ToString();
+      EXPECT_EQ(docs, kDocs - ((kDocs + 2) / 3));
+      it.reset();
+
+      status = db->Close();
+      ASSERT_TRUE(status.IsOk()) << status.ToString();
+      status = DB::Open(kPath, options, &db);
+      ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+      // New chains must not take the pages of the existing ones
+      db->Put("blob", make_doc(1, pass),
+              [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+    }
+
+    status = db->Close();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+  }
+}
+
+TEST(DB, FailedOverflowChainFreesItsPages) {
+  constexpr char const* kPath = "_db_test_failed_chain.bin";
+  constexpr size_t kPageSize = 64 << 10;
+
+  for (const auto* suffix : {"", ".wal", ".journal"}) {
+    std::filesystem::remove(std::string(kPath) + suffix);
+  }
+
+  // The values of a page each, the later one takes the page after the other
+  std::shared_ptr<DB> db;
+  auto status = DB::Open(kPath, {}, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  db->Put("a", std::string(5000, 'a'),
+          [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+  db->Put("b", std::string(5000, 'b'),
+          [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+  status = db->Sync();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  // The page of "a" heads the free list, the last page of the file follows
+  db->Delete("b", [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+  db->Delete("a", [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  const auto file_size = std::filesystem::file_size(kPath);
+
+  status = DB::Open(kPath, {}, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  // The second page of a chain can't be read
+  std::string last_page(kPageSize, '\0');
+  {
+    std::ifstream in(kPath, std::ios::binary);
+    in.seekg(static_cast<std::streamoff>(file_size - kPageSize));
+    in.read(last_page.data(), static_cast<std::streamsize>(kPageSize));
+    ASSERT_TRUE(in.good());
+  }
+  std::filesystem::resize_file(kPath, file_size - kPageSize);
+
+  const std::string value(2 * kPageSize, 'c');
+  db->Put("c", value,
+          [](const Status& st, bool) { EXPECT_FALSE(st.IsOk()); });
+
+  // Once the page is back, the chain takes both free pages again
+  {
+    std::ofstream out(kPath, std::ios::binary | std::ios::app);
+    out.write(last_page.data(), static_cast<std::streamsize>(kPageSize));
+    ASSERT_TRUE(out.good());
+  }
+  db->Put("c", std::string(kPageSize, 'c'),
+          [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+  status = db->Sync();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  EXPECT_EQ(std::filesystem::file_size(kPath), file_size);
+
+  db->Get("c", [](const Status& st, const std::optional<std::string>& found) {
+    ASSERT_TRUE(st.IsOk()) << st.ToString();
+    EXPECT_EQ(found, std::string(kPageSize, 'c'));
+  });
+
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+}
+
+TEST(DB, ValuesInValueLog) {
+  constexpr int kKeys = 200;
+  constexpr char const* kPath = "_db_test_value_log.bin";
+  const std::string segment_prefix = std::string(kPath) + ".vlog.";
+
+  const auto segments = [&] {
+    std::vector<std::string> names;
+    for (const auto& file : std::filesystem::directory_iterator(".")) {
+      const auto name = file.path().filename().string();
+      if (name.starts_with(segment_prefix)) {
+        names.push_back(name);
+      }
+    }
+    std::ranges::sort(names);
+    return names;
+  };
+
+  // Every tenth value is small enough to stay in the leaf
+  const auto make_value = [](int i, int version) {
+    const size_t size = i % 10 == 0 ? 50 : 1000 + (i * 37 % 500);
+    return std::string(size, static_cast<char>('a' + ((i + version) % 26)));
+  };
+  const auto make_key = [](int i) { return std::format("key:{:04}", i); };
+
+  for (const bool copy_on_write : {false, true}) {
+    std::error_code rc;
+    std::filesystem::remove(kPath, rc);
+    std::filesystem::remove(std::string(kPath) + ".wal", rc);
+    for (const auto& name : segments()) {
+      std::filesystem::remove(name, rc);
+    }
+
+    const Options options{.value_log = true,
+                          .value_log_threshold = 100,
+                          .value_log_segment_size = 64 << 10,
+                          .copy_on_write = copy_on_write};
+    std::shared_ptr<DB> db;
+    auto status = DB::Open(kPath, options, &db);
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+    EXPECT_TRUE(segments().empty());
+
+    // Every round overwrites all values, so the old segments are garbage
+    constexpr int kVersions = 5;
+    for (int version = 0; version < kVersions; ++version) {
+      for (int i = 0; i < kKeys; ++i) {
+        db->Put(make_key(i), make_value(i, version),
+                [](const Status& st, bool) {
+                  EXPECT_TRUE(st.IsOk()) << st.ToString();
+                });
+      }
+      status = db->Sync();
+      ASSERT_TRUE(status.IsOk()) << status.ToString();
+    }
+
+    // The garbage of the overwritten values is kept by the commits
+    status = db->Close();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+    status = DB::Open(kPath, options, &db);
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    for (int i = 0; i < kKeys; i += 3) {
+      db->Delete(make_key(i), [](const Status& st, bool found) {
+        EXPECT_TRUE(st.IsOk()) << st.ToString();
+        EXPECT_TRUE(found);
+      });
+    }
+
+    // A checkpoint collects a single segment, the live values are moved
+    for (int i = 0; i < 20; ++i) {
+      status = db->Sync();
+      ASSERT_TRUE(status.IsOk()) << status.ToString();
+    }
+    ASSERT_FALSE(segments().empty());
+    EXPECT_NE(segments().front(), segment_prefix + "000000");
+    EXPECT_LE(segments().size(), 6);
+
+    const auto expected = [&](int i) -> std::optional<std::string> {
+      if (i % 3 == 0) {
+        return std::nullopt;
+      }
+      return make_value(i, kVersions - 1);
+    };
+
+    for (int pass = 0; pass < 2; ++pass) {
+      for (int i = 0; i < kKeys; ++i) {
+        db->Get(make_key(i), [&, i](const Status& st,
+                                    const std::optional<std::string>& value) {
+          ASSERT_TRUE(st.IsOk()) << st.ToString();
+          EXPECT_EQ(value, expected(i)) << i;
+        });
+      }
+
+      auto it = db->NewIterator();
+      int count = 0;
+      for (status = it->SeekToFirst(); status.IsOk() && it->Valid();
+           status = it->Next()) {
+        const int i = std::stoi(std::string(it->key().substr(4)));
+        EXPECT_EQ(it->value(), expected(i)) << i;
+        count += 1;
+      }
+      ASSERT_TRUE(status.IsOk()) << status.ToString();
+      EXPECT_EQ(count, kKeys - ((kKeys + 2) / 3));
+      it.reset();
+
+      // The collected segments stay removed after reopening
+      status = db->Close();
+      ASSERT_TRUE(status.IsOk()) << status.ToString();
+      status = DB::Open(kPath, options, &db);
+      ASSERT_TRUE(status.IsOk()) << status.ToString();
+    }
+
+    status = db->Close();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+  }
+}
+
+TEST(DB, CompressedPages) {
+  constexpr int kKeys = 20000;
+  constexpr char const* kPath = "_db_test_compressed.bin";
+  constexpr char const* kRawPath = "_db_test_uncompressed.bin";
+
+  const auto make_key = [](int i) { return std::format("key-{:06}", i); };
+  const auto make_value = [](int i) {
+    return std::format("value-{:06}-{}", i, std::string(100, 'a' + (i % 3)));
+  };
+
+  // The same data written with and without compression
+  std::array<uint64_t, 2> written{};
+  std::array<int64_t, 2> allocated{};
+  for (const bool compressed : {true, false}) {
+    const char* path = compressed ? kPath : kRawPath;
+    std::filesystem::remove(path);
+    std::filesystem::remove(std::string(path) + ".wal");
+
+    std::shared_ptr<DB> db;
+    Options options;
+    if (compressed) {
+      options.compression = NewLzCodec();
+    }
+    auto status = DB::Open(path, options, &db);
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    for (int i = 0; i < kKeys; ++i) {
+      db->Put(make_key(i), make_value(i),
+              [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+    }
+    status = db->Sync();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+    written[compressed ? 0 : 1] = db->GetStatistics().page_bytes_written;
+
+    status = db->Close();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    struct stat file_stat {};
+    ASSERT_EQ(stat(path, &file_stat), 0);
+    allocated[compressed ? 0 : 1] = file_stat.st_blocks;
+  }
+  EXPECT_GT(written[0], 0);
+  EXPECT_LT(written[0] * 2, written[1]);
+
+  // The pages keep their slots, but the tails of the slots take no storage
+  EXPECT_LT(allocated[0] * 2, allocated[1]);
+
+  // The datafile is opened with the codec it's written with only
+  {
+    std::shared_ptr<DB> db;
+    auto status = DB::Open(kPath, {}, &db);
+    EXPECT_TRUE(status.IsInvalidArgument()) << status.ToString();
+  }
+
+  {
+    Options options;
+    options.compression = NewLzCodec();
+    options.cache_size = 0;  // the pages are read again and again
+
+    std::shared_ptr<DB> db;
+    auto status = DB::Open(kPath, options, &db);
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    for (int i = 0; i < kKeys; ++i) {
+      db->Get(make_key(i), [&](const Status& st,
+                               const std::optional<std::string>& value) {
+        ASSERT_TRUE(st.IsOk()) << st.ToString();
+        EXPECT_EQ(value, make_value(i)) << i;
+      });
+    }
+    EXPECT_GT(db->GetStatistics().page_bytes_read, 0);
+
+    status = db->Close();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+  }
+
+  // A damaged extent of a tree page is reported, never decoded into garbage
+  {
+    std::fstream file(kPath, std::ios::in | std::ios::out | std::ios::binary);
+    for (std::streamoff page = 2; page < 8; ++page) {
+      file.seekp((page << 16) + 100);
+      file.write("garbage", 7);
+    }
+  }
+
+  Options options;
+  options.compression = NewLzCodec();
+  options.cache_size = 0;
+
+  std::shared_ptr<DB> db;
+  auto status = DB::Open(kPath, options, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  int corrupted = 0;
+  for (int i = 0; i < kKeys; ++i) {
+    db->Get(make_key(i),
+            [&](const Status& st, const std::optional<std::string>& value) {
+              if (st.IsOk()) {
+                EXPECT_EQ(value, make_value(i)) << i;
+              } else {
+                EXPECT_TRUE(st.IsCorruptedDatafile()) << st.ToString();
+                corrupted += 1;
+              }
+            });
+  }
+  EXPECT_GT(corrupted, 0);
+
+  status = db->Close();
+  EXPECT_TRUE(status.IsOk()) << status.ToString();
+}
+
+TEST(DB, MappedDatafile) {
+  constexpr int kKeys = 20000;
+  constexpr char const* kPath = "_db_test_mapped.bin";
+
+  const auto make_key = [](int i) { return std::format("key-{:06}", i); };
+  const auto make_value = [](int i, int round) {
+    return std::format("value-{:06}-{}-{}", i, round, std::string(100, 'v'));
+  };
+
+  std::filesystem::remove(kPath);
+  std::filesystem::remove(std::string(kPath) + ".wal");
+
+  // The pages are evicted and mapped again while the datafile grows
+  Options options;
+  options.mmap_reads = true;
+  options.cache_size = 0;
+
+  std::shared_ptr<DB> db;
+  auto status = DB::Open(kPath, options, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  for (int n = 0; n < kKeys; ++n) {
+    const int i = static_cast<int>((n * 7919L) % kKeys);
+    db->Put(make_key(i), make_value(i, 0),
+            [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+  }
+  for (int i = 0; i < kKeys; ++i) {
+    db->Get(make_key(i),
+            [&](const Status& st, const std::optional<std::string>& value) {
+              ASSERT_TRUE(st.IsOk()) << st.ToString();
+              EXPECT_EQ(value, make_value(i, 0)) << i;
+            });
+  }
+
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  // Nothing is read with the system calls, the lookups filling the filter
+  // included
+  options.bloom_filter_size = 32 << 10;
+  status = DB::Open(kPath, options, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  for (int i = 0; i < kKeys; ++i) {
+    db->Get(make_key(i),
+            [&](const Status& st, const std::optional<std::string>& value) {
+              ASSERT_TRUE(st.IsOk()) << st.ToString();
+              EXPECT_EQ(value, make_value(i, 0)) << i;
+            });
+  }
+  {
+    auto it = db->NewIterator();
+    int i = 0;
+    for (status = it->SeekToFirst(); status.IsOk() && it->Valid();
+         status = it->Next()) {
+      ASSERT_EQ(it->key(), make_key(i));
+      i += 1;
+    }
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+    EXPECT_EQ(i, kKeys);
+  }
+  EXPECT_EQ(db->GetStatistics().page_bytes_read, 0);
+
+  // The mapped pages are copied before they are modified
+  for (int i = 0; i < kKeys; i += 3) {
+    db->Put(make_key(i), make_value(i, 1),
+            [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+  }
+  for (int i = 0; i < kKeys; ++i) {
+    db->Get(make_key(i),
+            [&](const Status& st, const std::optional<std::string>& value) {
+              ASSERT_TRUE(st.IsOk()) << st.ToString();
+              EXPECT_EQ(value, make_value(i, i % 3 == 0 ? 1 : 0)) << i;
+            });
+  }
+
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  // The modifications are in the datafile as usual
+  status = DB::Open(kPath, {.cache_size = 0}, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  for (int i = 0; i < kKeys; ++i) {
+    db->Get(make_key(i),
+            [&](const Status& st, const std::optional<std::string>& value) {
+              ASSERT_TRUE(st.IsOk()) << st.ToString();
+              EXPECT_EQ(value, make_value(i, i % 3 == 0 ? 1 : 0)) << i;
+            });
+  }
+  EXPECT_GT(db->GetStatistics().page_bytes_read, 0);
+
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  // A mapped page is used as it's stored
+  options.compression = NewLzCodec();
+  status = DB::Open(kPath, options, &db);
+  EXPECT_TRUE(status.IsInvalidArgument()) << status.ToString();
+}
+
+TEST(DB, BloomFilterAnswersAbsentKeys) {
+  constexpr int kKeys = 20000;
+  constexpr char const* kPath = "_db_test_bloom.bin";
+
+  const auto make_key = [](int i) { return std::format("key-{:06}", i); };
+
+  std::filesystem::remove(kPath);
+  std::filesystem::remove(std::string(kPath) + ".wal");
+
+  Options options;
+  options.cache_size = 0;
+  options.bloom_filter_size = kKeys * 2;  // 16 bits per key
+
+  // The even keys are present, the odd ones are looked up in vain. The
+  // filter is filled by the writes first and by the lookups on reopen then.
+  for (const bool reopen : {false, true}) {
+    std::shared_ptr<DB> db;
+    auto status = DB::Open(kPath, options, &db);
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    if (!reopen) {
+      for (int i = 0; i < 2 * kKeys; i += 2) {
+        db->Put(make_key(i), std::string(100, 'v'),
+                [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+      }
+      status = db->Sync();
+      ASSERT_TRUE(status.IsOk()) << status.ToString();
+    }
+
+    const auto before = db->GetStatistics();
+    for (int i = 1; i < 2 * kKeys; i += 2) {
+      db->Get(make_key(i), [&](const Status& st,
+                               const std::optional<std::string>& value) {
+        ASSERT_TRUE(st.IsOk()) << st.ToString();
+        EXPECT_FALSE(value.has_value()) << i;
+      });
+    }
+    const auto after = db->GetStatistics();
+    EXPECT_GT(after.filtered_lookups - before.filtered_lookups,
+              kKeys * 95 / 100)
+        << reopen;
+
+    // No false negatives
+    for (int i = 0; i < 2 * kKeys; i += 2) {
+      db->Get(make_key(i), [&](const Status& st,
+                               const std::optional<std::string>& value) {
+        ASSERT_TRUE(st.IsOk()) << st.ToString();
+        EXPECT_TRUE(value.has_value()) << i;
+      });
+    }
+    EXPECT_EQ(db->GetStatistics().filtered_lookups, after.filtered_lookups);
+
+    status = db->Close();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+  }
+}
+
+TEST(DB, PrefixCompressedKeys) {
+  constexpr int kRows = 6000;
+  constexpr char const* kPath = "_db_test_prefix.bin";
+
+  // Keys of a tenant share a long prefix, the tenants inserted after the
+  // first one break the prefixes of the nodes at the ends of the tree
+  const std::string table(100, 't');
+  const auto make_key = [&table](int tenant, int row) {
+    return std::format("tenant-{:04}:{}:row-{:08}", tenant, table, row);
+  };
+
+  std::error_code rc;
+  std::filesystem::remove(kPath, rc);
+  std::filesystem::remove(std::string(kPath) + ".wal", rc);
+
+  std::shared_ptr<DB> db;
+  auto status = DB::Open(kPath, {}, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  std::vector<std::string> keys;
+  for (const int tenant : {1, 0, 2}) {
+    for (int row = 0; row < kRows; ++row) {
+      keys.push_back(make_key(tenant, row));
+      db->Put(keys.back(), std::to_string(row),
+              [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+    }
+  }
+
+  // The keys are stored once per node without their common prefix
+  status = db->Sync();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  EXPECT_LT(std::filesystem::file_size(kPath),
+            keys.size() * keys.front().size());
+
+  // Merges and borrowing recompute the prefixes of the nodes
+  for (int row = 0; row < kRows; ++row) {
+    db->Delete(make_key(0, row),
+               [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+    if (row % 3 != 0) {
+      db->Delete(make_key(1, row),
+                 [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+    }
+  }
+  std::erase_if(keys, [&](const std::string& key) {
+    return key.starts_with(make_key(0, 0).substr(0, 12)) ||
+           (key.starts_with(make_key(1, 0).substr(0, 12)) &&
+            std::stoi(key.substr(key.size() - 8)) % 3 != 0);
+  });
+  std::ranges::sort(keys);
+
+  for (int pass = 0; pass < 2; ++pass) {
+    auto it = db->NewIterator();
+    size_t index = 0;
+    for (status = it->SeekToFirst(); status.IsOk() && it->Valid();
+         status = it->Next()) {
+      ASSERT_LT(index, keys.size());
+      ASSERT_EQ(it->key(), keys[index]);
+      EXPECT_EQ(it->value(), std::to_string(std::stoi(keys[index].substr(
+                                 keys[index].size() - 8))));
+      index += 1;
+    }
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+    EXPECT_EQ(index, keys.size());
+    it.reset();
+
+    db->Get(make_key(0, 7), [](const Status& st,
+                               const std::optional<std::string>& value) {
+      EXPECT_TRUE(st.IsOk()) << st.ToString();
+      EXPECT_FALSE(value.has_value());
+    });
+    db->Get(make_key(2, 7), [](const Status& st,
+                               const std::optional<std::string>& value) {
+      ASSERT_TRUE(st.IsOk()) << st.ToString();
+      EXPECT_EQ(value, "7");
+    });
+
+    status = db->Close();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+    if (pass == 0) {
+      status = DB::Open(kPath, {}, &db);
+      ASSERT_TRUE(status.IsOk()) << status.ToString();
+    }
+  }
+}
+
+TEST(DB, BulkLoadBuildsFullLeaves) {
+  constexpr int kKeys = 50000;
+  constexpr char const* kPath = "_db_test_bulk.bin";
+  constexpr char const* kPutPath = "_db_test_bulk_put.bin";
+
+  const auto make_key = [](int i) { return std::format("key-{:07}", i); };
+  const auto make_value = [](int i) {
+    // Every 10000th value takes an overflow chain
+    return i % 10000 == 0
+               ? std::string(10000, 'o')
+               : std::format("value-{}-{}", i, std::string(100, 'v'));
+  };
+
+  // The same entries loaded in bulk and put one by one in the descending
+  // order, which leaves the split leaves half full
+  std::array<int64_t, 2> sizes{};
+  for (const bool bulk : {true, false}) {
+    const char* path = bulk ? kPath : kPutPath;
+    std::filesystem::remove(path);
+    std::filesystem::remove(std::string(path) + ".wal");
+
+    std::shared_ptr<DB> db;
+    auto status = DB::Open(path, {}, &db);
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    if (bulk) {
+      int i = 0;
+      std::string key;
+      std::string value;
+      status = db->BulkLoad(
+          [&](std::string_view* key_ptr, std::string_view* value_ptr) {
+            if (i == kKeys) {
+              return false;
+            }
+            key = make_key(i);
+            value = make_value(i);
+            *key_ptr = key;
+            *value_ptr = value;
+            i += 1;
+            return true;
+          });
+      ASSERT_TRUE(status.IsOk()) << status.ToString();
+    } else {
+      for (int i = kKeys - 1; i >= 0; --i) {
+        db->Put(make_key(i), make_value(i),
+                [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+      }
+    }
+
+    status = db->Close();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+    sizes[bulk ? 0 : 1] =
+        static_cast<int64_t>(std::filesystem::file_size(path));
+  }
+  EXPECT_LT(sizes[0] * 10, sizes[1] * 8);
+
+  std::shared_ptr<DB> db;
+  auto status = DB::Open(kPath, {.cache_size = 0}, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  for (int i = 0; i < kKeys; ++i) {
+    db->Get(make_key(i),
+            [&](const Status& st, const std::optional<std::string>& value) {
+              ASSERT_TRUE(st.IsOk()) << st.ToString();
+              EXPECT_EQ(value, make_value(i)) << i;
+            });
+  }
+
+  // The leaves are linked both ways
+  {
+    auto it = db->NewIterator();
+    int i = kKeys;
+    for (status = it->SeekToLast(); status.IsOk() && it->Valid();
+         status = it->Prev()) {
+      i -= 1;
+      ASSERT_EQ(it->key(), make_key(i));
+    }
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+    EXPECT_EQ(i, 0);
+  }
+
+  // A loaded tree is modified as any other
+  for (int i = 0; i < kKeys; i += 2) {
+    db->Delete(make_key(i),
+               [](const Status& st, bool found) {
+                 EXPECT_TRUE(st.IsOk());
+                 EXPECT_TRUE(found);
+               });
+  }
+  db->Put("key-", "first", [](const Status& st, bool) {
+    EXPECT_TRUE(st.IsOk());
+  });
+  db->Get("key-0000001",
+          [&](const Status& st, const std::optional<std::string>& value) {
+            ASSERT_TRUE(st.IsOk()) << st.ToString();
+            EXPECT_EQ(value, make_value(1));
+          });
+
+  // Only an empty database is loaded
+  status = db->BulkLoad([](std::string_view*, std::string_view*) {
+    return false;
+  });
+  EXPECT_TRUE(status.IsInvalidArgument()) << status.ToString();
+
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  // Unordered input fails the load and leaves the database empty
+  std::filesystem::remove(kPath);
+  std::filesystem::remove(std::string(kPath) + ".wal");
+  status = DB::Open(kPath, {}, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  int i = 0;
+  std::string key;
+  status = db->BulkLoad([&](std::string_view* key_ptr,
+                            std::string_view* value_ptr) {
+    key = make_key(i < kKeys ? i : 0);
+    *key_ptr = key;
+    *value_ptr = key;
+    return i++ <= kKeys;
+  });
+  EXPECT_TRUE(status.IsInvalidArgument()) << status.ToString();
+
+  auto it = db->NewIterator();
+  status = it->SeekToFirst();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+  EXPECT_FALSE(it->Valid());
+  it.reset();
+
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+}
+
+TEST(DB, BulkLoadReplacesEmptiedTree) {
+  constexpr int kKeys = 1000;
+  constexpr char const* kPath = "_db_test_bulk_emptied.bin";
+
+  const auto make_key = [](int i) { return std::format("key-{:07}", i); };
+
+  // The loaded tree takes the place of the empty leaf left by the deletes
+  for (const bool copy_on_write : {false, true}) {
+    for (const auto* suffix : {"", ".wal", ".journal"}) {
+      std::filesystem::remove(std::string(kPath) + suffix);
+    }
+
+    std::shared_ptr<DB> db;
+    auto status = DB::Open(kPath, {.copy_on_write = copy_on_write}, &db);
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    for (int i = 0; i < kKeys; ++i) {
+      db->Put(make_key(i), std::string(200, 'p'),
+              [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+    }
+
+    // A database with entries isn't loaded
+    status = db->BulkLoad([](std::string_view*, std::string_view*) {
+      return false;
+    });
+    EXPECT_TRUE(status.IsInvalidArgument()) << status.ToString();
+
+    for (int i = 0; i < kKeys; ++i) {
+      db->Delete(make_key(i),
+                 [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+    }
+
+    int i = 0;
+    std::string key;
+    status = db->BulkLoad(
+        [&](std::string_view* key_ptr, std::string_view* value_ptr) {
+          if (i == kKeys) {
+            return false;
+          }
+          key = make_key(i++);
+          *key_ptr = key;
+          *value_ptr = key;
+          return true;
+        });
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    status = db->Close();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    status = DB::Open(kPath, {.copy_on_write = copy_on_write}, &db);
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    auto it = db->NewIterator();
+    int count = 0;
+    for (status = it->SeekToFirst(); status.IsOk() && it->Valid();
+         status = it->Next()) {
+      EXPECT_EQ(it->key(), make_key(count));
+      EXPECT_EQ(it->value(), make_key(count));
+      ++count;
+    }
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+    EXPECT_EQ(count, kKeys);
+    it.reset();
+
+    status = db->Close();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+  }
+}
+
+TEST(DB, AppendsFillSplitPages) {
+  constexpr int kKeys = 50000;
+  constexpr char const* kPath = "_db_test_append.bin";
+
+  const auto make_key = [](int i) { return std::format("key-{:07}", i); };
+  const auto make_value = [](int i) {
+    return std::format("value-{}-{}", i, std::string(100, 'v'));
+  };
+
+  // The ascending keys are appended, the descending ones split the pages in
+  // halves. The copy-on-write mode shadows the cached path after each commit.
+  std::array<int64_t, 2> sizes{};
+  for (const bool ascending : {true, false}) {
+    std::filesystem::remove(kPath);
+    std::filesystem::remove(std::string(kPath) + ".wal");
+
+    std::shared_ptr<DB> db;
+    auto status = DB::Open(kPath,
+                           {.wal_checkpoint_size = 1 << 20,
+                            .copy_on_write = ascending},
+                           &db);
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    for (int n = 0; n < kKeys; ++n) {
+      const int i = ascending ? n : kKeys - 1 - n;
+      db->Put(make_key(i), make_value(i),
+              [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+
+      // The readers see the modifications of the cached path
+      if (n % 1000 == 0) {
+        db->Get(make_key(i), [&](const Status& st,
+                                 const std::optional<std::string>& value) {
+          ASSERT_TRUE(st.IsOk()) << st.ToString();
+          EXPECT_EQ(value, make_value(i));
+        });
+      }
+    }
+
+    if (ascending) {
+      for (int i = 0; i < kKeys; ++i) {
+        db->Get(make_key(i), [&](const Status& st,
+                                 const std::optional<std::string>& value) {
+          ASSERT_TRUE(st.IsOk()) << st.ToString();
+          EXPECT_EQ(value, make_value(i)) << i;
+        });
+      }
+
+      auto it = db->NewIterator();
+      int i = 0;
+      for (status = it->SeekToFirst(); status.IsOk() && it->Valid();
+           status = it->Next()) {
+        ASSERT_EQ(it->key(), make_key(i));
+        i += 1;
+      }
+      ASSERT_TRUE(status.IsOk()) << status.ToString();
+      EXPECT_EQ(i, kKeys);
+    }
+
+    status = db->Close();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+    sizes[ascending ? 0 : 1] =
+        static_cast<int64_t>(std::filesystem::file_size(kPath));
+  }
+  EXPECT_LT(sizes[0] * 10, sizes[1] * 7);
+
+  // The appended tree is modified as any other, the deletes rebalance the
+  // full pages and reset the cached path
+  std::shared_ptr<DB> db;
+  auto status = DB::Open(kPath, {}, &db);
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+  for (int i = 0; i < kKeys; i += 2) {
+    db->Delete(make_key(i), [](const Status& st, bool found) {
+      EXPECT_TRUE(st.IsOk());
+      EXPECT_TRUE(found);
+    });
+    db->Put(make_key(kKeys + i), make_value(i),
+            [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+  }
+  for (int i = 0; i < kKeys; ++i) {
+    db->Get(make_key(i),
+            [&](const Status& st, const std::optional<std::string>& value) {
+              ASSERT_TRUE(st.IsOk()) << st.ToString();
+              EXPECT_EQ(value, i % 2 == 0 ? std::nullopt
+                                          : std::optional(make_value(i)))
+                  << i;
+            });
+    db->Get(make_key(kKeys + i),
+            [&](const Status& st, const std::optional<std::string>& value) {
+              ASSERT_TRUE(st.IsOk()) << st.ToString();
+              EXPECT_EQ(value, i % 2 == 0 ? std::optional(make_value(i))
+                                          : std::nullopt)
+                  << i;
+            });
+  }
+
+  status = db->Close();
+  ASSERT_TRUE(status.IsOk()) << status.ToString();
+}
+
+TEST(DB, ConcurrentReadersAndWriters) {
+  constexpr int kKeys = 4000;
+  constexpr int kWriters = 2;
+  constexpr int kReaders = 4;
+  constexpr int kRounds = 3;
+  constexpr char const* kPath = "_db_test_concurrent.bin";
+
+  // Every value names its key, so a torn read shows up as a mismatch. Every
+  // tenth value is in overflow pages.
+  const auto make_key = [](int i) { return std::format("key-{:05}", i); };
+  const auto make_value = [](std::string_view key, int round) {
+    return std::format("{}:{}:{}", key, round,
+                       std::string(key.ends_with('0') ? 300 : 200, 'v'));
+  };
+  const auto matches = [](std::string_view key, std::string_view value) {
+    return value.starts_with(key) && value.size() > key.size() &&
+           value[key.size()] == ':';
+  };
+
+  for (const bool copy_on_write : {false, true}) {
+    std::filesystem::remove(kPath);
+    std::filesystem::remove(std::string(kPath) + ".wal");
+
+    // Small checkpoints commit the tree while the readers descend it
+    std::shared_ptr<DB> db;
+    const Options options{.cache_size = 4 << 20,
+                          .wal_checkpoint_size = 1 << 20,
+                          .max_inline_value = 256,
+                          .copy_on_write = copy_on_write};
+    auto status = DB::Open(kPath, options, &db);
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+
+    for (int i = 0; i < kKeys; ++i) {
+      db->Put(make_key(i), make_value(make_key(i), 0),
+              [](const Status& st, bool) { EXPECT_TRUE(st.IsOk()); });
+    }
+
+    std::atomic<int> writing = kWriters;
+    std::atomic<int> errors = 0;
+    std::vector<std::thread> threads;
+
+    // The writers split the keys, every round rewrites a key or deletes it
+    for (int w = 0; w < kWriters; ++w) {
+      threads.emplace_back([&, w] {
+        for (int round = 1; round <= kRounds; ++round) {
+          for (int i = w; i < kKeys; i += kWriters) {
+            const auto key = make_key(i);
+            const auto check = [&](const Status& st, bool) {
+              errors += st.IsOk() ? 0 : 1;
+            };
+            if ((i + round) % 5 == 0) {
+              db->Delete(key, check);
+            } else {
+              db->Put(key, make_value(key, round), check);
+            }
+          }
+        }
+        writing -= 1;
+      });
+    }
+
+    for (int r = 0; r < kReaders; ++r) {
+      threads.emplace_back([&, r] {
+        for (int pass = 0; writing > 0 || pass < 2; ++pass) {
+          for (int i = r; i < kKeys; i += 7) {
+            const auto key = make_key(i);
+            db->Get(key, [&](const Status& st,
+                             const std::optional<std::string>& value) {
+              errors += st.IsOk() && (!value || matches(key, *value)) ? 0 : 1;
+            });
+          }
+
+          // The keys of a scan grow even while the leaves are split
+          auto it = db->NewIterator();
+          std::string prev;
+          auto st = it->SeekToFirst();
+          for (; st.IsOk() && it->Valid(); st = it->Next()) {
+            errors += it->key() > prev && matches(it->key(), it->value()) ? 0
+                                                                          : 1;
+            prev = it->key();
+          }
+          errors += st.IsOk() ? 0 : 1;
+        }
+      });
+    }
+
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    EXPECT_EQ(errors, 0);
+
+    for (int i = 0; i < kKeys; ++i) {
+      const auto key = make_key(i);
+      db->Get(key, [&](const Status& st,
+                       const std::optional<std::string>& value) {
+        ASSERT_TRUE(st.IsOk()) << st.ToString();
+        if ((i + kRounds) % 5 == 0) {
+          EXPECT_FALSE(value.has_value()) << key;
+        } else {
+          EXPECT_EQ(value, make_value(key, kRounds)) << key;
+        }
+      });
+    }
+
+    status = db->Close();
+    ASSERT_TRUE(status.IsOk()) << status.ToString();
+  }
+}
 // NOLINTEND(*-function-cognitive-complexity)
 
 }  // namespace NIMBLEDB_NAMESPACE
@@ -0,0 +1,224 @@
+// Copyright 2025 Nikolay Govorov. All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at LICENSE file in the root.
+
+#include "src/journal.h"
+
+#include <sys/types.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "nimbledb/base.h"
+#include "nimbledb/system.h"
+#include "src/crc32c.h"
+
+namespace NIMBLEDB_NAMESPACE {
+
+namespace {
+
+struct RecordHeader {
+  uint32_t checksum;
+  uint32_t reserved;
+  int64_t page_id;
+  uint64_t sequence;
+};
+
+// The checksum must not cover padding bytes
+static_assert(sizeof(RecordHeader) == 24);
+
+}  // namespace
+
+// static
+Status Journal::Open(OS* os, std::string_view filename, File* datafile,
+                     size_t page_size, std::unique_ptr<Journal>* journal_ptr) {
+  std::unique_ptr<File> file;
+  const File::Flags flags{.read = true, .write = true, .creat = true};
+  if (auto st = os->OpenDatafile(filename, flags, &file); !st.IsOk()) {
+    return st;
+  }
+
+  int64_t size;
+  if (auto st = file->GetFileSize(&size); !st.IsOk()) {
+    return st;
+  }
+
+  auto* journal = new (std::nothrow)
+      Journal(os, std::move(file), datafile, page_size, size);
+  if (journal == nullptr) {
+    return Status::NoMemory();
+  }
+  journal_ptr->reset(journal);
+
+  return Status::Ok();
+}
+
+Status Journal::Rollback(uint64_t sequence) {
+  if (offset_ == 0) {
+    return Status::Ok();
+  }
+
+  std::vector<std::byte> journal(static_cast<size_t>(offset_));
+  if (auto st = os_->Await([&](const Callback<>& callback) {
+        file_->Read(journal, 0, callback);
+      });
+      !st.IsOk()) {
+    return st;
+  }
+
+  const size_t record_size = sizeof(RecordHeader) + page_size_;
+  bool restored = false;
+  for (size_t pos = 0; pos + record_size <= journal.size();
+       pos += record_size) {
+    const auto record = std::span(journal).subspan(pos, record_size);
+
+    RecordHeader header;
+    std::memcpy(&header, record.data(), sizeof(RecordHeader));
+    if (Crc32c(record.subspan(sizeof(header.checksum))) != header.checksum) {
+      break;  // the last save was interrupted
+    }
+    if (header.sequence != sequence) {
+      continue;
+    }
+
+    const auto image = record.subspan(sizeof(RecordHeader));
+    const auto offset =
+        static_cast<off_t>(header.page_id * static_cast<PageId>(page_size_));
+    if (auto st = os_->Await([&](const Callback<>& callback) {
+          datafile_->Write(image, offset, callback);
+        });
+        !st.IsOk()) {
+      return st;
+    }
+    restored = true;
+  }
+
+  if (!restored) {
+    return Status::Ok();
+  }
+  return os_->Await([&](const Callback<>& callback) {
+    datafile_->Sync(File::SyncMode::kDataOnly, callback);
+  });
+}
+
+Status Journal::Reset(uint64_t sequence, PageId pages) {
+  // A record surviving a lost truncation restores an earlier commit or this
+  // one as it is, so the truncation isn't synced
+  if (offset_ > 0) {
+    if (auto st = os_->Await([&](const Callback<>& callback) {
+          file_->Truncate(0, callback);
+        });
+        !st.IsOk()) {
+      return st;
+    }
+  }
+
+  offset_ = 0;
+  sequence_ = sequence;
+  pages_ = pages;
+  saved_.clear();
+  return Status::Ok();
+}
+
+Status Journal::Save(std::span<const PageId> ids) {
+  const std::lock_guard lock(mutex_);
+
+  std::vector<PageId> fresh;
+  for (const PageId id : ids) {
+    if (id < pages_ && !saved_.contains(id)) {
+      fresh.push_back(id);
+    }
+  }
+  if (fresh.empty()) {
+    return Status::Ok();
+  }
+
+  // A compressed page may end before its slot does, the rest reads as zeros
+  int64_t file_size;
+  if (auto st = datafile_->GetFileSize(&file_size); !st.IsOk()) {
+    return st;
+  }
+
+  const size_t record_size = sizeof(RecordHeader) + page_size_;
+  std::vector<std::byte> records(fresh.size() * record_size);
+
+  // The slots are read concurrently, the completions may be reaped by other
+  // threads
+  std::atomic<size_t> pending = 0;
+  std::vector<std::optional<Status>> results(fresh.size());
+  for (size_t i = 0; i < fresh.size(); ++i) {
+    const int64_t offset = fresh[i] * static_cast<PageId>(page_size_);
+    const auto size = static_cast<size_t>(std::clamp<int64_t>(
+        file_size - offset, 0, static_cast<int64_t>(page_size_)));
+    if (size == 0) {
+      continue;
+    }
+
+    pending.fetch_add(1, std::memory_order_relaxed);
+    const auto image =
+        std::span(records).subspan(i * record_size + sizeof(RecordHeader));
+    datafile_->Read(image.first(size), static_cast<off_t>(offset),
+                    [&pending, &results, i](const Status& st) {
+                      results[i] = st;
+                      pending.fetch_sub(1, std::memory_order_release);
+                    });
+  }
+
+  while (pending.load(std::memory_order_acquire) > 0) {
+    if (auto st = os_->Wait(); !st.IsOk()) {
+      return st;
+    }
+  }
+  for (const auto& result : results) {
+    if (result.has_value() && !result->IsOk()) {
+      return *result;
+    }
+  }
+
+  for (size_t i = 0; i < fresh.size(); ++i) {
+    const auto record = std::span(records).subspan(i * record_size,
+                                                   record_size);
+    const RecordHeader header{.checksum = 0,
+                              .reserved = 0,
+                              .page_id = fresh[i],
+                              .sequence = sequence_};
+    std::memcpy(record.data(), &header, sizeof(RecordHeader));
+
+    const uint32_t checksum = Crc32c(record.subspan(sizeof(header.checksum)));
+    std::memcpy(record.data(), &checksum, sizeof(checksum));
+  }
+
+  // The images must be durable before any of the pages is overwritten
+  auto st = os_->Await([&](const Callback<>& callback) {
+    file_->Write(records, static_cast<off_t>(offset_), callback);
+  });
+  if (!st.IsOk()) {
+    return st;
+  }
+
+  st = os_->Await([&](const Callback<>& callback) {
+    file_->Sync(File::SyncMode::kDataOnly, callback);
+  });
+  if (!st.IsOk()) {
+    return st;
+  }
+
+  offset_ += static_cast<int64_t>(records.size());
+  saved_.insert(fresh.begin(), fresh.end());
+  return Status::Ok();
+}
+
+Status Journal::Close() { return file_->Close(); }
+
+}  // namespace NIMBLEDB_NAMESPACE
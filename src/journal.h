@@ -0,0 +1,94 @@
+// Copyright 2025 Nikolay Govorov. All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at LICENSE file in the root.
+
+#ifndef NIMBLEDB_JOURNAL_H_
+#define NIMBLEDB_JOURNAL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <unordered_set>
+
+#include "nimbledb/base.h"
+#include "nimbledb/system.h"
+
+namespace NIMBLEDB_NAMESPACE {
+
+// Rollback journal of the pages overwritten in place.
+//
+// Without copy-on-write a modified page is written back to its own slot, by
+// an eviction at any time or by the flush of a checkpoint before the meta
+// page. Before a committed page is overwritten the first time, its slot is
+// copied to the journal and made durable. After a crash the journal restores
+// the datafile to the last commit, the write-ahead log is replayed over it if
+// there is one.
+//
+// Record layout: | crc32c | page id | sequence | image |, the checksum covers
+// everything after itself and the image is the raw slot of the page size. The
+// records are tagged with the sequence of the commit they restore, so those
+// left from an earlier commit are ignored. A torn record at the end of the
+// journal is ignored too, its page hasn't been overwritten yet.
+//
+// The saves may be made by any thread writing pages back and are serialized
+// by a mutex, the other methods must not run concurrently with them.
+class Journal {
+ public:
+  using PageId = int64_t;
+
+  // The journal saves the pages of `datafile`
+  static Status Open(OS* os, std::string_view filename, File* datafile,
+                     size_t page_size, std::unique_ptr<Journal>* journal_ptr);
+
+  ~Journal() = default;
+
+  Journal(const Journal&) = delete;
+  Journal(Journal&&) = delete;
+  Journal& operator=(const Journal&) = delete;
+  Journal& operator=(Journal&&) = delete;
+
+  // Writes the saved images of the commit `sequence` back to the datafile
+  // and makes them durable
+  Status Rollback(uint64_t sequence);
+
+  // Empties the journal for the commit `sequence` of `pages` pages, the pages
+  // past them aren't part of the commit and aren't saved
+  Status Reset(uint64_t sequence, PageId pages);
+
+  // Saves the committed images of the pages about to be written back, which
+  // weren't saved since the last reset
+  Status Save(std::span<const PageId> ids);
+
+  Status Close();
+
+ private:
+  Journal(OS* os, std::unique_ptr<File> file, File* datafile,
+          size_t page_size, int64_t size)
+      : os_(os),
+        file_(std::move(file)),
+        datafile_(datafile),
+        page_size_(page_size),
+        offset_(size) {}
+
+  OS* os_ = nullptr;
+  std::unique_ptr<File> file_;
+  File* datafile_ = nullptr;
+
+  const size_t page_size_;
+
+  std::mutex mutex_;
+
+  // The end of the journal
+  int64_t offset_ = 0;
+
+  uint64_t sequence_ = 0;
+  PageId pages_ = 0;
+  std::unordered_set<PageId> saved_;
+};
+
+}  // namespace NIMBLEDB_NAMESPACE
+
+#endif  // NIMBLEDB_JOURNAL_H_
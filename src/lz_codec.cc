@@ -0,0 +1,246 @@
+// Copyright 2025 Nikolay Govorov. All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at LICENSE file in the root.
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include "nimbledb/base.h"
+#include "nimbledb/codec.h"
+
+namespace NIMBLEDB_NAMESPACE {
+
+namespace {
+
+// The input is a sequence of (literals, match) pairs:
+//
+//   | token | literals size... | literals | offset | match size... |
+//
+// The high nibble of the token is the number of literals, the low one is the
+// match length minus kMinMatch. A nibble of 15 is continued by bytes added to
+// it until one is less than 255. The match copies the output `offset` bytes
+// back (2 bytes, little-endian), it may overlap the bytes it produces. The
+// last pair has no match and ends the input.
+constexpr size_t kMinMatch = 4;
+constexpr size_t kMaxOffset = 0xffff;
+constexpr unsigned kNibble = 15;
+
+// The last match starts at least 12 bytes before the end and the last 5 bytes
+// are always literals
+constexpr size_t kMatchLimit = 12;
+constexpr size_t kLastLiterals = 5;
+
+constexpr size_t kHashBits = 12;
+
+uint32_t Load32(const std::byte* ptr) {
+  uint32_t value;
+  std::memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+size_t Hash(uint32_t sequence) {
+  return (sequence * 2654435761U) >> (32 - kHashBits);
+}
+
+// The bytes encoding a length continued past its nibble
+size_t LengthBytes(size_t length) {
+  return length < kNibble ? 0 : ((length - kNibble) / 255) + 1;
+}
+
+std::byte* PutLength(std::byte* out, size_t length) {
+  if (length < kNibble) {
+    return out;
+  }
+  length -= kNibble;
+  for (; length >= 255; length -= 255) {
+    *out++ = std::byte{255};
+  }
+  *out++ = static_cast<std::byte>(length);
+  return out;
+}
+
+class LzCodec final : public Codec {
+ public:
+  [[nodiscard]] uint32_t id() const override { return 1; }
+
+  size_t Compress(ROBuffer input, RWBuffer output) const override;
+  bool Decompress(ROBuffer input, RWBuffer output) const override;
+
+ private:
+  // Appends a pair, a zero `match` ends the input. Returns false if the pair
+  // doesn't fit the output.
+  static bool PutSequence(ROBuffer literals, size_t offset, size_t match,
+                          RWBuffer output, size_t* out);
+};
+
+size_t LzCodec::Compress(ROBuffer input, RWBuffer output) const {
+  const std::byte* in = input.data();
+  const size_t size = input.size();
+
+  size_t out = 0;
+  size_t anchor = 0;
+
+  // The input positions by the hash of their first bytes, a stale position
+  // fails the comparison
+  std::array<uint32_t, size_t{1} << kHashBits> table{};
+
+  if (size > kMatchLimit) {
+    const size_t limit = size - kMatchLimit;
+    const size_t match_end = size - kLastLiterals;
+
+    size_t pos = 0;
+    while (pos < limit) {
+      const uint32_t sequence = Load32(in + pos);
+      auto& slot = table[Hash(sequence)];
+      const size_t candidate = slot;
+      slot = static_cast<uint32_t>(pos);
+
+      if (candidate >= pos || pos - candidate > kMaxOffset ||
+          Load32(in + candidate) != sequence) {
+        // The step grows over the incompressible data
+        pos += 1 + ((pos - anchor) >> 6U);
+        continue;
+      }
+
+      // Extend the match backward over the pending literals and forward
+      size_t start = pos;
+      size_t from = candidate;
+      while (start > anchor && from > 0 && in[start - 1] == in[from - 1]) {
+        --start;
+        --from;
+      }
+      size_t end = pos + kMinMatch;
+      while (end < match_end && in[end] == in[from + (end - start)]) {
+        ++end;
+      }
+
+      if (!PutSequence(input.subspan(anchor, start - anchor), start - from,
+                       end - start, output, &out)) {
+        return 0;
+      }
+
+      anchor = end;
+      pos = end;
+      if (pos - 2 < limit) {
+        table[Hash(Load32(in + pos - 2))] = static_cast<uint32_t>(pos - 2);
+      }
+    }
+  }
+
+  if (!PutSequence(input.subspan(anchor), 0, 0, output, &out)) {
+    return 0;
+  }
+  return out;
+}
+
+bool LzCodec::Decompress(ROBuffer input, RWBuffer output) const {
+  const std::byte* in = input.data();
+  std::byte* dst = output.data();
+
+  size_t ip = 0;
+  size_t op = 0;
+  const auto read_length = [&](size_t length) {
+    if (length < kNibble) {
+      return length;
+    }
+    for (;;) {
+      if (ip >= input.size()) {
+        return SIZE_MAX;
+      }
+      const auto byte = static_cast<size_t>(in[ip++]);
+      length += byte;
+      if (byte < 255) {
+        return length;
+      }
+    }
+  };
+
+  for (;;) {
+    if (ip >= input.size()) {
+      return false;
+    }
+    const auto token = static_cast<unsigned>(in[ip++]);
+
+    const size_t literals = read_length(token >> 4U);
+    if (literals > input.size() - ip || literals > output.size() - op) {
+      return false;
+    }
+    if (literals > 0) {
+      std::memcpy(dst + op, in + ip, literals);
+    }
+    ip += literals;
+    op += literals;
+
+    if (ip == input.size()) {
+      return op == output.size();
+    }
+
+    if (input.size() - ip < 2) {
+      return false;
+    }
+    const size_t offset = static_cast<size_t>(in[ip]) |
+                          (static_cast<size_t>(in[ip + 1]) << 8U);
+    ip += 2;
+    if (offset == 0 || offset > op) {
+      return false;
+    }
+
+    const size_t match = read_length(token & kNibble);
+    if (match == SIZE_MAX || match + kMinMatch > output.size() - op) {
+      return false;
+    }
+
+    // An overlapping match repeats the bytes it produces
+    const std::byte* from = dst + op - offset;
+    if (offset >= match + kMinMatch) {
+      std::memcpy(dst + op, from, match + kMinMatch);
+    } else {
+      for (size_t i = 0; i < match + kMinMatch; ++i) {
+        dst[op + i] = from[i];
+      }
+    }
+    op += match + kMinMatch;
+  }
+}
+
+// static
+bool LzCodec::PutSequence(ROBuffer literals, size_t offset, size_t match,
+                          RWBuffer output, size_t* out) {
+  const size_t match_length = match == 0 ? 0 : match - kMinMatch;
+  const size_t needed = 1 + LengthBytes(literals.size()) + literals.size() +
+                        (match == 0 ? 0 : 2 + LengthBytes(match_length));
+  if (needed > output.size() - *out) {
+    return false;
+  }
+
+  std::byte* ptr = output.data() + *out;
+  *ptr++ = static_cast<std::byte>(
+      (std::min<size_t>(literals.size(), kNibble) << 4U) |
+      std::min<size_t>(match_length, kNibble));
+  ptr = PutLength(ptr, literals.size());
+  if (!literals.empty()) {
+    std::memcpy(ptr, literals.data(), literals.size());
+  }
+  ptr += literals.size();
+
+  if (match != 0) {
+    *ptr++ = static_cast<std::byte>(offset & 0xffU);
+    *ptr++ = static_cast<std::byte>(offset >> 8U);
+    ptr = PutLength(ptr, match_length);
+  }
+
+  *out = static_cast<size_t>(ptr - output.data());
+  return true;
+}
+
+}  // namespace
+
+std::shared_ptr<const Codec> NewLzCodec() {
+  return std::make_shared<const LzCodec>();
+}
+
+}  // namespace NIMBLEDB_NAMESPACE
@@ -7,18 +7,25 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 
+#include <atomic>
 #include <cassert>
+#include <cerrno>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <new>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <tuple>
 #include <utility>
+#include <vector>
 
 #include "nimbledb/base.h"
 
@@ -30,10 +37,16 @@
   // https://learn.microsoft.com/en-us/cpp/error-messages/compiler-warnings/compiler-warning-level-3-c4996
   #pragma warning(disable : 4996)
 #else
+  #include <sys/mman.h>
   #include <sys/types.h>
   #include <unistd.h>
 #endif
 
+#if defined(NIMBLEDB_OS_LINUX)
+  #include <linux/falloc.h>
+  #include <liburing.h>
+#endif
+
 namespace NIMBLEDB_NAMESPACE {
 
 int File::Flags::GetMask() const {
@@ -96,10 +109,65 @@ Status File::GetFileSize(int64_t* size) const {
   return Status::Ok();
 }
 
-Status File::Close() {
-  closed_ = true;
+Status File::Map(size_t size,
+                 std::unique_ptr<MappedRegion>* region_ptr) const {
+  assert(!closed_);
+
+#if defined(NIMBLEDB_OS_WINDOWS)
+  return Status::IOError("couldn't map file", "not supported");
+#else
+  void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd_, 0);
+  if (data == MAP_FAILED) {
+    return Status::IOError("couldn't map file", Status::ErrnoToString());
+  }
+
+  const auto* bytes = static_cast<const std::byte*>(data);
+  region_ptr->reset(new (std::nothrow) MappedRegion(bytes, size));
+  if (*region_ptr == nullptr) {
+    munmap(data, size);
+    return Status::NoMemory();
+  }
+  return Status::Ok();
+#endif
+}
+
+MappedRegion::~MappedRegion() {
+#if !defined(NIMBLEDB_OS_WINDOWS)
+  // NOLINTNEXTLINE(*-const-cast)
+  munmap(const_cast<std::byte*>(data_), size_);
+#endif
+}
+
+Status MappedRegion::Advise(Access access) const {
+#if defined(NIMBLEDB_OS_WINDOWS)
+  (void)access;
+  return Status::Ok();
+#else
+  int advice = MADV_NORMAL;
+  switch (access) {
+    case Access::kNormal:
+      break;
+    case Access::kRandom:
+      advice = MADV_RANDOM;
+      break;
+    case Access::kSequential:
+      advice = MADV_SEQUENTIAL;
+      break;
+  }
 
+  // NOLINTNEXTLINE(*-const-cast)
+  if (madvise(const_cast<std::byte*>(data_), size_, advice) != 0) {
+    return Status::IOError("couldn't advise file mapping",
+                           Status::ErrnoToString());
+  }
+  return Status::Ok();
+#endif
+}
+
+Status File::Close() {
   if (!closed_) {
+    closed_ = true;
+
     if (const int rc = close(fd_); rc != 0) {
       return Status::IOError("couldn't close file", Status::ErrnoToString());
     }
@@ -108,125 +176,489 @@ Status File::Close() {
   return Status::Ok();
 }
 
+struct OS::Request {
+  enum class Op : uint8_t { kRead, kWrite, kSync, kTruncate, kPunchHole };
+
+  Op op;
+  int fd;
+
+  std::byte* data = nullptr;
+  size_t size = 0;
+  int64_t offset = 0;
+
+  File::SyncMode mode = File::SyncMode::kNormal;
+
+  Callback<> callback;
+  Request* next = nullptr;
+};
+
 void File::Read(RWBuffer buffer, off_t offset,
                 const Callback<>& callback) const {
   assert(!closed_);
 
-  auto new_offset = lseek(fd_, offset, SEEK_SET);
-  if (new_offset < 0) {
-    callback(Status::IOError("couldn't lseek to file position",
-                             Status::ErrnoToString()));
+  auto* req = new (std::nothrow) OS::Request{.op = OS::Request::Op::kRead,
+                                             .fd = fd_,
+                                             .data = buffer.data(),
+                                             .size = buffer.size(),
+                                             .offset = offset,
+                                             .callback = callback};
+  if (req == nullptr) {
+    callback(Status::NoMemory());
     return;
   }
 
-  auto bytes = read(fd_, buffer.data(), buffer.size());
-  if (bytes < 0) {
-    callback(
-        Status::IOError("couldn't read from file", Status::ErrnoToString()));
-    return;
-  }
+  os_->Submit(req);
+}
+
+void File::Write(ROBuffer buffer, off_t offset,
+                 const Callback<>& callback) const {
+  assert(!closed_);
 
-  if (static_cast<size_t>(bytes) != buffer.size()) {
-    callback(Status::IOError("couldn't read all data"));
+  // The buffer is never written through, the request type is shared with reads
+  auto* data = const_cast<std::byte*>(buffer.data());
+
+  auto* req = new (std::nothrow) OS::Request{.op = OS::Request::Op::kWrite,
+                                             .fd = fd_,
+                                             .data = data,
+                                             .size = buffer.size(),
+                                             .offset = offset,
+                                             .callback = callback};
+  if (req == nullptr) {
+    callback(Status::NoMemory());
     return;
   }
 
-  callback(Status::Ok());
+  os_->Submit(req);
 }
 
-void File::Write(ROBuffer buffer, off_t offset,
-                 const Callback<>& callback) const {
+// The sync starts only after all previously queued operations of the OS have
+// completed, so it acts as a write barrier.
+void File::Sync(SyncMode mode, const Callback<>& callback) const {
   assert(!closed_);
 
-  auto new_offset = lseek(fd_, offset, SEEK_SET);
-  if (new_offset < 0) {
-    callback(Status::IOError("couldn't lseek to file position",
-                             Status::ErrnoToString()));
+  auto* req = new (std::nothrow) OS::Request{.op = OS::Request::Op::kSync,
+                                             .fd = fd_,
+                                             .mode = mode,
+                                             .callback = callback};
+  if (req == nullptr) {
+    callback(Status::NoMemory());
     return;
   }
 
-  auto bytes = write(fd_, buffer.data(), buffer.size());
-  if (bytes < 0) {
-    callback(
-        Status::IOError("couldn't write to file", Status::ErrnoToString()));
+  os_->Submit(req);
+}
+
+void File::Truncate(int64_t size, const Callback<>& callback) const {
+  assert(!closed_);
+
+  auto* req = new (std::nothrow)
+      OS::Request{.op = OS::Request::Op::kTruncate,
+                  .fd = fd_,
+                  .size = static_cast<size_t>(size),
+                  .callback = callback};
+  if (req == nullptr) {
+    callback(Status::NoMemory());
     return;
   }
 
-  if (static_cast<size_t>(bytes) != buffer.size()) {
-    callback(Status::IOError("couldn't write all data"));
+  os_->Submit(req);
+}
+
+void File::PunchHole(int64_t offset, int64_t size,
+                     const Callback<>& callback) const {
+  assert(!closed_);
+
+  auto* req = new (std::nothrow)
+      OS::Request{.op = OS::Request::Op::kPunchHole,
+                  .fd = fd_,
+                  .size = static_cast<size_t>(size),
+                  .offset = offset,
+                  .callback = callback};
+  if (req == nullptr) {
+    callback(Status::NoMemory());
     return;
   }
 
-  callback(Status::Ok());
+  os_->Submit(req);
 }
 
-void File::Sync(SyncMode mode, const Callback<>& callback) const {
-  assert(!closed_);
+// static
+int64_t OS::Execute(const Request& req) {
+  switch (req.op) {
+    case Request::Op::kRead: {
+      if (lseek(req.fd, req.offset, SEEK_SET) < 0) {
+        return -errno;
+      }
+
+      auto bytes = read(req.fd, req.data, File::BufferLimit(req.size));
+      return bytes < 0 ? -errno : bytes;
+    }
+
+    case Request::Op::kWrite: {
+      if (lseek(req.fd, req.offset, SEEK_SET) < 0) {
+        return -errno;
+      }
+
+      auto bytes = write(req.fd, req.data, File::BufferLimit(req.size));
+      return bytes < 0 ? -errno : bytes;
+    }
+
+    case Request::Op::kTruncate: {
+#if defined(NIMBLEDB_OS_WINDOWS)
+      const int rc = _chsize_s(req.fd, static_cast<int64_t>(req.size));
+#else
+      const int rc = ftruncate(req.fd, static_cast<off_t>(req.size));
+#endif
+      return rc < 0 ? -errno : 0;
+    }
+
+    case Request::Op::kPunchHole: {
+#if defined(NIMBLEDB_OS_LINUX)
+      const int rc =
+          fallocate(req.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                    req.offset, static_cast<off_t>(req.size));
+      return rc < 0 ? -errno : 0;
+#else
+      return 0;
+#endif
+    }
+
+    case Request::Op::kSync:
+      break;
+  }
 
   int rc = -1;
-  switch (mode) {
-    case SyncMode::kFull:
+  switch (req.mode) {
+    case File::SyncMode::kFull:
 #ifdef F_FULLFSYNC
       // If the FULLFSYNC failed, fall back to attempting an fsync().
       // It shouldn't be possible for fullfsync to fail on the local
       // file system (on OSX), so failure indicates that FULLFSYNC
       // isn't supported for this file system. So, attempt an fsync
       // and (for now) ignore the overhead of a superfluous fcntl call.
-      if (fcntl(fd_, F_FULLFSYNC, 0) == 0) {
+      if (fcntl(req.fd, F_FULLFSYNC, 0) == 0) {
+        rc = 0;
         break;
       }
       [[fallthrough]];
 #endif
 
-    case SyncMode::kNormal:
+    case File::SyncMode::kNormal:
 #if defined(NIMBLEDB_OS_WINDOWS)
-      rc = _commit(fd_);
+      rc = _commit(req.fd);
 #else
-      rc = fsync(fd_);
+      rc = fsync(req.fd);
 #endif
       break;
 
-    case SyncMode::kDataOnly:
+    case File::SyncMode::kDataOnly:
 #if defined(NIMBLEDB_OS_DARWIN)
       // fdatasync() on HFS+ doesn't yet flush the file size if it changed
       // correctly so currently we default to the macro that redefines fdatasync
       // to fsync
-      rc = fsync(fd_);
+      rc = fsync(req.fd);
 #elif defined(NIMBLEDB_OS_WINDOWS)
       // It would be better to use FLUSH_FLAGS_FILE_DATA_SYNC_ONLY for this
-      rc = _commit(fd_);
+      rc = _commit(req.fd);
 #else
-      rc = fdatasync(fd_);
+      rc = fdatasync(req.fd);
 #endif
       break;
   }
 
-  if (rc < 0) {
-    callback(Status::IOError("couldn't fsync file", Status::ErrnoToString()));
-    return;
-  }
-
-  callback(Status::Ok());
+  return rc < 0 ? -errno : 0;
 }
 
 // static
-Status OS::Create(std::unique_ptr<OS>* ioptr) {
-  OS* ptr = new (std::nothrow) OS;
+Status OS::Create(std::unique_ptr<OS>* ioptr, unsigned queue_depth) {
+  OS* ptr = new (std::nothrow) OS(queue_depth);
   if (ptr == nullptr) {
     return Status::NoMemory();
   }
 
   ioptr->reset(ptr);
-  return Status::Ok();
+  return ptr->Init();
 }
 
-OS::OS() = default;
+OS::OS(unsigned queue_depth) : queue_depth_(queue_depth) {}
+
 OS::~OS() {
   if (!closed_) {
     std::ignore = Close().state();
   }
 }
 
+Status OS::Init() {
+#if defined(NIMBLEDB_OS_LINUX)
+  ring_.reset(new (std::nothrow) io_uring{});
+  if (ring_ == nullptr) {
+    return Status::NoMemory();
+  }
+
+  if (const int rc = io_uring_queue_init(queue_depth_, ring_.get(), 0);
+      rc < 0) {
+    ring_.reset();
+    return Status::IOError("couldn't setup io_uring",
+                           Status::ErrnoToString(-rc));
+  }
+#endif
+
+  return Status::Ok();
+}
+
+Status OS::Close() {
+  if (closed_) {
+    return Status::Ok();
+  }
+
+  while (pending_ > 0) {
+    if (auto st = Wait(); !st.IsOk()) {
+      return st;
+    }
+  }
+
+  closed_ = true;
+
+#if defined(NIMBLEDB_OS_LINUX)
+  if (ring_ != nullptr) {
+    io_uring_queue_exit(ring_.get());
+    ring_.reset();
+  }
+#endif
+
+  return Status::Ok();
+}
+
+Status OS::Tick() { return Reap(false); }
+
+Status OS::Wait() { return Reap(true); }
+
+Status OS::Await(FunctionRef<void(const Callback<>&)> submit) {
+  // The completion may be reaped by another thread
+  std::atomic<bool> done = false;
+  std::optional<Status> result;
+  submit([&done, &result](const Status& st) {
+    result = st;
+    done.store(true, std::memory_order_release);
+  });
+
+  while (!done.load(std::memory_order_acquire)) {
+    if (auto st = Wait(); !st.IsOk()) {
+      return st;
+    }
+  }
+
+  return *result;
+}
+
+void OS::Submit(Request* req) {
+  assert(!closed_);
+
+  const std::lock_guard lock(mutex_);
+  if (queue_tail_ == nullptr) {
+    queue_head_ = req;
+  } else {
+    queue_tail_->next = req;
+  }
+  queue_tail_ = req;
+
+  pending_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void OS::Complete(Request* req, int64_t result) {
+  // The file system may not support the holes, the range is kept then
+  if (req->op == Request::Op::kPunchHole && result == -EOPNOTSUPP) {
+    result = 0;
+  }
+
+  const bool transfer =
+      req->op == Request::Op::kRead || req->op == Request::Op::kWrite;
+
+  if (transfer && result > 0 && std::cmp_less(result, req->size)) {
+    // Short transfer, queue the rest of the buffer again
+    req->data += result;
+    req->size -= static_cast<size_t>(result);
+    req->offset += result;
+    req->next = nullptr;
+
+    Submit(req);
+    pending_.fetch_sub(1, std::memory_order_relaxed);
+    return;
+  }
+
+  Status status = Status::Ok();
+  if (result < 0) {
+    auto err = Status::ErrnoToString(static_cast<int>(-result));
+    switch (req->op) {
+      case Request::Op::kRead:
+        status = Status::IOError("couldn't read from file", err);
+        break;
+      case Request::Op::kWrite:
+        status = Status::IOError("couldn't write to file", err);
+        break;
+      case Request::Op::kSync:
+        status = Status::IOError("couldn't fsync file", err);
+        break;
+      case Request::Op::kTruncate:
+        status = Status::IOError("couldn't truncate file", err);
+        break;
+      case Request::Op::kPunchHole:
+        status = Status::IOError("couldn't punch a hole in file", err);
+        break;
+    }
+  } else if (transfer && result == 0 && req->size > 0) {
+    status = Status::IOError(req->op == Request::Op::kRead
+                                 ? "couldn't read all data"
+                                 : "couldn't write all data");
+  }
+
+  req->callback(status);
+  delete req;
+
+  // The request is counted until its callback returns, so the threads seeing
+  // no pending requests also see the effects of all callbacks
+  pending_.fetch_sub(1, std::memory_order_release);
+}
+
+Status OS::Reap(bool wait) {
+  assert(!closed_);
+
+  if (Pending() == 0) {
+    return Status::Ok();
+  }
+
+  // The callbacks run without the lock, they may queue new requests
+  std::vector<Completion> completed;
+  Status st;
+  {
+    const std::lock_guard lock(mutex_);
+    st = Poll(wait, &completed);
+  }
+
+  for (const auto& [req, result] : completed) {
+    Complete(req, result);
+  }
+
+  // The other requests are being completed by another thread
+  if (wait && completed.empty()) {
+    std::this_thread::yield();
+  }
+  return st;
+}
+
+#if defined(NIMBLEDB_OS_LINUX)
+
+Status OS::Poll(bool wait, std::vector<Completion>* completed) {
+  // Move the queued requests into the submission queue. The kernel ring is
+  // never overcommitted, so the completion queue can't overflow.
+  while (queue_head_ != nullptr && inflight_ < queue_depth_) {
+    Request* req = queue_head_;
+
+    if (req->op == Request::Op::kTruncate) {
+      // There is no portable ftruncate opcode before Linux 6.9, execute it
+      // in place once everything queued before it has finished
+      if (inflight_ > 0) {
+        break;
+      }
+
+      queue_head_ = req->next;
+      if (queue_head_ == nullptr) {
+        queue_tail_ = nullptr;
+      }
+
+      completed->emplace_back(req, Execute(*req));
+      continue;
+    }
+
+    io_uring_sqe* sqe = io_uring_get_sqe(ring_.get());
+    if (sqe == nullptr) {
+      break;  // retry on the next tick
+    }
+
+    queue_head_ = req->next;
+    if (queue_head_ == nullptr) {
+      queue_tail_ = nullptr;
+    }
+
+    switch (req->op) {
+      case Request::Op::kRead:
+        io_uring_prep_read(sqe, req->fd, req->data,
+                           File::BufferLimit(req->size), req->offset);
+        break;
+
+      case Request::Op::kWrite:
+        io_uring_prep_write(sqe, req->fd, req->data,
+                            File::BufferLimit(req->size), req->offset);
+        break;
+
+      case Request::Op::kSync:
+        io_uring_prep_fsync(sqe, req->fd,
+                            req->mode == File::SyncMode::kDataOnly
+                                ? IORING_FSYNC_DATASYNC
+                                : 0);
+        io_uring_sqe_set_flags(sqe, IOSQE_IO_DRAIN);
+        break;
+
+      case Request::Op::kPunchHole:
+        io_uring_prep_fallocate(sqe, req->fd,
+                                FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                                req->offset, req->size);
+        break;
+
+      case Request::Op::kTruncate:
+        assert(false);
+        break;
+    }
+
+    io_uring_sqe_set_data(sqe, req);
+    inflight_ += 1;
+  }
+
+  if (inflight_ == 0) {
+    return Status::Ok();
+  }
+
+  const int rc = wait ? io_uring_submit_and_wait(ring_.get(), 1)
+                      : io_uring_submit(ring_.get());
+  if (rc < 0 && rc != -EINTR && rc != -EAGAIN && rc != -EBUSY) {
+    return Status::IOError("couldn't submit to io_uring",
+                           Status::ErrnoToString(-rc));
+  }
+
+  io_uring_cqe* cqe = nullptr;
+  while (io_uring_peek_cqe(ring_.get(), &cqe) == 0) {
+    auto* req = static_cast<Request*>(io_uring_cqe_get_data(cqe));
+    const int64_t result = cqe->res;
+    io_uring_cqe_seen(ring_.get(), cqe);
+
+    inflight_ -= 1;
+    completed->emplace_back(req, result);
+  }
+
+  return Status::Ok();
+}
+
+#else
+
+Status OS::Poll(bool /*wait*/, std::vector<Completion>* completed) {
+  // The requests are executed under the lock, the blocking calls seek the
+  // shared file descriptors
+  while (queue_head_ != nullptr) {
+    Request* req = queue_head_;
+
+    queue_head_ = req->next;
+    if (queue_head_ == nullptr) {
+      queue_tail_ = nullptr;
+    }
+
+    completed->emplace_back(req, Execute(*req));
+  }
+
+  return Status::Ok();
+}
+
+#endif  // NIMBLEDB_OS_LINUX
+
 Status OS::OpenDatafile(std::string_view file_path, File::Flags flags,
                         std::unique_ptr<File>* file_ptr) {
   const int fd = open(std::string(file_path).c_str(), flags.GetMask(), 0644);
@@ -244,7 +676,19 @@ Status OS::OpenDatafile(std::string_view file_path, File::Flags flags,
   }
 #endif
 
-  *file_ptr = std::make_unique<File>(file_path, fd);
+  *file_ptr = std::make_unique<File>(this, file_path, fd);
+  return Status::Ok();
+}
+
+bool OS::FileExists(std::string_view file_path) const {
+  struct stat st{};
+  return stat(std::string(file_path).c_str(), &st) == 0;
+}
+
+Status OS::RemoveFile(std::string_view file_path) {
+  if (std::remove(std::string(file_path).c_str()) != 0) {
+    return Status::IOError("couldn't remove file", Status::ErrnoToString());
+  }
   return Status::Ok();
 }
 
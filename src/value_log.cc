@@ -0,0 +1,404 @@
+// Copyright 2025 Nikolay Govorov. All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at LICENSE file in the root.
+
+#include "src/value_log.h"
+
+#include <sys/types.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "nimbledb/base.h"
+#include "nimbledb/system.h"
+#include "src/crc32c.h"
+
+namespace NIMBLEDB_NAMESPACE {
+
+namespace {
+
+struct RecordHeader {
+  uint32_t checksum;
+  uint32_t key_size;
+  uint32_t value_size;
+};
+
+// The checksum must not cover padding bytes
+static_assert(sizeof(RecordHeader) == 12);
+
+std::span<const std::byte> AsBytes(std::string_view str) {
+  return std::as_bytes(std::span(str.data(), str.size()));
+}
+
+// Returns the key and the value of the record at the beginning of `data`,
+// fails if the record is torn or damaged
+bool ParseRecord(std::span<const std::byte> data, std::string_view* key,
+                 std::string_view* value, size_t* size) {
+  RecordHeader header;
+  if (data.size() < sizeof(RecordHeader)) {
+    return false;
+  }
+  std::memcpy(&header, data.data(), sizeof(RecordHeader));
+
+  *size = sizeof(RecordHeader) + size_t{header.key_size} + header.value_size;
+  if (*size > data.size()) {
+    return false;
+  }
+
+  const auto record = data.first(*size);
+  if (Crc32c(record.subspan(sizeof(header.checksum))) != header.checksum) {
+    return false;
+  }
+
+  const auto* bytes = reinterpret_cast<const char*>(
+      record.subspan(sizeof(RecordHeader)).data());
+  *key = {bytes, header.key_size};
+  *value = {bytes + header.key_size, header.value_size};
+  return true;
+}
+
+}  // namespace
+
+// static
+Status ValueLog::Open(OS* os, std::string_view filename, uint32_t tail,
+                      size_t segment_size, std::unique_ptr<ValueLog>* log_ptr) {
+  auto* log = new (std::nothrow) ValueLog(os, filename, tail, segment_size);
+  if (log == nullptr) {
+    return Status::NoMemory();
+  }
+  log_ptr->reset(log);
+
+  // A collected segment may have outlived its commit
+  if (tail > 0 && os->FileExists(log->SegmentName(tail - 1))) {
+    if (auto st = os->RemoveFile(log->SegmentName(tail - 1)); !st.IsOk()) {
+      return st;
+    }
+  }
+
+  for (uint32_t segment = tail; os->FileExists(log->SegmentName(segment));
+       ++segment) {
+    if (auto st = log->OpenSegment(segment, false); !st.IsOk()) {
+      return st;
+    }
+  }
+
+  // A torn record at the end is never referenced, it's skipped by appending
+  // after it
+  if (!log->segments_.empty()) {
+    log->written_ = log->segments_.rbegin()->second.size;
+  }
+  return Status::Ok();
+}
+
+Status ValueLog::Append(std::string_view key, std::string_view value,
+                        Ref* ref) {
+  const size_t size = sizeof(RecordHeader) + key.size() + value.size();
+
+  if (segments_.empty() ||
+      segments_.rbegin()->second.size + size > segment_size_) {
+    if (auto st = WriteBuffer(); !st.IsOk()) {
+      return st;
+    }
+
+    // An empty segment takes the record whatever its size
+    if (segments_.empty() || segments_.rbegin()->second.size > 0) {
+      const uint32_t next =
+          segments_.empty() ? tail_ : segments_.rbegin()->first + 1;
+      if (auto st = OpenSegment(next, true); !st.IsOk()) {
+        return st;
+      }
+      written_ = 0;
+    }
+  }
+
+  const RecordHeader header{.checksum = 0,
+                            .key_size = static_cast<uint32_t>(key.size()),
+                            .value_size = static_cast<uint32_t>(value.size())};
+
+  {
+    const std::lock_guard lock(mutex_);
+    auto& [number, segment] = *segments_.rbegin();
+
+    const size_t begin = buffer_.size();
+    const auto header_bytes = std::as_bytes(std::span(&header, 1));
+    buffer_.insert(buffer_.end(), header_bytes.begin(), header_bytes.end());
+    buffer_.insert(buffer_.end(), AsBytes(key).begin(), AsBytes(key).end());
+    buffer_.insert(buffer_.end(), AsBytes(value).begin(), AsBytes(value).end());
+
+    const auto record = std::span(buffer_).subspan(begin);
+    const uint32_t checksum = Crc32c(record.subspan(sizeof(header.checksum)));
+    std::memcpy(record.data(), &checksum, sizeof(checksum));
+
+    *ref = {.offset = segment.size,
+            .segment = number,
+            .size = static_cast<uint32_t>(size)};
+    segment.size += size;
+    segment.synced = false;
+  }
+
+  if (buffer_.size() >= kBufferSize) {
+    return WriteBuffer();
+  }
+  return Status::Ok();
+}
+
+Status ValueLog::Read(const Ref& ref, std::string* value) const {
+  std::vector<std::byte> record(ref.size);
+  std::shared_ptr<File> file;
+  {
+    const std::lock_guard lock(mutex_);
+    const auto it = segments_.find(ref.segment);
+    if (it == segments_.end()) {
+      return Status::CorruptedDatafile(
+          "value log segment is missing",
+          std::format("segment {}", ref.segment));
+    }
+
+    if (ref.segment == segments_.rbegin()->first && ref.offset >= written_) {
+      const uint64_t begin = ref.offset - written_;
+      if (begin + ref.size > buffer_.size()) {
+        return Status::CorruptedDatafile(
+            "value log record is out of the segment",
+            std::format("segment {}, offset {}", ref.segment, ref.offset));
+      }
+      std::memcpy(record.data(), buffer_.data() + begin, ref.size);
+    } else {
+      file = it->second.file;
+    }
+  }
+
+  if (file != nullptr) {
+    if (auto st = os_->Await([&](const Callback<>& callback) {
+          file->Read(record, static_cast<off_t>(ref.offset), callback);
+        });
+        !st.IsOk()) {
+      return st;
+    }
+  }
+
+  std::string_view key;
+  std::string_view data;
+  size_t size = 0;
+  if (!ParseRecord(record, &key, &data, &size) || size != ref.size) {
+    return Status::CorruptedDatafile(
+        "value log record is damaged",
+        std::format("segment {}, offset {}", ref.segment, ref.offset));
+  }
+
+  value->assign(data);
+  return Status::Ok();
+}
+
+void ValueLog::AddGarbage(const Ref& ref) {
+  const std::lock_guard lock(mutex_);
+  if (const auto it = segments_.find(ref.segment); it != segments_.end()) {
+    it->second.garbage += ref.size;
+  }
+}
+
+void ValueLog::CountGarbage(const std::map<uint32_t, uint64_t>& live) {
+  const std::lock_guard lock(mutex_);
+  for (auto& [number, segment] : segments_) {
+    const auto it = live.find(number);
+    const uint64_t used = it != live.end() ? it->second : 0;
+    segment.garbage = segment.size - std::min(used, segment.size);
+  }
+}
+
+std::vector<uint64_t> ValueLog::Live() const {
+  const std::lock_guard lock(mutex_);
+  std::vector<uint64_t> live;
+  for (auto it = segments_.lower_bound(tail_); it != segments_.end(); ++it) {
+    live.push_back(it->second.size - it->second.garbage);
+  }
+  return live;
+}
+
+Status ValueLog::ReadCollectable(double ratio, std::vector<Record>* records,
+                                 bool* found) {
+  *found = false;
+  records->clear();
+
+  std::shared_ptr<File> file;
+  uint32_t number = 0;
+  uint64_t size = 0;
+  {
+    const std::lock_guard lock(mutex_);
+    if (segments_.size() < 2) {
+      return Status::Ok();
+    }
+
+    const auto& [tail, segment] = *segments_.begin();
+    if (static_cast<double>(segment.garbage) <
+        ratio * static_cast<double>(segment.size)) {
+      return Status::Ok();
+    }
+    file = segment.file;
+    number = tail;
+    size = segment.size;
+  }
+
+  std::vector<std::byte> data(size);
+  if (auto st = os_->Await([&](const Callback<>& callback) {
+        file->Read(data, 0, callback);
+      });
+      !st.IsOk()) {
+    return st;
+  }
+
+  // A torn record ends the segment, the ones after it were never written
+  for (size_t pos = 0; pos < data.size();) {
+    std::string_view key;
+    std::string_view value;
+    size_t record_size = 0;
+    if (!ParseRecord(std::span(data).subspan(pos), &key, &value,
+                     &record_size)) {
+      break;
+    }
+
+    records->push_back({.key = std::string(key),
+                        .value = std::string(value),
+                        .ref = {.offset = pos,
+                                .segment = number,
+                                .size = static_cast<uint32_t>(record_size)}});
+    pos += record_size;
+  }
+
+  *found = true;
+  return Status::Ok();
+}
+
+void ValueLog::ReleaseTail() {
+  const std::lock_guard lock(mutex_);
+  tail_ += 1;
+}
+
+Status ValueLog::RemoveReleased() {
+  for (;;) {
+    std::string name;
+    {
+      const std::lock_guard lock(mutex_);
+      if (segments_.empty() || segments_.begin()->first >= tail_) {
+        return Status::Ok();
+      }
+
+      // The readers holding the file finish their reads
+      name = SegmentName(segments_.begin()->first);
+      segments_.erase(segments_.begin());
+    }
+
+    if (auto st = os_->RemoveFile(name); !st.IsOk()) {
+      return st;
+    }
+  }
+}
+
+Status ValueLog::Sync() {
+  if (auto st = WriteBuffer(); !st.IsOk()) {
+    return st;
+  }
+
+  std::vector<std::pair<uint32_t, std::shared_ptr<File>>> unsynced;
+  {
+    const std::lock_guard lock(mutex_);
+    for (const auto& [number, segment] : segments_) {
+      if (!segment.synced) {
+        unsynced.emplace_back(number, segment.file);
+      }
+    }
+  }
+
+  for (const auto& [number, file] : unsynced) {
+    if (auto st = os_->Await([&](const Callback<>& callback) {
+          file->Sync(File::SyncMode::kDataOnly, callback);
+        });
+        !st.IsOk()) {
+      return st;
+    }
+
+    const std::lock_guard lock(mutex_);
+    if (const auto it = segments_.find(number); it != segments_.end()) {
+      it->second.synced = true;
+    }
+  }
+  return Status::Ok();
+}
+
+Status ValueLog::Close() {
+  if (auto st = WriteBuffer(); !st.IsOk()) {
+    return st;
+  }
+
+  const std::lock_guard lock(mutex_);
+  for (auto& [number, segment] : segments_) {
+    if (auto st = segment.file->Close(); !st.IsOk()) {
+      return st;
+    }
+  }
+  return Status::Ok();
+}
+
+std::string ValueLog::SegmentName(uint32_t segment) const {
+  return std::format("{}.{:06}", filename_, segment);
+}
+
+Status ValueLog::OpenSegment(uint32_t segment, bool create) {
+  std::unique_ptr<File> file;
+  const File::Flags flags{.read = true, .write = true, .creat = create};
+  if (auto st = os_->OpenDatafile(SegmentName(segment), flags, &file);
+      !st.IsOk()) {
+    return st;
+  }
+
+  int64_t size;
+  if (auto st = file->GetFileSize(&size); !st.IsOk()) {
+    return st;
+  }
+
+  const std::lock_guard lock(mutex_);
+  segments_[segment] = {.file = std::move(file),
+                        .size = static_cast<uint64_t>(size),
+                        .garbage = 0,
+                        .synced = true};
+  return Status::Ok();
+}
+
+Status ValueLog::WriteBuffer() {
+  if (buffer_.empty()) {
+    return Status::Ok();
+  }
+
+  std::shared_ptr<File> file;
+  {
+    const std::lock_guard lock(mutex_);
+    file = segments_.rbegin()->second.file;
+  }
+
+  // Only the appending thread modifies the buffer, the readers copy from it
+  // meanwhile
+  if (auto st = os_->Await([&](const Callback<>& callback) {
+        file->Write(buffer_, static_cast<off_t>(written_), callback);
+      });
+      !st.IsOk()) {
+    return st;
+  }
+
+  const std::lock_guard lock(mutex_);
+  written_ += buffer_.size();
+  buffer_.clear();
+  return Status::Ok();
+}
+
+}  // namespace NIMBLEDB_NAMESPACE
@@ -0,0 +1,170 @@
+// Copyright 2025 Nikolay Govorov. All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at LICENSE file in the root.
+
+#ifndef NIMBLEDB_VALUE_LOG_H_
+#define NIMBLEDB_VALUE_LOG_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "nimbledb/base.h"
+#include "nimbledb/system.h"
+
+namespace NIMBLEDB_NAMESPACE {
+
+// Append-only log of the values kept out of the tree (key-value separation).
+//
+// The log is a sequence of segment files `<filename>.<number>`. Records are
+// appended to the last segment and a new one is started once it grows over
+// the segment size. The leaves keep a reference to the record instead of the
+// value, so the value is written once instead of with every write-back of its
+// leaf.
+//
+// Record layout: | crc32c | key size | value size | key | value |, the
+// checksum covers everything after itself. The key lets the garbage collector
+// find the entry referencing the record: the oldest segment is collected by
+// appending its live values again, then it is removed.
+//
+// Appends, collection and syncs must be serialized by the caller, the reads
+// may run concurrently with them.
+class ValueLog {
+ public:
+  // The location of a record, see Read()
+  struct Ref {
+    uint64_t offset;
+    uint32_t segment;
+    uint32_t size;  // of the whole record
+
+    bool operator==(const Ref&) const = default;
+
+    // The encoding kept in the leaves
+    [[nodiscard]] std::string Encode() const {
+      return {reinterpret_cast<const char*>(this), sizeof(Ref)};
+    }
+    static Ref Decode(std::string_view bytes) {
+      Ref ref{.offset = 0, .segment = 0, .size = 0};
+      std::memcpy(&ref, bytes.data(), std::min(bytes.size(), sizeof(ref)));
+      return ref;
+    }
+  };
+
+  // Encode() copies the bytes, there must be no padding
+  static_assert(sizeof(Ref) == 16);
+
+  struct Record {
+    std::string key;
+    std::string value;
+    Ref ref;
+  };
+
+  // Opens the segments starting from `tail`, the segments before it have
+  // been collected. No file is created until the first append.
+  static Status Open(OS* os, std::string_view filename, uint32_t tail,
+                     size_t segment_size, std::unique_ptr<ValueLog>* log_ptr);
+
+  ~ValueLog() = default;
+
+  ValueLog(const ValueLog&) = delete;
+  ValueLog(ValueLog&&) = delete;
+  ValueLog& operator=(const ValueLog&) = delete;
+  ValueLog& operator=(ValueLog&&) = delete;
+
+  Status Append(std::string_view key, std::string_view value, Ref* ref);
+
+  // Copies the value of the record, the record may be still buffered
+  Status Read(const Ref& ref, std::string* value) const;
+
+  // Accounts a record no longer referenced by the tree
+  void AddGarbage(const Ref& ref);
+
+  // Sets the garbage of every segment to the bytes the tree doesn't
+  // reference, `live` holds the referenced bytes by segment. The bytes
+  // appended after `live` was taken are garbage then.
+  void CountGarbage(const std::map<uint32_t, uint64_t>& live);
+
+  // The bytes referenced by the tree in the segments from the tail, the
+  // commits keep them so the open doesn't recount the garbage
+  [[nodiscard]] std::vector<uint64_t> Live() const;
+
+  // Reads the records of the oldest segment if at least `ratio` of it is
+  // garbage, `found` tells if it is. The last segment is never collected,
+  // it's being appended to.
+  Status ReadCollectable(double ratio, std::vector<Record>* records,
+                         bool* found);
+
+  // Moves the tail past the oldest segment once the tree no longer
+  // references it. The segment stays readable until RemoveReleased().
+  void ReleaseTail();
+
+  // Removes the segments before the tail, the tail must have been committed
+  Status RemoveReleased();
+
+  // Writes the buffered records and makes the segments durable
+  Status Sync();
+
+  Status Close();
+
+  // No segment is in use
+  [[nodiscard]] bool empty() const {
+    const std::lock_guard lock(mutex_);
+    return segments_.empty();
+  }
+
+  // The oldest segment in use
+  [[nodiscard]] uint32_t tail() const {
+    const std::lock_guard lock(mutex_);
+    return tail_;
+  }
+
+ private:
+  // Records are written once the buffer reaches the limit
+  static constexpr size_t kBufferSize = 1 << 20;
+
+  struct Segment {
+    std::shared_ptr<File> file;
+    uint64_t size = 0;  // including the buffered records
+    uint64_t garbage = 0;
+    bool synced = true;
+  };
+
+  ValueLog(OS* os, std::string_view filename, uint32_t tail,
+           size_t segment_size)
+      : os_(os),
+        filename_(filename),
+        segment_size_(segment_size),
+        tail_(tail) {}
+
+  [[nodiscard]] std::string SegmentName(uint32_t segment) const;
+
+  Status OpenSegment(uint32_t segment, bool create);
+
+  // Writes the buffer to the last segment
+  Status WriteBuffer();
+
+  OS* os_ = nullptr;
+  const std::string filename_;
+  const size_t segment_size_;
+
+  // Guards the segments and the buffer shared with the readers
+  mutable std::mutex mutex_;
+
+  uint32_t tail_ = 0;
+  std::map<uint32_t, Segment> segments_;
+
+  // The records of the last segment after `written_` bytes
+  std::vector<std::byte> buffer_;
+  uint64_t written_ = 0;
+};
+
+}  // namespace NIMBLEDB_NAMESPACE
+
+#endif  // NIMBLEDB_VALUE_LOG_H_
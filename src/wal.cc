@@ -0,0 +1,337 @@
+// Copyright 2025 Nikolay Govorov. All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at LICENSE file in the root.
+
+#include "src/wal.h"
+
+#include <sys/types.h>
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "nimbledb/base.h"
+#include "nimbledb/system.h"
+#include "src/crc32c.h"
+
+namespace NIMBLEDB_NAMESPACE {
+
+namespace {
+
+struct RecordHeader {
+  uint32_t checksum;
+  uint32_t value_size;
+  uint64_t lsn;
+  uint16_t key_size;
+  uint8_t type;
+  std::array<uint8_t, 5> reserved;
+};
+
+// The checksum must not cover padding bytes
+static_assert(sizeof(RecordHeader) == 24);
+
+std::span<const std::byte> AsBytes(std::string_view str) {
+  return std::as_bytes(std::span(str.data(), str.size()));
+}
+
+}  // namespace
+
+// static
+Status WriteAheadLog::Open(OS* os, std::string_view filename, bool sync,
+                           std::unique_ptr<WriteAheadLog>* wal_ptr) {
+  std::unique_ptr<File> file;
+  const File::Flags flags{.read = true, .write = true, .creat = true};
+  if (auto st = os->OpenDatafile(filename, flags, &file); !st.IsOk()) {
+    return st;
+  }
+
+  int64_t size;
+  if (auto st = file->GetFileSize(&size); !st.IsOk()) {
+    return st;
+  }
+
+  auto* wal = new (std::nothrow) WriteAheadLog(os, std::move(file), sync, size);
+  if (wal == nullptr) {
+    return Status::NoMemory();
+  }
+  wal_ptr->reset(wal);
+
+  return Status::Ok();
+}
+
+Status WriteAheadLog::Replay(uint64_t lsn, const Apply& apply) {
+  assert(!writing_ && buffer_.empty());
+  next_lsn_ = lsn;
+  if (offset_ == 0) {
+    return Status::Ok();
+  }
+
+  std::vector<std::byte> log(static_cast<size_t>(offset_));
+  if (auto st = os_->Await([&](const Callback<>& callback) {
+        file_->Read(log, 0, callback);
+      });
+      !st.IsOk()) {
+    return st;
+  }
+
+  for (size_t pos = 0; pos + sizeof(RecordHeader) <= log.size();) {
+    RecordHeader header;
+    std::memcpy(&header, log.data() + pos, sizeof(RecordHeader));
+
+    const size_t size =
+        sizeof(RecordHeader) + header.key_size + header.value_size;
+    if (size > log.size() - pos) {
+      break;  // the last write was interrupted
+    }
+
+    const auto record = std::span(log).subspan(pos, size);
+    if (Crc32c(record.subspan(sizeof(header.checksum))) != header.checksum) {
+      break;
+    }
+
+    const auto* data = reinterpret_cast<const char*>(
+        record.subspan(sizeof(RecordHeader)).data());
+    const std::string_view key(data, header.key_size);
+    const std::string_view value(data + header.key_size, header.value_size);
+
+    const auto type = static_cast<RecordType>(header.type);
+    if (type != RecordType::kPut && type != RecordType::kDelete &&
+        type != RecordType::kBatch) {
+      return Status::CorruptedDatafile(
+          "unknown write-ahead log record",
+          std::format("type {} at offset {}", header.type, pos));
+    }
+
+    if (header.lsn >= next_lsn_) {
+      if (auto st = apply(type, key, value); !st.IsOk()) {
+        return st;
+      }
+      next_lsn_ = header.lsn + 1;
+    }
+
+    pos += size;
+  }
+
+  return Status::Ok();
+}
+
+void WriteAheadLog::Append(RecordType type, std::string_view key,
+                           std::string_view value,
+                           const Callback<>& callback) {
+  if (!sync_) {
+    callback(Append(type, key, value));
+    return;
+  }
+
+  std::unique_lock lock(mutex_);
+  if (error_.has_value()) {
+    const Status error = *error_;
+    lock.unlock();
+    callback(error);
+    return;
+  }
+
+  BufferRecord(type, key, value);
+  waiters_.push_back(callback);
+  if (!writing_) {
+    StartWrite();
+  }
+}
+
+Status WriteAheadLog::Append(RecordType type, std::string_view key,
+                             std::string_view value) {
+  assert(!sync_);
+
+  const std::lock_guard lock(mutex_);
+  if (error_.has_value()) {
+    return *error_;
+  }
+
+  BufferRecord(type, key, value);
+  if (!writing_ && buffer_.size() >= kLazyBufferSize) {
+    StartWrite();
+  }
+  return Status::Ok();
+}
+
+void WriteAheadLog::BufferRecord(RecordType type, std::string_view key,
+                                 std::string_view value) {
+  const RecordHeader header{.value_size = static_cast<uint32_t>(value.size()),
+                            .lsn = next_lsn_++,
+                            .key_size = static_cast<uint16_t>(key.size()),
+                            .type = static_cast<uint8_t>(type),
+                            .reserved = {}};
+
+  const size_t begin = buffer_.size();
+  const auto header_bytes = std::as_bytes(std::span(&header, 1));
+  buffer_.insert(buffer_.end(), header_bytes.begin(), header_bytes.end());
+  buffer_.insert(buffer_.end(), AsBytes(key).begin(), AsBytes(key).end());
+  buffer_.insert(buffer_.end(), AsBytes(value).begin(), AsBytes(value).end());
+
+  const auto record = std::span(buffer_).subspan(begin);
+  const uint32_t checksum = Crc32c(record.subspan(sizeof(header.checksum)));
+  std::memcpy(record.data(), &checksum, sizeof(checksum));
+}
+
+Status WriteAheadLog::Flush() {
+  assert(!sync_);
+  if (auto st = WaitWrite(); !st.IsOk()) {
+    return st;
+  }
+
+  {
+    const std::lock_guard lock(mutex_);
+    if (error_.has_value()) {
+      return *error_;
+    }
+    if (buffer_.empty()) {
+      return Status::Ok();
+    }
+    StartWrite();
+  }
+
+  if (auto st = WaitWrite(); !st.IsOk()) {
+    return st;
+  }
+  return status();
+}
+
+Status WriteAheadLog::Reset() {
+  if (auto st = WaitWrite(); !st.IsOk()) {
+    return st;
+  }
+
+  // The changes of the buffered records are already in the datafile
+  std::vector<Callback<>> waiters;
+  {
+    const std::lock_guard lock(mutex_);
+    buffer_.clear();
+    waiters = std::exchange(waiters_, {});
+  }
+  for (const auto& callback : waiters) {
+    callback(Status::Ok());
+  }
+
+  auto st = os_->Await(
+      [&](const Callback<>& callback) { file_->Truncate(0, callback); });
+  if (!st.IsOk()) {
+    return st;
+  }
+
+  st = os_->Await([&](const Callback<>& callback) {
+    file_->Sync(File::SyncMode::kDataOnly, callback);
+  });
+  if (!st.IsOk()) {
+    return st;
+  }
+
+  const std::lock_guard lock(mutex_);
+  offset_ = 0;
+  error_.reset();
+  return Status::Ok();
+}
+
+int64_t WriteAheadLog::size() const {
+  const std::lock_guard lock(mutex_);
+  return offset_ + static_cast<int64_t>(inflight_.size() + buffer_.size());
+}
+
+Status WriteAheadLog::status() const {
+  const std::lock_guard lock(mutex_);
+  if (error_.has_value()) {
+    return *error_;
+  }
+  return Status::Ok();
+}
+
+Status WriteAheadLog::Close() {
+  if (auto st = WaitWrite(); !st.IsOk()) {
+    return st;
+  }
+  return file_->Close();
+}
+
+void WriteAheadLog::StartWrite() {
+  assert(!writing_ && !buffer_.empty());
+
+  writing_ = true;
+  inflight_.swap(buffer_);
+  inflight_waiters_.swap(waiters_);
+
+  file_->Write(inflight_, static_cast<off_t>(offset_),
+               [this](const Status& st) {
+                 if (!st.IsOk() || !sync_) {
+                   CompleteWrite(st);
+                   return;
+                 }
+
+                 file_->Sync(File::SyncMode::kDataOnly,
+                             [this](const Status& sync_st) {
+                               CompleteWrite(sync_st);
+                             });
+               });
+}
+
+void WriteAheadLog::CompleteWrite(const Status& status) {
+  std::vector<Callback<>> committed;
+  std::vector<Callback<>> failed;
+  std::optional<Status> error;
+  {
+    const std::lock_guard lock(mutex_);
+    writing_ = false;
+    if (status.IsOk()) {
+      offset_ += static_cast<int64_t>(inflight_.size());
+    } else if (!error_.has_value()) {
+      error_ = status;
+    }
+
+    inflight_.clear();
+    committed = std::exchange(inflight_waiters_, {});
+
+    if (error_.has_value()) {
+      buffer_.clear();
+      failed = std::exchange(waiters_, {});
+      if (!failed.empty()) {
+        error = error_;
+      }
+    } else if (!buffer_.empty() &&
+               (sync_ || buffer_.size() >= kLazyBufferSize)) {
+      // The records appended during the write form the next group
+      StartWrite();
+    }
+  }
+
+  for (const auto& callback : committed) {
+    callback(status);
+  }
+  for (const auto& callback : failed) {
+    callback(*error);
+  }
+}
+
+Status WriteAheadLog::WaitWrite() {
+  for (;;) {
+    {
+      const std::lock_guard lock(mutex_);
+      if (!writing_) {
+        return Status::Ok();
+      }
+    }
+    if (auto st = os_->Wait(); !st.IsOk()) {
+      return st;
+    }
+  }
+}
+
+}  // namespace NIMBLEDB_NAMESPACE
@@ -0,0 +1,135 @@
+// Copyright 2025 Nikolay Govorov. All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at LICENSE file in the root.
+
+#ifndef NIMBLEDB_WAL_H_
+#define NIMBLEDB_WAL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "nimbledb/base.h"
+#include "nimbledb/system.h"
+
+namespace NIMBLEDB_NAMESPACE {
+
+// Append-only log of the database modifications.
+//
+// Records are collected in memory and written with a single request. While a
+// write is in flight the following records wait in the buffer, so all commits
+// made during a log sync are made durable together by the next one (group
+// commit). The log is emptied by a checkpoint once the datafile contains all
+// the logged changes.
+//
+// Record layout: | crc32c | value size | lsn | key size | type | key | value |,
+// the checksum covers everything after itself. Records are numbered by log
+// sequence numbers (LSN) which keep growing after the log is emptied. A torn
+// record at the end of the log is ignored by the replay.
+//
+// The appends, resets and accessors must be serialized by the caller. The
+// write completions may be handled by any thread running the event loop, so
+// the log state they share is guarded by a mutex and the append callbacks are
+// invoked without it.
+class WriteAheadLog {
+ public:
+  // A batch record has no key, its value is the encoded WriteBatch
+  enum class RecordType : uint8_t { kPut = 1, kDelete = 2, kBatch = 3 };
+
+  using Apply = std::function<Status(RecordType type, std::string_view key,
+                                     std::string_view value)>;
+
+  // With `sync` each batch of records is followed by a fdatasync and the
+  // append callbacks wait for it. Otherwise records are written once enough
+  // of them have been buffered and the callbacks are invoked immediately.
+  static Status Open(OS* os, std::string_view filename, bool sync,
+                     std::unique_ptr<WriteAheadLog>* wal_ptr);
+
+  ~WriteAheadLog() = default;
+
+  WriteAheadLog(const WriteAheadLog&) = delete;
+  WriteAheadLog(WriteAheadLog&&) = delete;
+  WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+  WriteAheadLog& operator=(WriteAheadLog&&) = delete;
+
+  // Passes the complete records starting from `lsn` to `apply`, the records
+  // before it are already in the datafile. The following records are
+  // numbered after the replayed ones.
+  Status Replay(uint64_t lsn, const Apply& apply);
+
+  // Appends the record, the callback is invoked once it's durable in the
+  // sync mode and right away otherwise
+  void Append(RecordType type, std::string_view key, std::string_view value,
+              const Callback<>& callback);
+
+  // Appends the record without waiting for it, the log must not be in the
+  // sync mode. Fails if a previous write has failed.
+  Status Append(RecordType type, std::string_view key, std::string_view value);
+
+  // Writes the buffered records without a sync and waits for the write, the
+  // log must not be in the sync mode
+  Status Flush();
+
+  // Empties the log, the datafile must be synced with all logged changes
+  Status Reset();
+
+  Status Close();
+
+  // The LSN of the next appended record
+  [[nodiscard]] uint64_t lsn() const { return next_lsn_; }
+
+  // Bytes in the log including the buffered records
+  [[nodiscard]] int64_t size() const;
+
+  // The error of a failed write, all appends fail after it
+  [[nodiscard]] Status status() const;
+
+ private:
+  // Records are written without sync once the buffer reaches the limit, it
+  // bounds what a crash of the process loses before Flush()
+  static constexpr size_t kLazyBufferSize = 64 << 10;
+
+  WriteAheadLog(OS* os, std::unique_ptr<File> file, bool sync, int64_t size)
+      : os_(os), file_(std::move(file)), sync_(sync), offset_(size) {}
+
+  // Adds the record to the buffer, the mutex must be held
+  void BufferRecord(RecordType type, std::string_view key,
+                    std::string_view value);
+
+  // Submits the buffered records as a single write, the mutex must be held
+  void StartWrite();
+  void CompleteWrite(const Status& status);
+
+  // Runs the event loop until the in-flight write is complete
+  Status WaitWrite();
+
+  OS* os_ = nullptr;
+  std::unique_ptr<File> file_;
+
+  const bool sync_;
+
+  mutable std::mutex mutex_;
+
+  // The end of the written part of the log
+  int64_t offset_ = 0;
+  uint64_t next_lsn_ = 0;
+
+  std::vector<std::byte> buffer_;
+  std::vector<Callback<>> waiters_;
+
+  bool writing_ = false;
+  std::vector<std::byte> inflight_;
+  std::vector<Callback<>> inflight_waiters_;
+
+  // A failed write leaves a hole in the log, all following appends fail
+  std::optional<Status> error_;
+};
+
+}  // namespace NIMBLEDB_NAMESPACE
+
+#endif  // NIMBLEDB_WAL_H_
@@ -0,0 +1,89 @@
+// Copyright 2025 Nikolay Govorov. All rights reserved.
+// Licensed under the Apache License, Version 2.0 (the "License");
+// You may obtain a copy of the License at LICENSE file in the root.
+
+#include "nimbledb/db.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <string_view>
+#include <vector>
+
+#include "nimbledb/base.h"
+
+namespace NIMBLEDB_NAMESPACE {
+
+namespace {
+
+struct OpHeader {
+  uint32_t key_size;
+  uint32_t value_size;
+  uint8_t type;
+  std::array<uint8_t, 3> reserved;
+};
+
+// The header is copied into the buffer, it must not have padding bytes
+static_assert(sizeof(OpHeader) == 12);
+
+}  // namespace
+
+void WriteBatch::Put(std::string_view key, std::string_view value) {
+  Append(Type::kPut, key, value);
+}
+
+void WriteBatch::Delete(std::string_view key) {
+  Append(Type::kDelete, key, {});
+}
+
+void WriteBatch::Clear() {
+  rep_.clear();
+  count_ = 0;
+}
+
+void WriteBatch::Append(Type type, std::string_view key,
+                        std::string_view value) {
+  const OpHeader header{.key_size = static_cast<uint32_t>(key.size()),
+                        .value_size = static_cast<uint32_t>(value.size()),
+                        .type = static_cast<uint8_t>(type),
+                        .reserved = {}};
+
+  rep_.append(reinterpret_cast<const char*>(&header), sizeof(OpHeader));
+  rep_.append(key);
+  rep_.append(value);
+  count_ += 1;
+}
+
+// static
+Status WriteBatch::Decode(std::string_view rep, std::vector<Op>* ops) {
+  ops->clear();
+  for (size_t pos = 0; pos < rep.size();) {
+    OpHeader header;
+    if (rep.size() - pos < sizeof(OpHeader)) {
+      return Status::CorruptedDatafile(
+          "truncated write batch", std::format("header at offset {}", pos));
+    }
+    std::memcpy(&header, rep.data() + pos, sizeof(OpHeader));
+    pos += sizeof(OpHeader);
+
+    const auto type = static_cast<Type>(header.type);
+    if ((type != Type::kPut && type != Type::kDelete) ||
+        rep.size() - pos < size_t{header.key_size} + header.value_size) {
+      return Status::CorruptedDatafile(
+          "malformed write batch",
+          std::format("type {} at offset {}", header.type, pos));
+    }
+
+    const std::string_view key = rep.substr(pos, header.key_size);
+    const std::string_view value =
+        rep.substr(pos + header.key_size, header.value_size);
+    ops->push_back({.type = type, .key = key, .value = value});
+
+    pos += size_t{header.key_size} + header.value_size;
+  }
+  return Status::Ok();
+}
+
+}  // namespace NIMBLEDB_NAMESPACE